@@ -0,0 +1,64 @@
+#include "audio_device.h"
+
+#include <cassert>
+
+namespace
+{
+	// A buffer requested this many buffer lengths after the last one means the device ran dry
+	constexpr uint32_t kUnderrunFactor = 2;
+}
+
+namespace chip8
+{
+	AudioDevice::AudioDevice()
+	{
+		int result = SDL_InitSubSystem(SDL_INIT_AUDIO);
+		assert(result == 0);
+
+		SDL_AudioSpec desiredSpec = {};
+		SDL_AudioSpec obtainedSpec = {};
+
+		desiredSpec.format = AUDIO_F32SYS;
+		desiredSpec.channels = 1;
+		desiredSpec.callback = &RenderCallback;
+		desiredSpec.userdata = this;
+
+		mDevice = SDL_OpenAudioDevice(NULL, SDL_FALSE, &desiredSpec, &obtainedSpec, SDL_TRUE);
+		assert(mDevice > 0);
+
+		assert(obtainedSpec.format == AUDIO_F32SYS);
+		assert(obtainedSpec.channels == 1);
+		mFrequency = obtainedSpec.freq;
+
+		// Plays silence until a sound timer is attached
+		SDL_PauseAudioDevice(mDevice, false);
+	}
+
+	AudioDevice::~AudioDevice()
+	{
+		if (mDevice > 0)
+			SDL_CloseAudioDevice(mDevice);
+
+		SDL_QuitSubSystem(SDL_INIT_AUDIO);
+	}
+
+	void AudioDevice::RenderCallback(void* device, Uint8* buffer, int bufferLen)
+	{
+		assert(bufferLen >= 0);
+		assert(bufferLen % sizeof(float) == 0);
+		assert(device != nullptr);
+
+		AudioDevice* audioDevice = static_cast<AudioDevice*>(device);
+		float* samples = reinterpret_cast<float*>(buffer);
+		size_t sampleCount = bufferLen / sizeof(float);
+
+		// Each buffer should be asked for about as long after the previous one as it lasts
+		auto now = std::chrono::steady_clock::now();
+		auto bufferDuration = std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::seconds(1)) * sampleCount / audioDevice->mFrequency;
+		if (audioDevice->mLastRender.time_since_epoch().count() != 0 && now - audioDevice->mLastRender > bufferDuration * kUnderrunFactor)
+			audioDevice->mUnderruns.fetch_add(1, std::memory_order_relaxed);
+		audioDevice->mLastRender = now;
+
+		audioDevice->mMixer.Mix(samples, sampleCount);
+	}
+}
@@ -0,0 +1,54 @@
+#ifndef CHIP8_AUDIO_DEVICE_H
+#define CHIP8_AUDIO_DEVICE_H
+
+#include "audio_mixer.h"
+
+#include "SDL.h"
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+
+namespace chip8
+{
+	class SoundTimer;
+
+	// The audio output shared by every program run, which plays all of the sound timers attached
+	// at once. Opening a device is slow, and each has its own thread, so there's only the one.
+	class AudioDevice
+	{
+	public:
+		// Initialises the audio subsystem if need be
+		AudioDevice();
+		~AudioDevice();
+
+		AudioDevice(const AudioDevice&) = delete;
+		AudioDevice& operator=(const AudioDevice&) = delete;
+
+		// Sound timers played through the device have to render at this frequency
+		uint32_t GetFrequency() const { return mFrequency; }
+
+		// Mixed in with whatever else is playing, see AudioMixer. Returns false if there are too
+		// many already.
+		bool Attach(SoundTimer* soundTimer) { return mMixer.Attach(soundTimer); }
+		void Detach(SoundTimer* soundTimer) { mMixer.Detach(soundTimer); }
+
+		// Times the device asked for samples late enough that it must have run dry
+		uint64_t GetUnderruns() const { return mUnderruns.load(std::memory_order_relaxed); }
+
+	private:
+		static void RenderCallback(void* device, Uint8* buffer, int bufferLen);
+
+	private:
+		SDL_AudioDeviceID mDevice = 0;
+		uint32_t mFrequency = 0;
+
+		AudioMixer mMixer;
+
+		// Only used on the audio thread
+		std::chrono::steady_clock::time_point mLastRender;
+		std::atomic_uint64_t mUnderruns = 0;
+	};
+}
+
+#endif // CHIP8_AUDIO_DEVICE_H
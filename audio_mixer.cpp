@@ -0,0 +1,74 @@
+#include "audio_mixer.h"
+
+#include "sound_timer.h"
+
+#include <algorithm>
+#include <cassert>
+#include <thread>
+
+namespace chip8
+{
+	bool AudioMixer::Attach(SoundTimer* soundTimer)
+	{
+		assert(soundTimer != nullptr);
+
+		for (size_t index = 0; index < kMaxVoices; index++)
+		{
+			SoundTimer* expected = nullptr;
+			if (!mVoices[index].compare_exchange_strong(expected, soundTimer))
+				continue;
+
+			size_t end = mVoiceEnd.load();
+			while (end < index + 1 && !mVoiceEnd.compare_exchange_weak(end, index + 1))
+			{
+			}
+			return true;
+		}
+
+		return false;
+	}
+
+	void AudioMixer::Detach(SoundTimer* soundTimer)
+	{
+		size_t end = mVoiceEnd.load();
+		for (size_t index = 0; index < end; index++)
+		{
+			SoundTimer* expected = soundTimer;
+			if (mVoices[index].compare_exchange_strong(expected, nullptr))
+				break;
+		}
+
+		// A mix already under way may have read the voice before it was cleared. It's short, so
+		// just wait for it to finish rather than making the audio thread take a lock.
+		uint64_t sequence = mMixSequence.load();
+		if (sequence % 2 == 1)
+		{
+			while (mMixSequence.load() == sequence)
+				std::this_thread::yield();
+		}
+	}
+
+	void AudioMixer::Mix(float* buffer, size_t bufferLen)
+	{
+		std::fill_n(buffer, bufferLen, 0.f);
+
+		mMixSequence.fetch_add(1);
+
+		size_t audible = 0;
+		size_t end = mVoiceEnd.load();
+		for (size_t index = 0; index < end; index++)
+		{
+			if (SoundTimer* soundTimer = mVoices[index].load())
+				audible += soundTimer->Mix(buffer, bufferLen) ? 1 : 0;
+		}
+
+		mMixSequence.fetch_add(1);
+
+		// Voices buzzing at once add up past full scale
+		if (audible > 1)
+		{
+			for (size_t sample = 0; sample < bufferLen; sample++)
+				buffer[sample] = std::min(std::max(buffer[sample], -1.f), 1.f);
+		}
+	}
+}
@@ -0,0 +1,42 @@
+#ifndef CHIP8_AUDIO_MIXER_H
+#define CHIP8_AUDIO_MIXER_H
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+namespace chip8
+{
+	class SoundTimer;
+
+	// Sums the sound timers of every program running into one buffer. Mix is called on the
+	// audio thread, Attach and Detach from anywhere, and neither side ever waits on a lock: voices
+	// are claimed slots in a fixed table.
+	class AudioMixer
+	{
+	public:
+		// More programs than this can run, the rest are silent
+		static constexpr size_t kMaxVoices = 256;
+
+		// Returns false if every voice is taken
+		bool Attach(SoundTimer* soundTimer);
+
+		// Once this returns the timer won't be mixed again, so it can be destroyed
+		void Detach(SoundTimer* soundTimer);
+
+		// Overwrites buffer with the voices summed, clipped to [-1, 1]
+		void Mix(float* buffer, size_t bufferLen);
+
+	private:
+		std::array<std::atomic<SoundTimer*>, kMaxVoices> mVoices{};
+
+		// One past the highest voice ever attached, so Mix doesn't scan the whole table
+		std::atomic<size_t> mVoiceEnd = 0;
+
+		// Incremented before and after each Mix, so odd while the voices are being read
+		std::atomic<uint64_t> mMixSequence = 0;
+	};
+}
+
+#endif // CHIP8_AUDIO_MIXER_H
@@ -0,0 +1,335 @@
+#include "audio_mixer.h"
+#include "display.h"
+#include "image.h"
+#include "log.h"
+#include "program.h"
+#include "sound_timer.h"
+#include "timer.h"
+
+#include "SDL.h"
+#include "SDL_main.h"
+
+#include <algorithm>
+#include <cassert>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <initializer_list>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace
+{
+	using ClockType = std::chrono::steady_clock;
+
+	constexpr char kDefaultOutputFile[] = "chip8_bench.json";
+
+	// Each benchmark is run this many times after a warm up, and the median taken
+	constexpr int kRepetitions = 7;
+
+	constexpr uint32_t kAudioFrequency = 44100;
+
+	struct Result
+	{
+		std::string name;
+		uint64_t operations;
+		double nanosecondsPerOperation;
+	};
+
+	std::vector<Result> sResults;
+
+	// Stops the compiler optimising away work whose result is otherwise unused
+	volatile uint64_t sSink = 0;
+
+	template <typename Function>
+	void Measure(const std::string& name, uint64_t operations, Function&& function)
+	{
+		function();
+
+		std::vector<double> samples;
+		for (int repetition = 0; repetition < kRepetitions; repetition++)
+		{
+			ClockType::time_point start = ClockType::now();
+			function();
+			ClockType::duration duration = ClockType::now() - start;
+
+			samples.push_back(std::chrono::duration<double, std::nano>(duration).count() / operations);
+		}
+
+		std::sort(samples.begin(), samples.end());
+		double median = samples[samples.size() / 2];
+
+		LOG("%-36s %12.2f ns/op", name.c_str(), median);
+		sResults.push_back({ name, operations, median });
+	}
+
+	std::vector<uint8_t> Assemble(std::initializer_list<uint16_t> opcodes)
+	{
+		std::vector<uint8_t> program;
+		for (uint16_t opcode : opcodes)
+		{
+			program.push_back(opcode >> 8);
+			program.push_back(opcode & 0xFF);
+		}
+		return program;
+	}
+
+	struct SyntheticProgram
+	{
+		const char* name;
+		std::vector<uint8_t> program;
+	};
+
+	// Small looping programs, each stressing one group of opcodes. Each loop changes a register
+	// every time round, otherwise the interpreter would skip it as idle.
+	std::vector<SyntheticProgram> SyntheticPrograms()
+	{
+		return {
+			{ "alu", Assemble({
+				0x6005, 0x6103, 0x7001, 0x8010, 0x8011, 0x8012, 0x8013, 0x8014,
+				0x8015, 0x8226, 0x822E, 0x7E01, 0x7101, 0x3000, 0x7101, 0x1204,
+			}) },
+			{ "call", Assemble({
+				0x2206, 0x2206, 0x1200, 0x00EE,
+			}) },
+			{ "draw", Assemble({
+				0xA000, 0x6000, 0x6100, 0xD015, 0x6008, 0xD01A, 0x603C, 0x610A,
+				0xD01F, 0x1200,
+			}) },
+			{ "memory", Assemble({
+				0xA300, 0x60FF, 0xF033, 0xF265, 0xF029, 0xA300, 0xF255, 0x1200,
+			}) },
+			{ "timer", Assemble({
+				0x60FF, 0xF015, 0xF107, 0x7201, 0x3100, 0x1204, 0x1200,
+			}) },
+			{ "mixed", Assemble({
+				0x6005, 0x6103, 0x8014, 0x8115, 0x2220, 0xA000, 0x6000, 0x6100,
+				0xD015, 0xA300, 0xF233, 0xF265, 0x1200, 0x1200, 0x1200, 0x1200,
+				0xC2FF, 0x7201, 0x00EE,
+			}) },
+		};
+	}
+
+	void BenchmarkProgram()
+	{
+		constexpr uint32_t kMicroOpcodes = 100000;
+		constexpr uint32_t kMacroOpcodes = 10000000;
+
+		for (const SyntheticProgram& synthetic : SyntheticPrograms())
+		{
+			chip8::Program program(chip8::Image(synthetic.program.data(), synthetic.program.size()));
+			Measure(std::string("program/execute/") + synthetic.name, kMicroOpcodes, [&]() {
+				program.Execute(kMicroOpcodes);
+			});
+		}
+
+		for (const SyntheticProgram& synthetic : SyntheticPrograms())
+		{
+			if (std::string(synthetic.name) != "mixed")
+				continue;
+
+			chip8::Program program(chip8::Image(synthetic.program.data(), synthetic.program.size()));
+			Measure("program/execute/mixed/long", kMacroOpcodes, [&]() {
+				program.Execute(kMacroOpcodes);
+			});
+		}
+	}
+
+	void BenchmarkDraw()
+	{
+		constexpr uint32_t kDraws = 100000;
+		const uint8_t sprite[15] = {
+			0xFF, 0x81, 0xBD, 0xA5, 0xA5, 0xBD, 0x81, 0xFF,
+			0x18, 0x3C, 0x7E, 0xFF, 0x7E, 0x3C, 0x18,
+		};
+
+		for (uint8_t height : { 1, 5, 8, 15 })
+		{
+			for (uint8_t x : { 0, 3, 8, 60 })
+			{
+				chip8::Display display;
+				Measure("display/draw/h" + std::to_string(height) + "/x" + std::to_string(x), kDraws, [&]() {
+					uint64_t flipped = 0;
+					for (uint32_t i = 0; i < kDraws; i++)
+						flipped += display.Draw(x, i % (33 - height), height, sprite);
+					sSink = sSink + flipped;
+				});
+			}
+		}
+	}
+
+	void BenchmarkRender(SDL_Renderer* renderer)
+	{
+		constexpr uint32_t kRenders = 100;
+
+		// One row of sprite data for each fill level
+		struct FillLevel
+		{
+			const char* name;
+			uint8_t pattern;
+		};
+		constexpr FillLevel kFillLevels[] = {
+			{ "0", 0x00 },
+			{ "25", 0x88 },
+			{ "50", 0xAA },
+			{ "100", 0xFF },
+		};
+
+		for (const FillLevel& level : kFillLevels)
+		{
+			chip8::Display display;
+			const uint8_t sprite[16] = {
+				level.pattern, level.pattern, level.pattern, level.pattern, level.pattern, level.pattern, level.pattern, level.pattern,
+				level.pattern, level.pattern, level.pattern, level.pattern, level.pattern, level.pattern, level.pattern, level.pattern,
+			};
+			for (uint8_t x = 0; x < 64; x += 8)
+			{
+				display.Draw(x, 0, 15, sprite);
+				display.Draw(x, 15, 15, sprite);
+				display.Draw(x, 30, 2, sprite);
+			}
+
+			Measure(std::string("display/render/fill") + level.name, kRenders, [&]() {
+				for (uint32_t i = 0; i < kRenders; i++)
+					display.Render(renderer);
+			});
+		}
+	}
+
+	void BenchmarkTimer()
+	{
+		constexpr uint32_t kReads = 1000000;
+
+		chip8::Timer timer;
+		timer.SetValue(255, chip8::Timer::ClockType::now());
+		Measure("timer/get_value", kReads, [&]() {
+			uint64_t total = 0;
+			for (uint32_t i = 0; i < kReads; i++)
+				total += timer.GetValue(chip8::Timer::ClockType::now());
+			sSink = sSink + total;
+		});
+	}
+
+	void BenchmarkSound()
+	{
+		constexpr uint32_t kCallbacks = 1000;
+
+		for (size_t bufferLen : { 256, 512, 1024, 4096 })
+		{
+			chip8::AudioMixer mixer;
+			chip8::SoundTimer soundTimer(kAudioFrequency);
+			mixer.Attach(&soundTimer);
+			std::vector<float> buffer(bufferLen);
+
+			Measure("sound/render/silent/" + std::to_string(bufferLen), kCallbacks, [&]() {
+				for (uint32_t i = 0; i < kCallbacks; i++)
+					mixer.Mix(buffer.data(), buffer.size());
+			});
+
+			Measure("sound/render/playing/" + std::to_string(bufferLen), kCallbacks, [&]() {
+				for (uint32_t i = 0; i < kCallbacks; i++)
+				{
+					soundTimer.SetValue(255);
+					mixer.Mix(buffer.data(), buffer.size());
+				}
+			});
+
+			mixer.Detach(&soundTimer);
+		}
+
+		// A minute of buzzing, as the audio device would request it
+		{
+			chip8::AudioMixer mixer;
+			chip8::SoundTimer soundTimer(kAudioFrequency);
+			mixer.Attach(&soundTimer);
+			std::vector<float> buffer(512);
+			constexpr uint32_t kMinuteCallbacks = 60 * kAudioFrequency / 512;
+			Measure("sound/render/playing/minute", kMinuteCallbacks, [&]() {
+				for (uint32_t i = 0; i < kMinuteCallbacks; i++)
+				{
+					if (i % 60 == 0)
+						soundTimer.SetValue(255);
+					mixer.Mix(buffer.data(), buffer.size());
+				}
+			});
+			mixer.Detach(&soundTimer);
+		}
+
+		// A grid of programs all buzzing, with all but one muted as in a multi-session
+		for (size_t voiceCount : { 16, 256 })
+		{
+			chip8::AudioMixer mixer;
+			std::vector<std::unique_ptr<chip8::SoundTimer>> soundTimers;
+			for (size_t voice = 0; voice < voiceCount; voice++)
+			{
+				soundTimers.push_back(std::make_unique<chip8::SoundTimer>(kAudioFrequency));
+				soundTimers.back()->SetMuted(voice != 0);
+				mixer.Attach(soundTimers.back().get());
+			}
+
+			std::vector<float> buffer(512);
+			Measure("sound/mix/voices" + std::to_string(voiceCount) + "/512", kCallbacks, [&]() {
+				for (uint32_t i = 0; i < kCallbacks; i++)
+				{
+					for (const std::unique_ptr<chip8::SoundTimer>& soundTimer : soundTimers)
+						soundTimer->SetValue(255);
+					mixer.Mix(buffer.data(), buffer.size());
+				}
+			});
+
+			for (const std::unique_ptr<chip8::SoundTimer>& soundTimer : soundTimers)
+				mixer.Detach(soundTimer.get());
+		}
+	}
+
+	void WriteResults(const char* path)
+	{
+		FILE* file = fopen(path, "w");
+		assert(file != nullptr);
+		if (file == nullptr)
+			return;
+
+		fprintf(file, "{\n\t\"benchmarks\": [");
+		for (size_t i = 0; i < sResults.size(); i++)
+		{
+			const Result& result = sResults[i];
+			fprintf(file, "%s\n\t\t{ \"name\": \"%s\", \"operations\": %llu, \"nanosecondsPerOperation\": %.3f, \"operationsPerSecond\": %.0f }",
+				i == 0 ? "" : ",",
+				result.name.c_str(),
+				static_cast<unsigned long long>(result.operations),
+				result.nanosecondsPerOperation,
+				1e9 / result.nanosecondsPerOperation);
+		}
+		fprintf(file, "\n\t]\n}\n");
+
+		fclose(file);
+	}
+}
+
+int main(int argc, char* argv[])
+{
+	// Programs are created without an audio device, and nothing else needs a subsystem
+	int result = SDL_Init(0);
+	assert(result == 0);
+
+	// Render to memory so that the results don't depend on the display
+	SDL_Surface* surface = SDL_CreateRGBSurfaceWithFormat(0, 640, 320, 32, SDL_PIXELFORMAT_ARGB8888);
+	assert(surface != nullptr);
+	SDL_Renderer* renderer = SDL_CreateSoftwareRenderer(surface);
+	assert(renderer != nullptr);
+
+	BenchmarkProgram();
+	BenchmarkDraw();
+	BenchmarkRender(renderer);
+	BenchmarkTimer();
+	BenchmarkSound();
+
+	WriteResults(argc > 1 ? argv[1] : kDefaultOutputFile);
+
+	SDL_DestroyRenderer(renderer);
+	SDL_FreeSurface(surface);
+	SDL_Quit();
+
+	return 0;
+}
@@ -0,0 +1,120 @@
+#include "image.h"
+#include "log.h"
+#include "program.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <fstream>
+#include <iterator>
+#include <vector>
+
+// Fuzzing entry point for the interpreter, for libFuzzer or any engine that calls
+// LLVMFuzzerTestOneInput. Without CHIP8_LIBFUZZER this builds a standalone runner
+// instead, which replays the inputs given on the command line.
+//
+// Input layout:
+//   2 bytes     ROM size, big endian (clamped to the bytes available)
+//   ROM         loaded at the image start offset
+//   script      pairs of (steps, key) - run steps * kOpcodesPerStep opcodes, then
+//               press (bit 4 set) or release key & 0xF
+//
+// A single headless program is reset to a blank snapshot between inputs, so each run
+// only costs restoring 4K of memory rather than constructing a new program.
+
+namespace
+{
+	// Total opcodes executed per input
+	constexpr uint32_t kOpcodeBudget = 4096;
+
+	constexpr uint32_t kOpcodesPerStep = 16;
+
+	constexpr uint8_t kKeyMask = 0x0F;
+	constexpr uint8_t kKeyDown = 0x10;
+
+	chip8::Program& GetProgram()
+	{
+		static chip8::Program sProgram(chip8::Image(nullptr, 0));
+		return sProgram;
+	}
+
+	const chip8::Program::Snapshot& GetBlankSnapshot()
+	{
+		// Emulated time and the fixed seed saved with it make every run of an input the same
+		static const chip8::Program::Snapshot sSnapshot = []() {
+			GetProgram().UseEmulatedTime();
+			return GetProgram().Save();
+		}();
+		return sSnapshot;
+	}
+
+	chip8::Program::Fault Run(const uint8_t* data, size_t size)
+	{
+		chip8::Program& program = GetProgram();
+		program.Restore(GetBlankSnapshot());
+
+		if (size < 2)
+			return chip8::Program::Fault::None;
+
+		uint16_t startOffset = program.GetProgramCounter();
+		size_t romSize = (static_cast<size_t>(data[0]) << 8) | data[1];
+		romSize = std::min({ romSize, size - 2, chip8::Image::Size() - startOffset });
+		program.WriteMemory(startOffset, data + 2, romSize);
+
+		const uint8_t* script = data + 2 + romSize;
+		const uint8_t* scriptEnd = data + size;
+
+		uint32_t remaining = kOpcodeBudget;
+		while (remaining > 0 && program.GetFault() == chip8::Program::Fault::None)
+		{
+			uint32_t opcodeCount = remaining;
+			if (scriptEnd - script >= 2)
+			{
+				opcodeCount = std::min<uint32_t>(script[0] * kOpcodesPerStep, remaining);
+				program.SetKeyState(script[1] & kKeyMask, (script[1] & kKeyDown) != 0);
+				script += 2;
+			}
+
+			program.Execute(opcodeCount);
+			remaining -= opcodeCount;
+		}
+
+		return program.GetFault();
+	}
+}
+
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t* data, size_t size)
+{
+	Run(data, size);
+	return 0;
+}
+
+#ifndef CHIP8_LIBFUZZER
+int main(int argc, char* argv[])
+{
+	if (argc < 2)
+	{
+		LOG("Usage: %s <input>...", argv[0]);
+		return 1;
+	}
+
+	for (int i = 1; i < argc; i++)
+	{
+		std::ifstream input(argv[i], std::ios::binary);
+		if (!input)
+		{
+			LOG_ERROR("Unable to open %s", argv[i]);
+			return 1;
+		}
+		std::vector<uint8_t> data{ std::istreambuf_iterator<char>(input), std::istreambuf_iterator<char>() };
+
+		chip8::Program::Fault fault = Run(data.data(), data.size());
+		chip8::Program& program = GetProgram();
+		if (fault == chip8::Program::Fault::None)
+			LOG("%s: ran to completion", argv[i]);
+		else
+			LOG("%s: %s at %03X", argv[i], chip8::Program::FaultName(fault), program.GetFaultAddress());
+	}
+
+	return 0;
+}
+#endif
@@ -0,0 +1,96 @@
+#include "image.h"
+#include "log.h"
+#include "rom_profile.h"
+#include "worker_pool.h"
+
+#include "SDL_main.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cinttypes>
+#include <filesystem>
+#include <string>
+#include <vector>
+
+// Finds the quirks and opcode rate for a collection of ROMs ahead of time, the same way the
+// emulator does when it loads a ROM it hasn't seen before (see rom_profile.h), and stores them
+// in the profiles file the emulator reads.
+//
+// Usage: chip8_profile <profiles> <rom or directory>...
+//
+// Directories are searched for .ch8 files, including those below. ROMs already in the profiles
+// file are skipped, as are those too big for memory.
+
+namespace
+{
+	constexpr char kImageExtension[] = ".ch8";
+
+	void AddRoms(const std::filesystem::path& path, std::vector<std::filesystem::path>& roms)
+	{
+		if (!std::filesystem::is_directory(path))
+		{
+			roms.push_back(path);
+			return;
+		}
+
+		for (const auto& entry : std::filesystem::recursive_directory_iterator(path))
+		{
+			if (entry.is_regular_file() && entry.path().extension() == kImageExtension)
+				roms.push_back(entry.path());
+		}
+	}
+}
+
+int main(int argc, char* argv[])
+{
+	if (argc < 3)
+	{
+		LOG("Usage: %s <profiles> <rom or directory>...", argv[0]);
+		return 1;
+	}
+
+	std::vector<std::filesystem::path> roms;
+	for (int arg = 2; arg < argc; arg++)
+		AddRoms(argv[arg], roms);
+	std::sort(roms.begin(), roms.end());
+
+	chip8::RomProfiles profiles(argv[1]);
+	chip8::WorkerPool workers;
+
+	// Each ROM's trials are spread across the workers, so the ROMs themselves go one at a time
+	auto start = std::chrono::steady_clock::now();
+	size_t detected = 0;
+	for (const std::filesystem::path& rom : roms)
+	{
+		// Larger SCHIP and XO-CHIP ROMs turn up in collections too
+		std::error_code error;
+		uintmax_t size = std::filesystem::file_size(rom, error);
+		if (error || size == 0 || size > chip8::Image::Size() - chip8::Image::StartOffset())
+		{
+			LOG_WARNING("%s: not a ROM which fits in memory, skipped", rom.string().c_str());
+			continue;
+		}
+
+		chip8::Image image(rom);
+		uint64_t hash = chip8::RomProfiles::Hash(image);
+
+		chip8::RomProfile profile;
+		if (profiles.Find(hash, profile))
+			continue;
+
+		if (!chip8::DetectProfile(image, workers, profile))
+		{
+			LOG_WARNING("%s: every trial faulted, not stored", rom.string().c_str());
+			continue;
+		}
+
+		profiles.Store(hash, profile);
+		detected++;
+
+		LOG("%s: quirks %" PRIu32 " at %" PRIu32 " opcodes a second", rom.string().c_str(), profile.quirks.Index(), profile.opcodeRate);
+	}
+
+	double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	LOG("Profiled %zu of %zu ROMs in %.2fs on %zu threads", detected, roms.size(), seconds, workers.ThreadCount());
+	return 0;
+}
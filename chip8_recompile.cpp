@@ -0,0 +1,379 @@
+#include "image.h"
+#include "log.h"
+
+#include <cassert>
+#include <cstdio>
+#include <fstream>
+#include <iterator>
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+
+// Recompiles a ROM ahead of time into a C++ translation unit, see native_program.h.
+//
+// Usage: chip8_recompile <rom.ch8> <output.cpp>
+//
+// Control flow is followed from the image start offset. Every jump target, call, return
+// site and skip destination starts a basic block, and each block becomes a label in a
+// single function operating directly on the Program's registers. Returns and BNNN jumps
+// go through a switch over the recompiled block addresses, which hands back to the
+// interpreter for anything else.
+//
+// Only the ROM itself is followed. The zeroes after it would decode as 0NNN and fall through
+// to the end of memory, and ordinary writes to buffers there would then count as writes over
+// the code.
+
+namespace
+{
+	struct Instruction
+	{
+		uint16_t address;
+		uint16_t opcode;
+	};
+
+	struct Block
+	{
+		std::vector<Instruction> instructions;
+	};
+
+	class Recompiler
+	{
+	public:
+		Recompiler(chip8::Image& image, size_t romSize)
+			: mImage(image)
+			, mRomEnd(chip8::Image::StartOffset() + romSize)
+		{
+		}
+
+		void Analyse()
+		{
+			// Find every block start, following all statically known control flow
+			std::vector<uint16_t> pending{ mImage.StartOffset() };
+			std::set<uint16_t> visited;
+
+			while (!pending.empty())
+			{
+				uint16_t address = pending.back();
+				pending.pop_back();
+
+				if (!IsDecodable(address) || !visited.insert(address).second)
+					continue;
+
+				uint16_t opcode = Decode(address);
+				mCode.insert(address);
+
+				std::vector<uint16_t> successors;
+				bool endsBlock = Successors(address, opcode, successors);
+				for (uint16_t successor : successors)
+				{
+					if (endsBlock)
+						mLeaders.insert(successor);
+					pending.push_back(successor);
+				}
+			}
+
+			mLeaders.insert(mImage.StartOffset());
+
+			// Then split the code into blocks
+			for (uint16_t leader : mLeaders)
+			{
+				if (!IsDecodable(leader))
+					continue;
+
+				Block& block = mBlocks[leader];
+				uint16_t address = leader;
+				while (true)
+				{
+					uint16_t opcode = Decode(address);
+					block.instructions.push_back({ address, opcode });
+
+					std::vector<uint16_t> successors;
+					if (Successors(address, opcode, successors))
+						break;
+
+					address += 2;
+					if (mLeaders.count(address) > 0 || !IsDecodable(address))
+						break;
+				}
+			}
+		}
+
+		void Write(FILE* file, const std::string& source, const std::vector<uint8_t>& rom)
+		{
+			fprintf(file, "// Generated by chip8_recompile from %s, do not edit.\n\n", source.c_str());
+			fprintf(file, "#include \"native_program.h\"\n\n");
+			fprintf(file, "namespace\n{\n");
+
+			// The ROM, so that only matching programs use this code
+			fprintf(file, "\tconst uint8_t kRom[] = {");
+			for (size_t i = 0; i < rom.size(); i++)
+				fprintf(file, "%s0x%02X,", i % 16 == 0 ? "\n\t\t" : " ", rom[i]);
+			fprintf(file, "\n\t};\n\n");
+
+			// Map of the bytes which have been recompiled, writing to any of them stops the native code being used
+			std::vector<uint8_t> codeMap(chip8::Image::Size() / 8, 0);
+			for (uint16_t address : mCode)
+			{
+				for (size_t byte = address; byte < address + 2u; byte++)
+					codeMap[byte / 8] |= 1u << (byte % 8);
+			}
+			fprintf(file, "\tconst uint8_t kCodeMap[] = {");
+			for (size_t i = 0; i < codeMap.size(); i++)
+				fprintf(file, "%s0x%02X,", i % 16 == 0 ? "\n\t\t" : " ", codeMap[i]);
+			fprintf(file, "\n\t};\n\n");
+
+			fprintf(file, "\tuint32_t Run(chip8::Program& program, uint32_t opcodeCount)\n\t{\n");
+			fprintf(file, "\t\tusing chip8::NativeProgram;\n\n");
+			// Not every ROM uses every register
+			fprintf(file, "\t\t[[maybe_unused]] uint8_t* v = NativeProgram::Registers(program);\n");
+			fprintf(file, "\t\t[[maybe_unused]] uint16_t& address = NativeProgram::AddressRegister(program);\n");
+			fprintf(file, "\t\tuint16_t& pc = NativeProgram::ProgramCounter(program);\n");
+			fprintf(file, "\t\t[[maybe_unused]] chip8::Stack& stack = NativeProgram::Stack(program);\n");
+			fprintf(file, "\t\tuint32_t executed = 0;\n\n");
+
+			// Going round the loop dispatches on the program counter, so there's no label to go unused
+			fprintf(file, "\t\tfor (;;)\n\t\t{\n");
+			fprintf(file, "\t\tswitch (pc)\n\t\t{\n");
+			for (const auto& [start, block] : mBlocks)
+				fprintf(file, "\t\tcase 0x%03X: goto block_%03X;\n", start, start);
+			fprintf(file, "\t\tdefault: return executed;\n\t\t}\n");
+
+			for (const auto& [start, block] : mBlocks)
+				WriteBlock(file, start, block);
+
+			fprintf(file, "\t\t}\n");
+			fprintf(file, "\t}\n\n");
+
+			fprintf(file, "\tconst bool sRegistered = chip8::NativeProgram::Register({ kRom, sizeof(kRom), kCodeMap, &Run });\n");
+			fprintf(file, "}\n");
+		}
+
+		size_t BlockCount() const { return mBlocks.size(); }
+
+	private:
+		bool IsDecodable(uint32_t address) const
+		{
+			return address >= chip8::Image::StartOffset() && address + 2 <= mRomEnd;
+		}
+
+		uint16_t Decode(uint16_t address) const
+		{
+			return (static_cast<uint16_t>(mImage[address]) << 8) + mImage[address + 1];
+		}
+
+		// Adds the statically known successors of an instruction, and returns whether it ends a block
+		static bool Successors(uint16_t address, uint16_t opcode, std::vector<uint16_t>& successors)
+		{
+			uint16_t next = address + 2;
+			uint16_t target = opcode & 0x0FFF;
+
+			switch (opcode >> 12)
+			{
+			case 0x0:
+				if (opcode == 0x00EE)
+					return true; // Return sites are added by the call
+				break;
+			case 0x1:
+				successors.push_back(target);
+				return true;
+			case 0x2:
+				successors.push_back(target);
+				successors.push_back(next);
+				return true;
+			case 0x3:
+			case 0x4:
+				successors.push_back(next);
+				successors.push_back(next + 2);
+				return true;
+			case 0x5:
+			case 0x9:
+				if ((opcode & 0x000F) == 0)
+				{
+					successors.push_back(next);
+					successors.push_back(next + 2);
+					return true;
+				}
+				break;
+			case 0xB:
+				return true; // Computed, resolved at run time
+			case 0xE:
+				if ((opcode & 0xFF) == 0x9E || (opcode & 0xFF) == 0xA1)
+				{
+					successors.push_back(next);
+					successors.push_back(next + 2);
+					return true;
+				}
+				break;
+			}
+
+			successors.push_back(next);
+			return false;
+		}
+
+		std::string Goto(uint32_t address) const
+		{
+			char label[32];
+			if (mBlocks.count(address) > 0)
+				snprintf(label, sizeof(label), "goto block_%03X;", address);
+			else
+				snprintf(label, sizeof(label), "continue;");
+			return label;
+		}
+
+		void WriteBlock(FILE* file, uint16_t start, const Block& block)
+		{
+			size_t count = block.instructions.size();
+
+			fprintf(file, "\n\tblock_%03X:\n", start);
+			fprintf(file, "\t\tif (opcodeCount - executed < %zu)\n\t\t\treturn executed;\n", count);
+			fprintf(file, "\t\texecuted += %zu;\n", count);
+
+			for (size_t index = 0; index < count; index++)
+			{
+				const Instruction& instruction = block.instructions[index];
+				size_t remaining = count - index - 1;
+
+				uint16_t opcode = instruction.opcode;
+				uint16_t next = instruction.address + 2;
+				uint8_t x = (opcode & 0x0F00) >> 8;
+				uint8_t y = (opcode & 0x00F0) >> 4;
+				uint8_t value = opcode & 0x00FF;
+				uint16_t target = opcode & 0x0FFF;
+
+				fprintf(file, "\t\t// %03X: %04X\n", instruction.address, opcode);
+				fprintf(file, "\t\tpc = 0x%03X;\n", next);
+
+				switch (opcode >> 12)
+				{
+				case 0x0:
+					if (opcode == 0x00EE)
+					{
+						// Leave returning from an empty stack to the interpreter, which reports the fault
+						fprintf(file, "\t\tif (stack.Empty())\n\t\t{\n\t\t\tpc = 0x%03X;\n\t\t\treturn executed - %zu;\n\t\t}\n",
+							instruction.address, remaining + 1);
+						fprintf(file, "\t\tpc = stack.Pop();\n");
+						fprintf(file, "\t\tcontinue;\n");
+						continue;
+					}
+					break;
+				case 0x1:
+					fprintf(file, "\t\tpc = 0x%03X;\n\t\t%s\n", target, Goto(target).c_str());
+					continue;
+				case 0x2:
+					// As is calling with a full stack
+					fprintf(file, "\t\tif (stack.Full())\n\t\t{\n\t\t\tpc = 0x%03X;\n\t\t\treturn executed - %zu;\n\t\t}\n",
+						instruction.address, remaining + 1);
+					fprintf(file, "\t\tstack.Push(pc);\n");
+					fprintf(file, "\t\tpc = 0x%03X;\n\t\t%s\n", target, Goto(target).c_str());
+					continue;
+				case 0x3:
+				case 0x4:
+					fprintf(file, "\t\tif (v[0x%X] %s 0x%02X)\n\t\t{\n\t\t\tpc = 0x%03X;\n\t\t\t%s\n\t\t}\n\t\t%s\n",
+						x, (opcode >> 12) == 0x3 ? "==" : "!=", value, next + 2, Goto(next + 2).c_str(), Goto(next).c_str());
+					continue;
+				case 0x5:
+				case 0x9:
+					if ((opcode & 0x000F) == 0)
+					{
+						fprintf(file, "\t\tif (v[0x%X] %s v[0x%X])\n\t\t{\n\t\t\tpc = 0x%03X;\n\t\t\t%s\n\t\t}\n\t\t%s\n",
+							x, (opcode >> 12) == 0x5 ? "==" : "!=", y, next + 2, Goto(next + 2).c_str(), Goto(next).c_str());
+						continue;
+					}
+					break;
+				case 0x6:
+					fprintf(file, "\t\tv[0x%X] = 0x%02X;\n", x, value);
+					continue;
+				case 0x7:
+					fprintf(file, "\t\tv[0x%X] += 0x%02X;\n", x, value);
+					continue;
+				case 0x8:
+					// The others depend on the quirks the program was loaded with
+					if ((opcode & 0xF) == 0x0)
+					{
+						fprintf(file, "\t\tv[0x%X] = v[0x%X];\n", x, y);
+						continue;
+					}
+					break;
+				case 0xA:
+					fprintf(file, "\t\taddress = 0x%03X;\n", target);
+					continue;
+				case 0xF:
+					if ((opcode & 0xFF) == 0x1E)
+					{
+						fprintf(file, "\t\taddress += v[0x%X];\n", x);
+						continue;
+					}
+					break;
+				}
+
+				// Everything else is left to the interpreter
+				fprintf(file, "\t\tNativeProgram::ExecuteOpcode(program, 0x%04X);\n", opcode);
+
+				// Jumps and skips left to the interpreter have moved the program counter
+				bool isSkip = (opcode >> 12) == 0xE && ((opcode & 0xFF) == 0x9E || (opcode & 0xFF) == 0xA1);
+				if ((opcode >> 12) == 0xB || isSkip)
+				{
+					fprintf(file, "\t\tcontinue;\n");
+					continue;
+				}
+
+				// Faults and writes over recompiled code stop the native code
+				fprintf(file, "\t\tif (NativeProgram::Stopped(program))\n\t\t\treturn executed - %zu;\n", remaining);
+			}
+
+			// Fall through to the next block
+			const Instruction& last = block.instructions.back();
+			std::vector<uint16_t> successors;
+			if (!Successors(last.address, last.opcode, successors))
+				fprintf(file, "\t\t%s\n", Goto(last.address + 2).c_str());
+		}
+
+	private:
+		chip8::Image& mImage;
+		uint32_t mRomEnd;
+
+		std::set<uint16_t> mCode;
+		std::set<uint16_t> mLeaders;
+		std::map<uint16_t, Block> mBlocks;
+	};
+}
+
+int main(int argc, char* argv[])
+{
+	if (argc != 3)
+	{
+		LOG("Usage: %s <rom.ch8> <output.cpp>", argv[0]);
+		return 1;
+	}
+
+	std::ifstream input(argv[1], std::ios::binary);
+	if (!input)
+	{
+		LOG_ERROR("Unable to open %s", argv[1]);
+		return 1;
+	}
+	std::vector<uint8_t> rom{ std::istreambuf_iterator<char>(input), std::istreambuf_iterator<char>() };
+	if (rom.empty() || rom.size() > chip8::Image::Size() - chip8::Image::StartOffset())
+	{
+		LOG_ERROR("%s is %zu bytes, a ROM has to be 1 to %zu", argv[1], rom.size(), chip8::Image::Size() - chip8::Image::StartOffset());
+		return 1;
+	}
+
+	chip8::Image image(rom.data(), rom.size());
+	Recompiler recompiler(image, rom.size());
+	recompiler.Analyse();
+
+	FILE* output = fopen(argv[2], "w");
+	if (output == nullptr)
+	{
+		LOG_ERROR("Unable to open %s", argv[2]);
+		return 1;
+	}
+
+	recompiler.Write(output, std::filesystem::path(argv[1]).filename().string(), rom);
+	fclose(output);
+
+	LOG("Recompiled %s into %zu blocks", argv[1], recompiler.BlockCount());
+	return 0;
+}
@@ -0,0 +1,532 @@
+#include "image.h"
+#include "log.h"
+#include "native_program.h"
+#include "program.h"
+#include "quirks.h"
+#include "worker_pool.h"
+#include "zip_archive.h"
+
+#include "SDL_main.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cinttypes>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <vector>
+
+// Runs a corpus of ROMs headless across every core, and compares the display at given frames
+// against golden hashes. Every run is repeatable: each program has its own seeded generator for
+// CXNN and its timers run on emulated time, so it doesn't matter how fast the host is.
+//
+// Usage: chip8_regress <manifest> [--update | --lockstep]
+//
+// Each line of the manifest is a case, paths are relative to the manifest and can go into zip
+// archives (see zip_archive.h):
+//   <rom> [seed=<n>] [quirks=<index>] [rate=<n>] [input=<script>] <frame>[:<hash>]...
+//
+// The display is hashed (see Display::Hash) once the given number of frames have run, at 60
+// frames a second and by default Program::kOpcodeRate opcodes a second. --update fills in the hashes from this build instead of checking them.
+// Blank lines and lines starting with # are ignored.
+//
+// An input script has a line per key change, applied once that many frames have run:
+//   <frame> <key, 0-F> down|up
+//
+// --lockstep checks the engines rather than the display. Each case is run by the normal engine
+// (opcode pairs, recompiled code and idle loop skipping) and the reference interpreter side by
+// side, up to the last frame listed. Their state is compared after every frame, and on the first
+// difference the frame is run again an opcode at a time to find the opcode that caused it.
+// chip8_regress_native is built with the corpus recompiled, so that its normal engine runs the
+// recompiled code, see native_program.h.
+
+namespace
+{
+	struct KeyEvent
+	{
+		uint32_t frame;
+		uint8_t key;
+		bool down;
+	};
+
+	struct Check
+	{
+		uint32_t frame;
+		bool hasGolden;
+		uint64_t golden;
+		uint64_t actual;
+	};
+
+	struct Case
+	{
+		size_t line;
+		std::filesystem::path rom;
+		uint32_t seed = 0;
+		chip8::Quirks quirks;
+		uint32_t opcodeRate = chip8::Program::kOpcodeRate;
+		std::vector<KeyEvent> input;
+
+		// Everything but the checks as written, kept when updating
+		std::string options;
+		std::vector<Check> checks;
+
+		chip8::Program::Fault fault = chip8::Program::Fault::None;
+		uint16_t faultAddress = 0;
+
+		// Where the engines first differed and how, for --lockstep
+		std::vector<std::string> divergence;
+
+		// Whether the normal engine still had recompiled code at the end, for --lockstep
+		bool native = false;
+	};
+
+	bool RomExists(const std::filesystem::path& path)
+	{
+		if (std::filesystem::is_regular_file(path))
+			return true;
+
+		std::filesystem::path archivePath;
+		std::string name;
+		if (!chip8::ZipArchive::Split(path, archivePath, name))
+			return false;
+
+		std::shared_ptr<const chip8::ZipArchive> archive = chip8::ZipArchive::Open(archivePath);
+		return archive != nullptr && archive->Find(name) != nullptr;
+	}
+
+	bool LoadInput(const std::filesystem::path& path, std::vector<KeyEvent>& input)
+	{
+		std::ifstream file(path);
+		if (!file)
+		{
+			LOG_ERROR("Unable to open %s", path.string().c_str());
+			return false;
+		}
+
+		std::string line;
+		for (size_t lineNumber = 1; std::getline(file, line); lineNumber++)
+		{
+			if (line.empty() || line[0] == '#')
+				continue;
+
+			std::istringstream tokens(line);
+			KeyEvent event;
+			unsigned int key;
+			std::string state;
+			if (!(tokens >> event.frame >> std::hex >> key >> state) || key > 0xF || (state != "down" && state != "up"))
+			{
+				LOG_ERROR("%s:%zu: expected <frame> <key> down|up", path.string().c_str(), lineNumber);
+				return false;
+			}
+
+			event.key = static_cast<uint8_t>(key);
+			event.down = state == "down";
+			input.push_back(event);
+		}
+
+		std::stable_sort(input.begin(), input.end(), [](const KeyEvent& a, const KeyEvent& b) { return a.frame < b.frame; });
+		return true;
+	}
+
+	bool ParseCase(const std::filesystem::path& manifest, size_t lineNumber, const std::string& line, Case& result)
+	{
+		std::filesystem::path directory = manifest.parent_path();
+		std::istringstream tokens(line);
+		std::string token;
+
+		tokens >> token;
+		result.line = lineNumber;
+		result.rom = directory / token;
+		result.options = token;
+
+		while (tokens >> token)
+		{
+			bool valid = true;
+			if (token.compare(0, 5, "seed=") == 0)
+			{
+				result.seed = static_cast<uint32_t>(std::strtoul(token.c_str() + 5, nullptr, 0));
+			}
+			else if (token.compare(0, 7, "quirks=") == 0)
+			{
+				uint32_t index = static_cast<uint32_t>(std::strtoul(token.c_str() + 7, nullptr, 0));
+				valid = index < chip8::Quirks::kCount;
+				result.quirks = chip8::Quirks::FromIndex(index);
+			}
+			else if (token.compare(0, 5, "rate=") == 0)
+			{
+				result.opcodeRate = static_cast<uint32_t>(std::strtoul(token.c_str() + 5, nullptr, 0));
+				valid = result.opcodeRate > 0 && result.opcodeRate <= 1000000;
+			}
+			else if (token.compare(0, 6, "input=") == 0)
+			{
+				valid = LoadInput(directory / token.substr(6), result.input);
+			}
+			else
+			{
+				// A frame, with or without its golden hash
+				Check check = {};
+				char* end;
+				check.frame = static_cast<uint32_t>(std::strtoul(token.c_str(), &end, 10));
+				valid = end != token.c_str();
+				if (valid && *end == ':')
+				{
+					check.hasGolden = true;
+					check.golden = std::strtoull(end + 1, &end, 16);
+				}
+				valid = valid && *end == '\0';
+				if (valid)
+				{
+					result.checks.push_back(check);
+					continue;
+				}
+			}
+
+			if (!valid)
+			{
+				LOG_ERROR("%s:%zu: can't use '%s'", manifest.string().c_str(), lineNumber, token.c_str());
+				return false;
+			}
+
+			result.options += " " + token;
+		}
+
+		if (result.checks.empty())
+		{
+			LOG_ERROR("%s:%zu: no frames to check", manifest.string().c_str(), lineNumber);
+			return false;
+		}
+
+		std::sort(result.checks.begin(), result.checks.end(), [](const Check& a, const Check& b) { return a.frame < b.frame; });
+		return true;
+	}
+
+	void ApplyInput(const Case& testCase, uint32_t frame, size_t& nextEvent, std::initializer_list<chip8::Program*> programs)
+	{
+		for (; nextEvent < testCase.input.size() && testCase.input[nextEvent].frame <= frame; nextEvent++)
+		{
+			for (chip8::Program* program : programs)
+				program->SetKeyState(testCase.input[nextEvent].key, testCase.input[nextEvent].down);
+		}
+	}
+
+	void Run(Case& testCase)
+	{
+		chip8::Program program(chip8::Image(testCase.rom), testCase.quirks);
+		program.SetOpcodeRate(testCase.opcodeRate);
+		program.Seed(testCase.seed);
+		program.UseEmulatedTime();
+
+		size_t nextEvent = 0;
+		size_t nextCheck = 0;
+		for (uint32_t frame = 0;; frame++)
+		{
+			while (nextCheck < testCase.checks.size() && testCase.checks[nextCheck].frame == frame)
+				testCase.checks[nextCheck++].actual = program.GetDisplay().Hash();
+			if (nextCheck == testCase.checks.size())
+				break;
+
+			ApplyInput(testCase, frame, nextEvent, { &program });
+			program.Execute(program.FrameOpcodes(frame));
+		}
+
+		testCase.fault = program.GetFault();
+		testCase.faultAddress = program.GetFaultAddress();
+	}
+
+	std::string FormatStack(const chip8::Stack& stack)
+	{
+		std::string result = "[";
+		for (uint16_t address : stack)
+		{
+			char entry[8];
+			std::snprintf(entry, sizeof(entry), "%s%03X", result.size() > 1 ? " " : "", address);
+			result += entry;
+		}
+		return result + "]";
+	}
+
+	// Adds a line for each part of the machine state which doesn't match
+	void Diff(const chip8::Program::Snapshot& reference, const chip8::Program::Snapshot& fast, std::vector<std::string>& differences)
+	{
+		auto add = [&](const char* format, auto... args) {
+			char line[256];
+			std::snprintf(line, sizeof(line), format, args...);
+			differences.push_back(line);
+		};
+
+		for (size_t index = 0; index < std::size(reference.registers); index++)
+		{
+			if (reference.registers[index] != fast.registers[index])
+				add("V%zX: reference %02X, fast %02X", index, reference.registers[index], fast.registers[index]);
+		}
+		if (reference.addressRegister != fast.addressRegister)
+			add("I: reference %03X, fast %03X", reference.addressRegister, fast.addressRegister);
+		if (reference.programCounter != fast.programCounter)
+			add("PC: reference %03X, fast %03X", reference.programCounter, fast.programCounter);
+		if (reference.stack != fast.stack)
+			add("stack: reference %s, fast %s", FormatStack(reference.stack).c_str(), FormatStack(fast.stack).c_str());
+
+		chip8::Timer referenceTimer = reference.delayTimer;
+		chip8::Timer fastTimer = fast.delayTimer;
+		uint8_t referenceDelay = referenceTimer.GetValue(reference.timerNow);
+		uint8_t fastDelay = fastTimer.GetValue(fast.timerNow);
+		if (referenceDelay != fastDelay)
+			add("delay timer: reference %u, fast %u", referenceDelay, fastDelay);
+
+		if (reference.random != fast.random)
+			add("%s", "random generator state");
+		if (reference.waitingForKey != fast.waitingForKey || reference.keyRegister != fast.keyRegister)
+			add("FX0A: reference %s V%X, fast %s V%X", reference.waitingForKey ? "waiting for" : "not waiting,", reference.keyRegister,
+				fast.waitingForKey ? "waiting for" : "not waiting,", fast.keyRegister);
+		if (reference.fault != fast.fault || reference.faultAddress != fast.faultAddress)
+			add("fault: reference %s at %03X, fast %s at %03X", chip8::Program::FaultName(reference.fault), reference.faultAddress,
+				chip8::Program::FaultName(fast.fault), fast.faultAddress);
+
+		// Memory a page at a time, so that a large difference doesn't flood the report
+		constexpr size_t kPageSize = 0x100;
+		for (size_t page = 0; page < chip8::Image::Size(); page += kPageSize)
+		{
+			size_t count = 0;
+			size_t first = 0;
+			for (size_t address = page + kPageSize; address-- > page;)
+			{
+				if (reference.image[address] != fast.image[address])
+				{
+					count++;
+					first = address;
+				}
+			}
+			if (count > 0)
+				add("memory %03zX-%03zX: %zu bytes differ, first at %03zX: reference %02X, fast %02X", page, page + kPageSize - 1, count,
+					first, reference.image[first], fast.image[first]);
+		}
+
+		uint8_t referenceDisplay[chip8::Display::kPackedSize];
+		uint8_t fastDisplay[chip8::Display::kPackedSize];
+		reference.display.Pack(referenceDisplay);
+		fast.display.Pack(fastDisplay);
+		constexpr size_t kRowSize = chip8::Display::kWidth / 8;
+		for (size_t row = 0; row < chip8::Display::kHeight; row++)
+		{
+			if (std::memcmp(referenceDisplay + row * kRowSize, fastDisplay + row * kRowSize, kRowSize) == 0)
+				continue;
+
+			std::string referenceRow;
+			std::string fastRow;
+			for (size_t x = 0; x < chip8::Display::kWidth; x++)
+			{
+				uint8_t mask = 0x80 >> (x % 8);
+				referenceRow += (referenceDisplay[row * kRowSize + x / 8] & mask) ? '#' : '.';
+				fastRow += (fastDisplay[row * kRowSize + x / 8] & mask) ? '#' : '.';
+			}
+			add("display row %2zu: reference %s", row, referenceRow.c_str());
+			add("display row %2zu:      fast %s", row, fastRow.c_str());
+		}
+	}
+
+	void RunLockstep(Case& testCase)
+	{
+		chip8::Program fast(chip8::Image(testCase.rom), testCase.quirks);
+		chip8::Program reference(chip8::Image(testCase.rom), testCase.quirks);
+		reference.UseReferenceEngine();
+		for (chip8::Program* program : { &fast, &reference })
+		{
+			program->SetOpcodeRate(testCase.opcodeRate);
+			program->Seed(testCase.seed);
+			program->UseEmulatedTime();
+		}
+
+		size_t nextEvent = 0;
+		for (uint32_t frame = 0; frame < testCase.checks.back().frame; frame++)
+		{
+			ApplyInput(testCase, frame, nextEvent, { &fast, &reference });
+
+			chip8::Program::Snapshot fastStart = fast.Save();
+			chip8::Program::Snapshot referenceStart = reference.Save();
+
+			uint32_t opcodeCount = fast.FrameOpcodes(frame);
+			fast.Execute(opcodeCount);
+			reference.Execute(opcodeCount);
+
+			std::vector<std::string> differences;
+			Diff(reference.Save(), fast.Save(), differences);
+			if (differences.empty())
+				continue;
+
+			// Run the frame again for the fewest opcodes which differ, the last of those is the culprit
+			char where[128];
+			std::snprintf(where, sizeof(where), "frame %" PRIu32 ", only when run as a whole", frame);
+			for (uint32_t count = 1; count <= opcodeCount; count++)
+			{
+				fast.Restore(fastStart);
+				reference.Restore(referenceStart);
+				fast.Execute(count);
+				reference.Execute(count);
+
+				std::vector<std::string> opcodeDifferences;
+				Diff(reference.Save(), fast.Save(), opcodeDifferences);
+				if (opcodeDifferences.empty())
+					continue;
+
+				reference.Restore(referenceStart);
+				reference.Execute(count - 1);
+				chip8::Program::Snapshot before = reference.Save();
+				uint16_t address = before.programCounter;
+				uint16_t opcode = address + 1u < chip8::Image::Size() ? (before.image[address] << 8) | before.image[address + 1] : 0;
+				std::snprintf(where, sizeof(where), "frame %" PRIu32 ", opcode %" PRIu32 " of %" PRIu32 ": %03X %04X",
+					frame, count, opcodeCount, address, opcode);
+
+				differences = std::move(opcodeDifferences);
+				break;
+			}
+
+			testCase.divergence.push_back(where);
+			testCase.divergence.insert(testCase.divergence.end(), differences.begin(), differences.end());
+			return;
+		}
+
+		testCase.native = chip8::NativeProgram::HasNativeCode(fast);
+	}
+
+	bool Report(const Case& testCase)
+	{
+		std::string rom = testCase.rom.filename().string();
+		for (const Check& check : testCase.checks)
+		{
+			if (!check.hasGolden)
+			{
+				LOG_ERROR("%s: no golden hash for frame %" PRIu32 ", run with --update", rom.c_str(), check.frame);
+				return false;
+			}
+
+			if (check.actual != check.golden)
+			{
+				LOG_ERROR("%s: frame %" PRIu32 " is %016" PRIx64 ", expected %016" PRIx64, rom.c_str(), check.frame, check.actual, check.golden);
+				if (testCase.fault != chip8::Program::Fault::None)
+					LOG_ERROR("%s: stopped by %s at %03X", rom.c_str(), chip8::Program::FaultName(testCase.fault), testCase.faultAddress);
+				return false;
+			}
+		}
+
+		LOG("%s: passed, %zu frames checked", rom.c_str(), testCase.checks.size());
+		return true;
+	}
+
+	bool ReportLockstep(const Case& testCase)
+	{
+		std::string rom = testCase.rom.filename().string();
+		if (testCase.divergence.empty())
+		{
+			LOG("%s: engines agree over %" PRIu32 " frames%s", rom.c_str(), testCase.checks.back().frame, testCase.native ? ", recompiled" : "");
+			return true;
+		}
+
+		LOG_ERROR("%s: engines differ at %s", rom.c_str(), testCase.divergence[0].c_str());
+		for (size_t line = 1; line < testCase.divergence.size(); line++)
+			LOG_ERROR("%s:   %s", rom.c_str(), testCase.divergence[line].c_str());
+		return false;
+	}
+
+	bool WriteManifest(const std::filesystem::path& manifest, std::vector<std::string> lines, const std::vector<Case>& cases)
+	{
+		for (const Case& testCase : cases)
+		{
+			std::string& line = lines[testCase.line - 1];
+			line = testCase.options;
+			for (const Check& check : testCase.checks)
+			{
+				char token[32];
+				std::snprintf(token, sizeof(token), " %" PRIu32 ":%016" PRIx64, check.frame, check.actual);
+				line += token;
+			}
+		}
+
+		std::ofstream file(manifest);
+		if (!file)
+		{
+			LOG_ERROR("Unable to write %s", manifest.string().c_str());
+			return false;
+		}
+
+		for (const std::string& line : lines)
+			file << line << '\n';
+		return true;
+	}
+}
+
+int main(int argc, char* argv[])
+{
+	bool update = argc == 3 && std::string(argv[2]) == "--update";
+	bool lockstep = argc == 3 && std::string(argv[2]) == "--lockstep";
+	if (argc != 2 && !update && !lockstep)
+	{
+		LOG("Usage: %s <manifest> [--update | --lockstep]", argv[0]);
+		return 1;
+	}
+
+	std::filesystem::path manifest = argv[1];
+	std::ifstream file(manifest);
+	if (!file)
+	{
+		LOG_ERROR("Unable to open %s", argv[1]);
+		return 1;
+	}
+
+	std::vector<std::string> lines;
+	std::vector<Case> cases;
+	for (std::string line; std::getline(file, line);)
+	{
+		lines.push_back(line);
+		if (line.find_first_not_of(" \t\r") == std::string::npos || line[0] == '#')
+			continue;
+
+		Case testCase;
+		if (!ParseCase(manifest, lines.size(), line, testCase))
+			return 1;
+
+		if (!RomExists(testCase.rom))
+		{
+			LOG_ERROR("%s:%zu: no ROM at %s", argv[1], lines.size(), testCase.rom.string().c_str());
+			return 1;
+		}
+
+		cases.push_back(std::move(testCase));
+	}
+	file.close();
+
+	auto start = std::chrono::steady_clock::now();
+
+	chip8::WorkerPool workers;
+	workers.Run(cases.size(), [&](size_t index) {
+		if (lockstep)
+			RunLockstep(cases[index]);
+		else
+			Run(cases[index]);
+	});
+
+	double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+	if (update)
+	{
+		if (!WriteManifest(manifest, lines, cases))
+			return 1;
+
+		LOG("Updated %zu cases in %.2fs on %zu threads", cases.size(), seconds, workers.ThreadCount());
+		return 0;
+	}
+
+	size_t passed = 0;
+	for (const Case& testCase : cases)
+	{
+		if (lockstep ? ReportLockstep(testCase) : Report(testCase))
+			passed++;
+	}
+
+	LOG("%zu of %zu cases passed in %.2fs on %zu threads", passed, cases.size(), seconds, workers.ThreadCount());
+	return passed == cases.size() ? 0 : 1;
+}
@@ -0,0 +1,569 @@
+#include "image.h"
+#include "log.h"
+#include "program.h"
+#include "quirks.h"
+#include "worker_pool.h"
+
+#include "SDL_main.h"
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cinttypes>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <numeric>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// Searches the states a ROM can reach by trying every key at every step, for automated
+// playtesting: to show a level can be completed, or to find where a player can get stuck.
+//
+// Usage: chip8_search <rom> [options] <condition>...
+//
+// The search starts from the state after loading and branches on each of the 16 keys being held
+// for a step, or none. It goes breadth first so the first way found to reach the target is
+// as short as any. States are hashed (see Program::StateHash) and each is only explored from
+// the first time it's reached, which is what keeps the search from growing as 17^depth. At rates
+// which aren't a multiple of 60, frames don't all run the same number of opcodes, so states are
+// only the same if they're also at the same point in that pattern.
+//
+// Options:
+//   seed=<n>          seed for CXNN, as in chip8_regress
+//   quirks=<index>    see quirks.h
+//   rate=<n>          opcodes a second
+//   frames=<n>        frames each key is held for, 6 by default
+//   depth=<n>         steps to search to, 100 by default
+//   states=<n>        states to keep track of, 1000000 by default
+//   --softlocks       explore everything within the limits, then report the states which can't
+//                     reach the target
+//
+// Conditions, all of which have to hold at the target (numbers in hex):
+//   memory=<address>:<value>
+//   register=<index>:<value>
+//   pixel=<x>,<y>     the pixel is set
+//   display=<hash>    the whole display, as chip8_regress hashes it
+//
+// The way to the target is written out as a chip8_regress input script, so it can be replayed
+// and kept as a regression case. Exits with 0 if the target was reached (or, with --softlocks,
+// nothing could get stuck), 1 if not and 2 for bad arguments.
+
+namespace
+{
+	// Held for a step, kNoKey being none of them
+	constexpr uint8_t kNoKey = chip8::Keyboard::kNumKeys;
+	constexpr size_t kBranches = chip8::Keyboard::kNumKeys + 1;
+
+	// States are handed to the workers in runs of this many, each run sharing a program
+	constexpr size_t kStatesPerTask = 32;
+
+	constexpr uint32_t kNone = std::numeric_limits<uint32_t>::max();
+
+	struct Options
+	{
+		std::filesystem::path rom;
+		uint32_t seed = 0;
+		chip8::Quirks quirks;
+		uint32_t opcodeRate = chip8::Program::kOpcodeRate;
+		uint32_t framesPerStep = 6;
+		uint32_t maxDepth = 100;
+		uint32_t maxStates = 1000000;
+		bool softlocks = false;
+	};
+
+	struct Condition
+	{
+		enum class Type
+		{
+			Memory,
+			Register,
+			Pixel,
+			Display,
+		};
+
+		Type type;
+		uint32_t a = 0;
+		uint64_t b = 0;
+
+		bool Holds(const chip8::Program& program) const
+		{
+			switch (type)
+			{
+			case Type::Memory:
+				return program.ReadMemory(static_cast<uint16_t>(a)) == b;
+			case Type::Register:
+				return program.GetRegister(static_cast<uint8_t>(a)) == b;
+			case Type::Pixel:
+				return (program.GetDisplay().GetRow(static_cast<size_t>(b)) >> (chip8::Display::kWidth - 1 - a)) & 1;
+			case Type::Display:
+				return program.GetDisplay().Hash() == b;
+			}
+			return false;
+		}
+	};
+
+	// How each state was first reached
+	struct Node
+	{
+		uint32_t parent;
+		uint8_t key;
+	};
+
+	struct State
+	{
+		uint32_t node;
+		chip8::Program::Snapshot snapshot;
+	};
+
+	// The node for each state hash seen, split so that threads rarely wait on each other
+	class VisitedStates
+	{
+	public:
+		// Adds the state if it's new, giving it the next node. Returns its node, or kNone if it's
+		// new but there's no room left. Sets added if it's new.
+		uint32_t Insert(uint64_t hash, uint32_t maxNodes, bool& added)
+		{
+			Shard& shard = mShards[hash >> (64 - kShardBits)];
+			std::lock_guard<std::mutex> lock(shard.mutex);
+
+			added = false;
+			auto [found, inserted] = shard.nodes.try_emplace(hash, kNone);
+			if (!inserted)
+				return found->second;
+
+			uint32_t node = mNodeCount.fetch_add(1);
+			if (node >= maxNodes)
+			{
+				shard.nodes.erase(found);
+				mFull = true;
+				return kNone;
+			}
+
+			found->second = node;
+			added = true;
+			return node;
+		}
+
+		size_t Size() const { return std::min<size_t>(mNodeCount.load(), std::numeric_limits<uint32_t>::max()); }
+		bool Full() const { return mFull; }
+
+	private:
+		static constexpr size_t kShardBits = 6;
+
+		struct alignas(64) Shard
+		{
+			std::mutex mutex;
+			std::unordered_map<uint64_t, uint32_t> nodes;
+		};
+
+		Shard mShards[1 << kShardBits];
+		std::atomic<uint32_t> mNodeCount = 0;
+		std::atomic<bool> mFull = false;
+	};
+
+	// Program::FrameOpcodes repeats every this many frames
+	uint32_t FramePeriod(uint32_t opcodeRate)
+	{
+		return chip8::Program::kFrameRate / std::gcd(opcodeRate, chip8::Program::kFrameRate);
+	}
+
+	// Which state a program is in, when it's about to run the given frame
+	uint64_t StateKey(const chip8::Program& program, uint32_t frame, uint32_t framePeriod)
+	{
+		return program.StateHash() ^ (static_cast<uint64_t>(frame % framePeriod) * 0x9E3779B97F4A7C15);
+	}
+
+	bool ParseHex(const std::string& text, uint64_t& value)
+	{
+		char* end = nullptr;
+		value = std::strtoull(text.c_str(), &end, 16);
+		return !text.empty() && *end == '\0';
+	}
+
+	bool ParseCondition(const std::string& argument, Condition& condition)
+	{
+		size_t equals = argument.find('=');
+		if (equals == std::string::npos)
+			return false;
+
+		std::string name = argument.substr(0, equals);
+		std::string value = argument.substr(equals + 1);
+		if (name == "display")
+		{
+			condition.type = Condition::Type::Display;
+			return ParseHex(value, condition.b);
+		}
+
+		size_t separator = value.find(name == "pixel" ? ',' : ':');
+		if (separator == std::string::npos)
+			return false;
+
+		uint64_t a;
+		if (name == "pixel")
+		{
+			condition.type = Condition::Type::Pixel;
+			char* end = nullptr;
+			a = std::strtoul(value.c_str(), &end, 10);
+			condition.b = std::strtoul(value.c_str() + separator + 1, &end, 10);
+			condition.a = static_cast<uint32_t>(a);
+			return a < chip8::Display::kWidth && condition.b < chip8::Display::kHeight;
+		}
+
+		if (!ParseHex(value.substr(0, separator), a) || !ParseHex(value.substr(separator + 1), condition.b) || condition.b > 0xFF)
+			return false;
+
+		condition.a = static_cast<uint32_t>(a);
+		if (name == "memory")
+		{
+			condition.type = Condition::Type::Memory;
+			return a < chip8::Image::Size();
+		}
+		if (name == "register")
+		{
+			condition.type = Condition::Type::Register;
+			return a < 16;
+		}
+		return false;
+	}
+
+	bool ParseArguments(int argc, char* argv[], Options& options, std::vector<Condition>& conditions)
+	{
+		if (argc < 2)
+			return false;
+
+		options.rom = argv[1];
+		for (int arg = 2; arg < argc; arg++)
+		{
+			std::string argument = argv[arg];
+			auto number = [&](const char* prefix, uint32_t& value) {
+				size_t length = std::strlen(prefix);
+				if (argument.compare(0, length, prefix) != 0)
+					return false;
+				value = static_cast<uint32_t>(std::strtoul(argument.c_str() + length, nullptr, 10));
+				return true;
+			};
+
+			uint32_t quirks = 0;
+			if (argument == "--softlocks")
+				options.softlocks = true;
+			else if (number("quirks=", quirks))
+			{
+				if (quirks >= chip8::Quirks::kCount)
+					return false;
+				options.quirks = chip8::Quirks::FromIndex(quirks);
+			}
+			else if (number("seed=", options.seed) || number("rate=", options.opcodeRate) || number("frames=", options.framesPerStep) ||
+				number("depth=", options.maxDepth) || number("states=", options.maxStates))
+			{
+			}
+			else
+			{
+				Condition condition;
+				if (!ParseCondition(argument, condition))
+				{
+					LOG_ERROR("Don't understand %s", argument.c_str());
+					return false;
+				}
+				conditions.push_back(condition);
+			}
+		}
+
+		return !conditions.empty() && options.opcodeRate > 0 && options.framesPerStep > 0 && options.maxStates > 0;
+	}
+
+	std::vector<uint8_t> Path(const std::vector<Node>& nodes, uint32_t node)
+	{
+		std::vector<uint8_t> keys;
+		for (; nodes[node].parent != kNone; node = nodes[node].parent)
+			keys.push_back(nodes[node].key);
+		std::reverse(keys.begin(), keys.end());
+		return keys;
+	}
+
+	// As a chip8_regress input script
+	void LogPath(const std::vector<uint8_t>& keys, uint32_t framesPerStep)
+	{
+		uint8_t held = kNoKey;
+		for (size_t step = 0; step <= keys.size(); step++)
+		{
+			uint8_t key = step < keys.size() ? keys[step] : kNoKey;
+			if (key == held)
+				continue;
+
+			uint32_t frame = static_cast<uint32_t>(step) * framesPerStep;
+			if (held != kNoKey)
+				LOG("%u %X up", frame, held);
+			if (key != kNoKey)
+				LOG("%u %X down", frame, key);
+			held = key;
+		}
+	}
+
+	// Every state which can reach a target, going backwards along the edges. States which
+	// weren't fully explored might, so they count too.
+	std::vector<bool> CanReachTarget(const std::vector<std::array<uint32_t, kBranches>>& edges, const std::vector<uint8_t>& target,
+		const std::vector<uint8_t>& explored, size_t nodeCount)
+	{
+		// Edges reversed, as offsets into one array of parents
+		std::vector<uint32_t> offsets(nodeCount + 1, 0);
+		for (size_t node = 0; node < nodeCount; node++)
+		{
+			for (uint32_t child : edges[node])
+			{
+				if (explored[node] && child != kNone)
+					offsets[child + 1]++;
+			}
+		}
+		for (size_t node = 0; node < nodeCount; node++)
+			offsets[node + 1] += offsets[node];
+
+		std::vector<uint32_t> parents(offsets[nodeCount]);
+		std::vector<uint32_t> next(offsets.begin(), offsets.end() - 1);
+		for (size_t node = 0; node < nodeCount; node++)
+		{
+			for (uint32_t child : edges[node])
+			{
+				if (explored[node] && child != kNone)
+					parents[next[child]++] = static_cast<uint32_t>(node);
+			}
+		}
+
+		std::vector<bool> reaches(nodeCount, false);
+		std::vector<uint32_t> queue;
+		for (size_t node = 0; node < nodeCount; node++)
+		{
+			if (target[node] || !explored[node])
+			{
+				reaches[node] = true;
+				queue.push_back(static_cast<uint32_t>(node));
+			}
+		}
+
+		while (!queue.empty())
+		{
+			uint32_t node = queue.back();
+			queue.pop_back();
+			for (uint32_t index = offsets[node]; index < offsets[node + 1]; index++)
+			{
+				uint32_t parent = parents[index];
+				if (!reaches[parent])
+				{
+					reaches[parent] = true;
+					queue.push_back(parent);
+				}
+			}
+		}
+
+		return reaches;
+	}
+}
+
+int main(int argc, char* argv[])
+{
+	Options options;
+	std::vector<Condition> conditions;
+	if (!ParseArguments(argc, argv, options, conditions))
+	{
+		LOG("Usage: %s <rom> [seed=<n>] [quirks=<index>] [rate=<n>] [frames=<n>] [depth=<n>] [states=<n>] [--softlocks] <condition>...", argv[0]);
+		return 2;
+	}
+
+	if (!std::filesystem::is_regular_file(options.rom))
+	{
+		LOG_ERROR("No ROM at %s", options.rom.string().c_str());
+		return 2;
+	}
+
+	chip8::Image image(options.rom);
+	auto makeProgram = [&]() {
+		chip8::Image copy(image);
+		auto program = std::make_unique<chip8::Program>(std::move(copy), options.quirks);
+		program->SetOpcodeRate(options.opcodeRate);
+		program->Seed(options.seed);
+		program->UseEmulatedTime();
+		return program;
+	};
+
+	auto isTarget = [&](const chip8::Program& program) {
+		return std::all_of(conditions.begin(), conditions.end(), [&](const Condition& condition) { return condition.Holds(program); });
+	};
+
+	// Each written only by the thread which adds or explores the node. For --softlocks, an
+	// explored node has all its edges, where kNone is a state there wasn't room for.
+	std::vector<Node> nodes(options.maxStates);
+	std::vector<uint8_t> target;
+	std::vector<uint8_t> explored;
+	std::vector<std::array<uint32_t, kBranches>> edges;
+	if (options.softlocks)
+	{
+		std::array<uint32_t, kBranches> noEdges;
+		noEdges.fill(kNone);
+		edges.resize(options.maxStates, noEdges);
+		target.resize(options.maxStates, 0);
+		explored.resize(options.maxStates, 0);
+	}
+
+	uint32_t framePeriod = FramePeriod(options.opcodeRate);
+	VisitedStates visited;
+	std::vector<State> frontier;
+	std::atomic<uint32_t> found = kNone;
+	{
+		std::unique_ptr<chip8::Program> program = makeProgram();
+		uint64_t hash = StateKey(*program, 0, framePeriod);
+		bool added;
+		uint32_t root = visited.Insert(hash, options.maxStates, added);
+		nodes[root] = { kNone, kNoKey };
+		frontier.push_back({ root, program->Save() });
+
+		if (isTarget(*program))
+		{
+			found = root;
+			if (options.softlocks)
+				target[root] = 1;
+		}
+	}
+
+	chip8::WorkerPool workers;
+	auto start = std::chrono::steady_clock::now();
+
+	std::atomic<uint32_t> firstFault = kNone;
+	std::atomic<size_t> faults = 0;
+	uint32_t depth = 0;
+	for (; depth < options.maxDepth && !frontier.empty() && (options.softlocks || found == kNone); depth++)
+	{
+		// Each task takes a run of states and keeps the new states they lead to
+		size_t taskCount = (frontier.size() + kStatesPerTask - 1) / kStatesPerTask;
+		std::vector<std::vector<State>> reached(taskCount);
+		workers.Run(taskCount, [&](size_t task) {
+			std::unique_ptr<chip8::Program> program = makeProgram();
+			size_t end = std::min(frontier.size(), (task + 1) * kStatesPerTask);
+			for (size_t index = task * kStatesPerTask; index < end && (options.softlocks || found == kNone); index++)
+			{
+				const State& state = frontier[index];
+				uint8_t held = nodes[state.node].key;
+				bool complete = true;
+				for (uint8_t key = 0; key < kBranches; key++)
+				{
+					// Only what changes, in the same order as the input script
+					program->Restore(state.snapshot);
+					if (held != key && held != kNoKey)
+						program->SetKeyState(held, false);
+					if (held != key && key != kNoKey)
+						program->SetKeyState(key, true);
+
+					uint32_t firstFrame = depth * options.framesPerStep;
+					uint32_t endFrame = firstFrame + options.framesPerStep;
+					for (uint32_t frame = firstFrame; frame < endFrame; frame++)
+						program->Execute(program->FrameOpcodes(frame));
+
+					uint64_t hash = StateKey(*program, endFrame, framePeriod);
+					bool added;
+					uint32_t node = visited.Insert(hash, options.maxStates, added);
+					complete = complete && node != kNone;
+					if (options.softlocks)
+						edges[state.node][key] = node;
+					if (!added)
+						continue;
+
+					nodes[node] = { state.node, key };
+
+					if (isTarget(*program))
+					{
+						uint32_t none = kNone;
+						found.compare_exchange_strong(none, node);
+						if (!options.softlocks)
+							break;
+						target[node] = 1;
+					}
+
+					// A fault stops the program, so it's a dead end
+					if (program->GetFault() != chip8::Program::Fault::None)
+					{
+						faults++;
+						uint32_t none = kNone;
+						firstFault.compare_exchange_strong(none, node);
+						if (options.softlocks)
+							explored[node] = 1;
+						continue;
+					}
+
+					reached[task].push_back({ node, program->Save() });
+				}
+
+				if (options.softlocks)
+					explored[state.node] = complete ? 1 : 0;
+			}
+		});
+
+		frontier.clear();
+		for (std::vector<State>& states : reached)
+		{
+			for (State& state : states)
+				frontier.push_back(std::move(state));
+		}
+
+		LOG("Step %u: %zu states to explore, %zu seen", depth + 1, frontier.size(), visited.Size());
+	}
+
+	double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	size_t nodeCount = std::min<size_t>(visited.Size(), options.maxStates);
+	LOG("Searched %zu states to a depth of %u steps in %.2fs on %zu threads", nodeCount, depth, seconds, workers.ThreadCount());
+	if (visited.Full())
+		LOG_WARNING("Ran out of room after %u states, some weren't explored", options.maxStates);
+
+	if (firstFault != kNone)
+	{
+		std::vector<uint8_t> keys = Path(nodes, firstFault);
+		LOG("%zu states stopped with a fault, the first after %zu frames with input:", faults.load(), keys.size() * options.framesPerStep);
+		LogPath(keys, options.framesPerStep);
+	}
+
+	if (!options.softlocks)
+	{
+		if (found == kNone)
+		{
+			LOG("Target not reached%s", frontier.empty() && !visited.Full() ? ", every state was explored" : "");
+			return 1;
+		}
+
+		std::vector<uint8_t> keys = Path(nodes, found);
+		LOG("Target reached after %zu frames with input:", keys.size() * options.framesPerStep);
+		LogPath(keys, options.framesPerStep);
+		return 0;
+	}
+
+	// Stuck is being unable to reach the target whatever keys are pressed. States which weren't
+	// explored can't be ruled out, so every one reported is stuck for certain.
+	std::vector<bool> reaches = CanReachTarget(edges, target, explored, nodeCount);
+	size_t stuck = 0;
+	uint32_t firstStuck = kNone;
+	for (size_t node = 0; node < nodeCount; node++)
+	{
+		if (!reaches[node])
+		{
+			stuck++;
+			firstStuck = std::min(firstStuck, static_cast<uint32_t>(node));
+		}
+	}
+
+	if (found == kNone)
+		LOG("Target not reached%s", frontier.empty() && !visited.Full() ? ", every state was explored" : "");
+	if (stuck == 0)
+	{
+		LOG("All %zu states can still reach the target", nodeCount);
+		return found != kNone ? 0 : 1;
+	}
+
+	// Nodes are numbered breadth first, so the first is one of the quickest to get into
+	std::vector<uint8_t> keys = Path(nodes, firstStuck);
+	LOG("%zu states can't reach the target, the first after %zu frames with input:", stuck, keys.size() * options.framesPerStep);
+	LogPath(keys, options.framesPerStep);
+	return 1;
+}
@@ -0,0 +1,160 @@
+#include "display.h"
+#include "log.h"
+#include "spectator.h"
+
+#include "SDL.h"
+#include "SDL_main.h"
+
+#include <cassert>
+#include <cerrno>
+#include <cstring>
+#include <vector>
+
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+// Reference viewer for a program published by Spectator.
+//
+// Usage: chip8_spectate <socket>
+
+namespace
+{
+	constexpr int kPixelWidth = 10;
+	constexpr int kPixelHeight = 10;
+
+	// Redraw at about 60 hz
+	constexpr int kFrameTime = 16;
+
+	// Applies whole messages from the start of buffer to packed, and removes them.
+	// Returns false if the stream is malformed.
+	bool Decode(std::vector<uint8_t>& buffer, uint8_t* packed)
+	{
+		size_t offset = 0;
+		while (buffer.size() - offset >= chip8::Spectator::kHeaderSize)
+		{
+			const uint8_t* header = buffer.data() + offset;
+			size_t payloadSize = header[1] | (header[2] << 8);
+			if (buffer.size() - offset - chip8::Spectator::kHeaderSize < payloadSize)
+				break;
+
+			const uint8_t* payload = header + chip8::Spectator::kHeaderSize;
+			switch (header[0])
+			{
+			case chip8::Spectator::kKeyframe:
+				if (payloadSize != chip8::Display::kPackedSize)
+					return false;
+				std::memcpy(packed, payload, payloadSize);
+				break;
+			case chip8::Spectator::kDelta:
+			{
+				size_t position = 0;
+				for (size_t run = 0; run + 2 <= payloadSize;)
+				{
+					size_t skip = payload[run];
+					size_t count = payload[run + 1];
+					position += skip;
+					if (position + count > chip8::Display::kPackedSize || run + 2 + count > payloadSize)
+						return false;
+
+					for (size_t index = 0; index < count; index++)
+						packed[position + index] ^= payload[run + 2 + index];
+
+					position += count;
+					run += 2 + count;
+				}
+			}
+			break;
+			default:
+				return false;
+			}
+
+			offset += chip8::Spectator::kHeaderSize + payloadSize;
+		}
+
+		buffer.erase(buffer.begin(), buffer.begin() + offset);
+		return true;
+	}
+}
+
+int main(int argc, char* argv[])
+{
+	if (argc != 2)
+	{
+		LOG("Usage: %s <socket>", argv[0]);
+		return 1;
+	}
+
+	sockaddr_un address = {};
+	address.sun_family = AF_UNIX;
+	if (strlen(argv[1]) >= sizeof(address.sun_path))
+	{
+		LOG_ERROR("Socket path is too long: %s", argv[1]);
+		return 1;
+	}
+	std::strncpy(address.sun_path, argv[1], sizeof(address.sun_path) - 1);
+
+	int connection = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (connection < 0 || connect(connection, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0)
+	{
+		LOG_ERROR("Unable to connect to %s: %s", argv[1], strerror(errno));
+		return 1;
+	}
+
+	int result = SDL_Init(SDL_INIT_VIDEO | SDL_INIT_EVENTS);
+	assert(result == 0);
+
+	SDL_Window* window = nullptr;
+	SDL_Renderer* renderer = nullptr;
+	result = SDL_CreateWindowAndRenderer(kPixelWidth * chip8::Display::kWidth, kPixelHeight * chip8::Display::kHeight,
+		SDL_WINDOW_SHOWN,
+		&window,
+		&renderer);
+	assert(result == 0);
+
+	chip8::Display display;
+	uint8_t packed[chip8::Display::kPackedSize] = {};
+	std::vector<uint8_t> buffer;
+
+	bool quit = false;
+	while (!quit)
+	{
+		SDL_Event event;
+		while (SDL_PollEvent(&event))
+		{
+			if (event.type == SDL_QUIT)
+				quit = true;
+		}
+
+		// Take everything that has arrived, without waiting for more
+		uint8_t received[4096];
+		ssize_t size;
+		while ((size = recv(connection, received, sizeof(received), MSG_DONTWAIT)) > 0)
+			buffer.insert(buffer.end(), received, received + size);
+
+		if (size == 0 || (size < 0 && errno != EAGAIN && errno != EWOULDBLOCK))
+		{
+			LOG("%s stopped publishing", argv[1]);
+			quit = true;
+		}
+		else if (!Decode(buffer, packed))
+		{
+			LOG_ERROR("Malformed stream from %s", argv[1]);
+			quit = true;
+		}
+
+		display.Unpack(packed);
+		display.Render(renderer);
+		SDL_RenderPresent(renderer);
+
+		SDL_Delay(kFrameTime);
+	}
+
+	close(connection);
+
+	SDL_DestroyRenderer(renderer);
+	SDL_DestroyWindow(window);
+	SDL_Quit();
+
+	return 0;
+}
@@ -0,0 +1,114 @@
+#include "instruction_trace.h"
+#include "log.h"
+
+#include <cinttypes>
+#include <cstdio>
+#include <deque>
+#include <string>
+
+// Compares two instruction traces, see instruction_trace.h, and reports the first instruction
+// where they part ways along with the ones leading up to it.
+//
+// Usage: chip8_tracediff <a.trace> <b.trace>
+//
+// Exits with 0 if the traces are the same, 1 if they differ and 2 if either can't be read.
+
+namespace
+{
+	// Instructions shown before the difference
+	constexpr size_t kContext = 16;
+
+	using Entry = chip8::InstructionTraceReader::Entry;
+
+	std::string Format(const Entry& entry)
+	{
+		char text[128];
+		int length = std::snprintf(text, sizeof(text), "%10" PRIu64 "  %03X: %04X  I=%03X ", entry.index, entry.address, entry.opcode, entry.addressRegister);
+
+		// Only what the instruction changed, the rest is in the lines before
+		for (size_t index = 0; index < chip8::InstructionTrace::kNumRegisters; index++)
+		{
+			if (entry.changedRegisters & (1 << index))
+				length += std::snprintf(text + length, sizeof(text) - length, " V%zX=%02X", index, entry.registers[index]);
+		}
+		return text;
+	}
+
+	std::string Differences(const Entry& a, const Entry& b)
+	{
+		std::string differences;
+		auto add = [&](const char* format, auto... values) {
+			char text[64];
+			std::snprintf(text, sizeof(text), format, values...);
+			differences += differences.empty() ? "" : ", ";
+			differences += text;
+		};
+
+		if (a.address != b.address)
+			add("address %03X / %03X", a.address, b.address);
+		if (a.opcode != b.opcode)
+			add("opcode %04X / %04X", a.opcode, b.opcode);
+		if (a.addressRegister != b.addressRegister)
+			add("I %03X / %03X", a.addressRegister, b.addressRegister);
+		for (size_t index = 0; index < chip8::InstructionTrace::kNumRegisters; index++)
+		{
+			if (a.registers[index] != b.registers[index])
+				add("V%zX %02X / %02X", index, a.registers[index], b.registers[index]);
+		}
+		return differences;
+	}
+}
+
+int main(int argc, char* argv[])
+{
+	if (argc != 3)
+	{
+		LOG("Usage: %s <a.trace> <b.trace>", argv[0]);
+		return 2;
+	}
+
+	chip8::InstructionTraceReader a(argv[1]);
+	chip8::InstructionTraceReader b(argv[2]);
+	if (!a.Valid() || !b.Valid())
+		return 2;
+
+	// The shared history before the difference, from the first trace
+	std::deque<Entry> context;
+
+	Entry entryA;
+	Entry entryB;
+	while (true)
+	{
+		bool moreA = a.Next(entryA);
+		bool moreB = b.Next(entryB);
+		if (!moreA && !moreB)
+			break;
+
+		std::string differences;
+		if (moreA != moreB)
+			differences = moreA ? "second trace ends" : "first trace ends";
+		else
+			differences = Differences(entryA, entryB);
+
+		if (differences.empty())
+		{
+			context.push_back(entryA);
+			if (context.size() > kContext)
+				context.pop_front();
+			continue;
+		}
+
+		for (const Entry& entry : context)
+			LOG("  %s", Format(entry).c_str());
+		if (moreA)
+			LOG("a %s", Format(entryA).c_str());
+		if (moreB)
+			LOG("b %s", Format(entryB).c_str());
+
+		LOG("Traces differ at instruction %" PRIu64 ": %s", moreA ? entryA.index : entryB.index, differences.c_str());
+		return 1;
+	}
+
+	LOG("Traces match over %" PRIu64 " instructions", context.empty() ? 0 : context.back().index + 1);
+	return 0;
+}
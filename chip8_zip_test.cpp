@@ -0,0 +1,261 @@
+#include "log.h"
+#include "zip_archive.h"
+
+#include <cstdint>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <memory>
+#include <string>
+#include <vector>
+
+// Checks ZipArchive's inflater with a DEFLATE stream for each kind of block, and that damaged
+// entries are refused rather than extracted.
+//
+// Usage: chip8_zip_test
+//
+// The streams were made with zlib, apart from the one with a code length repeat running from
+// the literal/length codes into the distance codes. zlib never writes one, other encoders may.
+
+namespace
+{
+	constexpr uint16_t kMethodDeflated = 8;
+	constexpr char kEntryName[] = "rom.ch8";
+
+	// Stored block of the bytes 0 to 99
+	const uint8_t kStored[] = {
+		0x01, 0x64, 0x00, 0x9B, 0xFF, 0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08, 0x09, 0x0A,
+		0x0B, 0x0C, 0x0D, 0x0E, 0x0F, 0x10, 0x11, 0x12, 0x13, 0x14, 0x15, 0x16, 0x17, 0x18, 0x19, 0x1A,
+		0x1B, 0x1C, 0x1D, 0x1E, 0x1F, 0x20, 0x21, 0x22, 0x23, 0x24, 0x25, 0x26, 0x27, 0x28, 0x29, 0x2A,
+		0x2B, 0x2C, 0x2D, 0x2E, 0x2F, 0x30, 0x31, 0x32, 0x33, 0x34, 0x35, 0x36, 0x37, 0x38, 0x39, 0x3A,
+		0x3B, 0x3C, 0x3D, 0x3E, 0x3F, 0x40, 0x41, 0x42, 0x43, 0x44, 0x45, 0x46, 0x47, 0x48, 0x49, 0x4A,
+		0x4B, 0x4C, 0x4D, 0x4E, 0x4F, 0x50, 0x51, 0x52, 0x53, 0x54, 0x55, 0x56, 0x57, 0x58, 0x59, 0x5A,
+		0x5B, 0x5C, 0x5D, 0x5E, 0x5F, 0x60, 0x61, 0x62, 0x63,
+	};
+
+	// Fixed block of FixedText, with back-references overlapping what they copy
+	const uint8_t kFixed[] = {
+		0x73, 0xF6, 0xF0, 0x0C, 0xD0, 0xB5, 0x50, 0x48, 0xA4, 0x07, 0x48, 0x4A, 0x1E, 0x10, 0x04, 0x00,
+	};
+
+	// Dynamic block of DynamicText
+	const uint8_t kDynamic[] = {
+		0x15, 0x91, 0xB7, 0x11, 0x00, 0x31, 0x08, 0x04, 0x5B, 0xC2, 0x08, 0xA3, 0x10, 0xDB, 0x7F, 0x49,
+		0xAF, 0x0F, 0x35, 0x03, 0xA7, 0xBD, 0x45, 0x07, 0x33, 0x93, 0xF2, 0x68, 0x6F, 0x15, 0x1A, 0x2E,
+		0x8E, 0xD2, 0x9A, 0xA9, 0xDD, 0xF0, 0xBA, 0xA1, 0x9C, 0x24, 0xE8, 0x75, 0x64, 0x6D, 0x24, 0x83,
+		0xAE, 0x17, 0x87, 0xCE, 0xDE, 0xBB, 0xBB, 0x3A, 0xEC, 0xDD, 0x31, 0x1A, 0x47, 0xA7, 0x6E, 0xCF,
+		0x2A, 0x02, 0xE4, 0xA2, 0x0B, 0xC8, 0x2D, 0xEE, 0x48, 0xBF, 0xC4, 0xD4, 0xBA, 0x21, 0xA4, 0xFC,
+		0x1E, 0x38, 0x45, 0x8E, 0x45, 0x2A, 0xA8, 0x6B, 0x7A, 0x5B, 0xC3, 0x8F, 0x78, 0x59, 0x61, 0x36,
+		0xCE, 0xC2, 0x35, 0xCC, 0xE5, 0x46, 0x68, 0xE9, 0x4E, 0xEE, 0x99, 0x1D, 0xF5, 0xA3, 0x81, 0xCC,
+		0xE8, 0xC7, 0x32, 0x00, 0x90, 0xF7, 0x82, 0x11, 0x0B, 0x20, 0x9A, 0x90, 0xF8, 0xCE, 0xDC, 0x3C,
+		0x0B, 0x7D, 0x27, 0x52, 0x01, 0x5E, 0x74, 0xA9, 0xBC, 0x06, 0x09, 0x69, 0xF7, 0x3C, 0x04, 0x07,
+		0x51, 0x13, 0xB3, 0x82, 0x93, 0x7C, 0x1E, 0x4B, 0xB1, 0xBC, 0xE1, 0x60, 0xE8, 0xC4, 0xB7, 0x5D,
+		0x76, 0x91, 0x63, 0x24, 0xB8, 0x1C, 0x15, 0x53, 0xEC, 0xC4, 0xAB, 0xA8, 0x04, 0x8D, 0x42, 0xF6,
+		0x2C, 0xCC, 0xB6, 0x7A, 0xBD, 0xF1, 0x83, 0x95, 0x76, 0x8C, 0x9B, 0xF8, 0xBC, 0x1A, 0x88, 0xEE,
+		0xB6, 0x78, 0x5A, 0x12, 0x96, 0xE5, 0x3C, 0x43, 0x4F, 0x43, 0xB0, 0x49, 0x12, 0x11, 0x17, 0x28,
+		0xEA, 0x69, 0x8A, 0x6A, 0xC5, 0xCB, 0x84, 0x9B, 0xA1, 0xF5, 0x0C, 0x78, 0xF6, 0x01, 0x96, 0x20,
+		0x0D, 0xF5, 0x2E, 0x94, 0x11, 0x02, 0xDE, 0xC7, 0xC5, 0xC9, 0x20, 0x3D, 0x0A, 0xA8, 0xC0, 0xB8,
+		0xD7, 0xE7, 0x3E, 0xDD, 0x83, 0x78, 0xF3, 0x09, 0xD9, 0x1D, 0x11, 0x79, 0xB2, 0xF6, 0x4F, 0x39,
+		0xB1, 0xAE, 0x86, 0x3A, 0x4F, 0x1E, 0x2D, 0x1F, 0xAB, 0x27, 0xAA, 0xEE, 0x35, 0x8F, 0xF6, 0x0A,
+		0xC0, 0xCE, 0x88, 0x97, 0xA0, 0xE7, 0xE1, 0xD5, 0x08, 0x63, 0x63, 0x99, 0x33, 0x18, 0x78, 0xDF,
+		0xCB, 0x48, 0x61, 0xDD, 0xC7, 0x2D, 0x98, 0xE8, 0xAA, 0xED, 0x99, 0x58, 0x78, 0x15, 0x28, 0x2E,
+		0x11, 0xD0, 0xE0, 0x71, 0xBD, 0xDB, 0xE1, 0x98, 0xEF, 0x3B, 0xA4, 0xB6, 0x47, 0xCA, 0x59, 0xC8,
+		0x86, 0x6D, 0xF2, 0xA8, 0x64, 0x74, 0xE5, 0x3F, 0xE5, 0x5B, 0x2D, 0x39, 0x83, 0xE2, 0x1F,
+	};
+
+	// Dynamic block of "ABABABABABA". One code length repeat covers unused literal/length codes
+	// and the first distance code, and the rest is copies at distance 2 overlapping themselves.
+	const uint8_t kCrossingRepeat[] = {
+		0x1D, 0xC2, 0x21, 0x01, 0x00, 0x00, 0x00, 0x80, 0xA0, 0x6D, 0xFA, 0x7F, 0x94, 0x06, 0xC0, 0x6D,
+		0x01,
+	};
+
+	std::vector<uint8_t> StoredText()
+	{
+		std::vector<uint8_t> text;
+		for (int value = 0; value < 100; value++)
+			text.push_back(static_cast<uint8_t>(value));
+		return text;
+	}
+
+	std::vector<uint8_t> FixedText()
+	{
+		std::string text = "CHIP-8 " + std::string(100, 'a');
+		for (int repeat = 0; repeat < 40; repeat++)
+			text += "abc";
+		return std::vector<uint8_t>(text.begin(), text.end());
+	}
+
+	// Hex digits from an LCG, which compress best with codes of their own
+	std::vector<uint8_t> DynamicText()
+	{
+		std::vector<uint8_t> text;
+		uint32_t state = 1;
+		for (int index = 0; index < 600; index++)
+		{
+			state = state * 1103515245 + 12345;
+			text.push_back("0123456789ABCDEF"[(state >> 16) % 16]);
+		}
+		return text;
+	}
+
+	std::vector<uint8_t> Bytes(const char* text)
+	{
+		return std::vector<uint8_t>(text, text + std::char_traits<char>::length(text));
+	}
+
+	uint32_t Crc32(const std::vector<uint8_t>& data)
+	{
+		uint32_t crc = 0xFFFFFFFF;
+		for (uint8_t byte : data)
+		{
+			crc ^= byte;
+			for (int bit = 0; bit < 8; bit++)
+				crc = (crc & 1) ? (crc >> 1) ^ 0xEDB88320 : crc >> 1;
+		}
+		return crc ^ 0xFFFFFFFF;
+	}
+
+	void Write16(std::vector<uint8_t>& output, uint16_t value)
+	{
+		output.push_back(static_cast<uint8_t>(value));
+		output.push_back(static_cast<uint8_t>(value >> 8));
+	}
+
+	void Write32(std::vector<uint8_t>& output, uint32_t value)
+	{
+		Write16(output, static_cast<uint16_t>(value));
+		Write16(output, static_cast<uint16_t>(value >> 16));
+	}
+
+	// An archive holding a single deflated entry, see https://pkware.cachefly.net/webdocs/casestudies/APPNOTE.TXT
+	std::vector<uint8_t> MakeArchive(const uint8_t* data, size_t dataSize, uint32_t size, uint32_t crc)
+	{
+		uint16_t nameSize = static_cast<uint16_t>(std::char_traits<char>::length(kEntryName));
+		std::vector<uint8_t> archive;
+
+		Write32(archive, 0x04034B50);
+		Write16(archive, 20);
+		Write16(archive, 0);
+		Write16(archive, kMethodDeflated);
+		Write32(archive, 0);
+		Write32(archive, crc);
+		Write32(archive, static_cast<uint32_t>(dataSize));
+		Write32(archive, size);
+		Write16(archive, nameSize);
+		Write16(archive, 0);
+		archive.insert(archive.end(), kEntryName, kEntryName + nameSize);
+		archive.insert(archive.end(), data, data + dataSize);
+
+		uint32_t directoryOffset = static_cast<uint32_t>(archive.size());
+		Write32(archive, 0x02014B50);
+		Write16(archive, 20);
+		Write16(archive, 20);
+		Write16(archive, 0);
+		Write16(archive, kMethodDeflated);
+		Write32(archive, 0);
+		Write32(archive, crc);
+		Write32(archive, static_cast<uint32_t>(dataSize));
+		Write32(archive, size);
+		Write16(archive, nameSize);
+		Write16(archive, 0);
+		Write16(archive, 0);
+		Write16(archive, 0);
+		Write16(archive, 0);
+		Write32(archive, 0);
+		Write32(archive, 0);
+		archive.insert(archive.end(), kEntryName, kEntryName + nameSize);
+
+		uint32_t directorySize = static_cast<uint32_t>(archive.size()) - directoryOffset;
+		Write32(archive, 0x06054B50);
+		Write16(archive, 0);
+		Write16(archive, 0);
+		Write16(archive, 1);
+		Write16(archive, 1);
+		Write32(archive, directorySize);
+		Write32(archive, directoryOffset);
+		Write16(archive, 0);
+		return archive;
+	}
+
+	// Extracts the stream as an entry of expected's size, and checks that it succeeds and
+	// matches if valid, or fails if not. The CRC is of expected, with crcError flipping bits.
+	bool Check(const char* name, const uint8_t* data, size_t dataSize, const std::vector<uint8_t>& expected, bool valid, uint32_t crcError = 0)
+	{
+		std::filesystem::path path = std::filesystem::temp_directory_path() / (std::string("chip8_zip_test_") + name + ".zip");
+		{
+			std::vector<uint8_t> archive = MakeArchive(data, dataSize, static_cast<uint32_t>(expected.size()), Crc32(expected) ^ crcError);
+			std::ofstream file(path, std::ios::binary);
+			file.write(reinterpret_cast<const char*>(archive.data()), archive.size());
+			if (!file)
+			{
+				LOG_ERROR("%s: unable to write %s", name, path.string().c_str());
+				return false;
+			}
+		}
+
+		bool passed = true;
+		{
+			std::shared_ptr<const chip8::ZipArchive> archive = chip8::ZipArchive::Open(path);
+			const chip8::ZipArchive::Entry* entry = archive != nullptr ? archive->Find(kEntryName) : nullptr;
+			if (entry == nullptr)
+			{
+				LOG_ERROR("%s: archive can't be read", name);
+				passed = false;
+			}
+			else
+			{
+				std::vector<uint8_t> output(expected.size());
+				bool extracted = archive->Extract(*entry, output.data());
+				if (extracted != valid)
+				{
+					LOG_ERROR("%s: extract %s, expected it to %s", name, extracted ? "succeeded" : "failed", valid ? "succeed" : "fail");
+					passed = false;
+				}
+				else if (valid && output != expected)
+				{
+					LOG_ERROR("%s: extracted the wrong bytes", name);
+					passed = false;
+				}
+			}
+		}
+
+		std::error_code error;
+		std::filesystem::remove(path, error);
+
+		if (passed)
+			LOG("%s: passed", name);
+		return passed;
+	}
+}
+
+int main(int argc, char* argv[])
+{
+	if (argc != 1)
+	{
+		LOG("Usage: %s", argv[0]);
+		return 1;
+	}
+
+	std::vector<uint8_t> dynamicText = DynamicText();
+	std::vector<uint8_t> shortText = dynamicText;
+	shortText.resize(dynamicText.size() / 2);
+
+	bool results[] = {
+		Check("stored", kStored, sizeof(kStored), StoredText(), true),
+		Check("fixed", kFixed, sizeof(kFixed), FixedText(), true),
+		Check("dynamic", kDynamic, sizeof(kDynamic), dynamicText, true),
+		Check("crossing_repeat", kCrossingRepeat, sizeof(kCrossingRepeat), Bytes("ABABABABABA"), true),
+		Check("truncated", kDynamic, sizeof(kDynamic) / 2, dynamicText, false),
+		Check("bad_crc", kDynamic, sizeof(kDynamic), dynamicText, false, 1),
+		Check("too_long", kDynamic, sizeof(kDynamic), shortText, false),
+	};
+
+	size_t passed = 0;
+	for (bool result : results)
+		passed += result ? 1 : 0;
+
+	LOG("%zu of %zu cases passed", passed, std::size(results));
+	return passed == std::size(results) ? 0 : 1;
+}
@@ -0,0 +1,185 @@
+#include "debugger.h"
+
+#include "log.h"
+
+#include <algorithm>
+#include <cassert>
+
+namespace
+{
+	constexpr size_t kNumRegisters = 16;
+
+	struct MemoryAccess
+	{
+		uint16_t address;
+		uint16_t size;
+		chip8::Debugger::Access access;
+	};
+
+	// The image memory an opcode will access, if any
+	bool GetMemoryAccess(uint16_t opcode, uint16_t addressRegister, MemoryAccess& access)
+	{
+		uint8_t registerX = (opcode & 0x0F00) >> 8;
+
+		if ((opcode & 0xF000) == 0xD000) // DXYN
+		{
+			access = { addressRegister, static_cast<uint16_t>(opcode & 0x000F), chip8::Debugger::kRead };
+			return true;
+		}
+
+		if ((opcode & 0xF000) == 0xF000)
+		{
+			switch (opcode & 0xFF)
+			{
+			case 0x33: // FX33
+				access = { addressRegister, 3, chip8::Debugger::kWrite };
+				return true;
+			case 0x55: // FX55
+				access = { addressRegister, static_cast<uint16_t>(registerX + 1), chip8::Debugger::kWrite };
+				return true;
+			case 0x65: // FX65
+				access = { addressRegister, static_cast<uint16_t>(registerX + 1), chip8::Debugger::kRead };
+				return true;
+			}
+		}
+
+		return false;
+	}
+
+	bool Compare(uint8_t lhs, chip8::Debugger::Comparison comparison, uint8_t rhs)
+	{
+		switch (comparison)
+		{
+		case chip8::Debugger::Comparison::Equal:
+			return lhs == rhs;
+		case chip8::Debugger::Comparison::NotEqual:
+			return lhs != rhs;
+		case chip8::Debugger::Comparison::Less:
+			return lhs < rhs;
+		case chip8::Debugger::Comparison::Greater:
+			return lhs > rhs;
+		}
+
+		assert(false);
+		return false;
+	}
+}
+
+namespace chip8
+{
+	void Debugger::AddBreakpoint(uint16_t address)
+	{
+		mBreakpoints.push_back({ address, false, {} });
+	}
+
+	void Debugger::AddBreakpoint(uint16_t address, const Condition& condition)
+	{
+		assert(condition.registerIndex < kNumRegisters);
+		mBreakpoints.push_back({ address, true, condition });
+	}
+
+	void Debugger::RemoveBreakpoints(uint16_t address)
+	{
+		mBreakpoints.erase(std::remove_if(mBreakpoints.begin(), mBreakpoints.end(), [address](const Breakpoint& breakpoint) {
+			return breakpoint.address == address;
+		}), mBreakpoints.end());
+	}
+
+	bool Debugger::HasBreakpoint(uint16_t address) const
+	{
+		return std::any_of(mBreakpoints.begin(), mBreakpoints.end(), [address](const Breakpoint& breakpoint) {
+			return breakpoint.address == address;
+		});
+	}
+
+	void Debugger::AddWatchpoint(uint16_t address, uint16_t size, Access access)
+	{
+		assert(size > 0);
+		mWatchpoints.push_back({ address, size, access });
+	}
+
+	void Debugger::RemoveWatchpoints(uint16_t address)
+	{
+		mWatchpoints.erase(std::remove_if(mWatchpoints.begin(), mWatchpoints.end(), [address](const Watchpoint& watchpoint) {
+			return watchpoint.address == address;
+		}), mWatchpoints.end());
+	}
+
+	void Debugger::Continue()
+	{
+		if (mPaused)
+			mSkipChecks = true;
+
+		mPaused = false;
+		mStepping = false;
+	}
+
+	void Debugger::Step()
+	{
+		// Run the opcode we're stopped at, then stop again
+		mPaused = false;
+		mStepping = true;
+		mSkipChecks = true;
+	}
+
+	bool Debugger::BeforeExecute(uint16_t address, uint16_t opcode, const uint8_t* registers, uint16_t addressRegister)
+	{
+		if (mPaused)
+			return false;
+
+		if (mSkipChecks)
+		{
+			mSkipChecks = false;
+			return true;
+		}
+
+		if (mStepping)
+		{
+			mStepping = false;
+			Break("Step", address, opcode, registers, addressRegister);
+			return false;
+		}
+
+		for (const Breakpoint& breakpoint : mBreakpoints)
+		{
+			if (breakpoint.address != address)
+				continue;
+
+			const Condition& condition = breakpoint.condition;
+			if (!breakpoint.conditional || Compare(registers[condition.registerIndex], condition.comparison, condition.value))
+			{
+				Break("Breakpoint", address, opcode, registers, addressRegister);
+				return false;
+			}
+		}
+
+		MemoryAccess access;
+		if (!mWatchpoints.empty() && GetMemoryAccess(opcode, addressRegister, access))
+		{
+			for (const Watchpoint& watchpoint : mWatchpoints)
+			{
+				bool overlaps = access.address < watchpoint.address + watchpoint.size &&
+					watchpoint.address < access.address + access.size;
+				if (overlaps && (watchpoint.access & access.access) != 0)
+				{
+					Break(access.access == kRead ? "Read watchpoint" : "Write watchpoint", address, opcode, registers, addressRegister);
+					return false;
+				}
+			}
+		}
+
+		return true;
+	}
+
+	void Debugger::Break(const char* reason, uint16_t address, uint16_t opcode, const uint8_t* registers, uint16_t addressRegister)
+	{
+		mPaused = true;
+
+		LOG("%s at %03X: %04X", reason, address, opcode);
+		LOG("  V0-V7 %02X %02X %02X %02X %02X %02X %02X %02X",
+			registers[0], registers[1], registers[2], registers[3], registers[4], registers[5], registers[6], registers[7]);
+		LOG("  V8-VF %02X %02X %02X %02X %02X %02X %02X %02X",
+			registers[8], registers[9], registers[10], registers[11], registers[12], registers[13], registers[14], registers[15]);
+		LOG("  I %03X", addressRegister);
+	}
+}
@@ -0,0 +1,87 @@
+#ifndef CHIP8_DEBUGGER_H
+#define CHIP8_DEBUGGER_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace chip8
+{
+	// Breakpoints and watchpoints for a Program. These are checked by a separate instrumented
+	// interpreter loop, which the program only uses while Active() - so a debugger with
+	// nothing set costs nothing.
+	class Debugger
+	{
+	public:
+		enum class Comparison
+		{
+			Equal,
+			NotEqual,
+			Less,
+			Greater,
+		};
+
+		// Breaks only if register registerIndex compares to value
+		struct Condition
+		{
+			uint8_t registerIndex;
+			Comparison comparison;
+			uint8_t value;
+		};
+
+		enum Access : uint8_t
+		{
+			kRead = 1 << 0,
+			kWrite = 1 << 1,
+			kReadWrite = kRead | kWrite,
+		};
+
+		void AddBreakpoint(uint16_t address);
+		void AddBreakpoint(uint16_t address, const Condition& condition);
+		void RemoveBreakpoints(uint16_t address);
+		bool HasBreakpoint(uint16_t address) const;
+
+		// Watches opcode reads and writes of image memory, instruction fetches aren't included
+		void AddWatchpoint(uint16_t address, uint16_t size, Access access);
+		void RemoveWatchpoints(uint16_t address);
+
+		void Pause() { mPaused = true; }
+		void Continue();
+		void Step();
+
+		bool Paused() const { return mPaused; }
+		bool Active() const { return mPaused || mStepping || !mBreakpoints.empty() || !mWatchpoints.empty(); }
+
+		// Called by the instrumented loop before each opcode, returns false if execution should stop
+		bool BeforeExecute(uint16_t address, uint16_t opcode, const uint8_t* registers, uint16_t addressRegister);
+
+	private:
+		struct Breakpoint
+		{
+			uint16_t address;
+			bool conditional;
+			Condition condition;
+		};
+
+		struct Watchpoint
+		{
+			uint16_t address;
+			uint16_t size;
+			Access access;
+		};
+
+		void Break(const char* reason, uint16_t address, uint16_t opcode, const uint8_t* registers, uint16_t addressRegister);
+
+	private:
+		std::vector<Breakpoint> mBreakpoints;
+		std::vector<Watchpoint> mWatchpoints;
+
+		bool mPaused = false;
+		bool mStepping = false;
+
+		// Set on continuing, so that the opcode stopped at doesn't immediately break again
+		bool mSkipChecks = false;
+	};
+}
+
+#endif // CHIP8_DEBUGGER_H
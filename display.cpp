@@ -1,5 +1,7 @@
 #include "display.h"
 
+#include "tracer.h"
+
 #include <algorithm>
 #include <cassert>
 
@@ -9,9 +11,9 @@ namespace chip8
 	{
 		// Drawing assuming 8 wide sprites, with each bit representing a pixel
 		// (so a single uint8_t is one line of the sprite)
-		// Sprite may be placed overlapping the edge of the screen on the right hand side
-		assert(x < 64);
-		assert(y + height <= 32);
+		// Sprite may be placed overlapping the edges of the screen, and wraps around
+		x %= kWidth;
+		y %= kHeight;
 
 		// Need to track if any bits were flipped
 		bool flipped = false;
@@ -26,6 +28,28 @@ namespace chip8
 			// Wrap around on overflow
 			newData |= static_cast<uint64_t>(data[row]) >> shiftDown;
 
+			uint64_t& target = mRows[(y + row) % kHeight];
+			flipped |= static_cast<bool>(target & newData);
+			target ^= newData;
+		}
+
+		return flipped;
+	}
+
+	bool Display::DrawClipped(uint8_t x, uint8_t y, uint8_t height, const uint8_t* data)
+	{
+		// As Draw, but anything past the right or bottom edges isn't drawn.
+		// The starting position still wraps.
+		x %= kWidth;
+		y %= kHeight;
+
+		bool flipped = false;
+
+		for (uint8_t row = 0; row < height && y + row < kHeight; row++)
+		{
+			// Pixels past the right hand side are shifted out
+			uint64_t newData = (static_cast<uint64_t>(data[row]) << 56) >> x;
+
 			flipped |= static_cast<bool>(mRows[y + row] & newData);
 			mRows[y + row] ^= newData;
 		}
@@ -39,8 +63,40 @@ namespace chip8
 		std::fill(std::begin(mRows), std::end(mRows), 0);
 	}
 
+	void Display::Pack(uint8_t* packed) const
+	{
+		for (uint64_t row : mRows)
+		{
+			for (int shift = 56; shift >= 0; shift -= 8)
+				*packed++ = static_cast<uint8_t>(row >> shift);
+		}
+	}
+
+	void Display::Unpack(const uint8_t* packed)
+	{
+		for (uint64_t& row : mRows)
+		{
+			row = 0;
+			for (int byte = 0; byte < 8; byte++)
+				row = (row << 8) | *packed++;
+		}
+	}
+
+	uint64_t Display::Hash() const
+	{
+		uint64_t hash = 0xCBF29CE484222325;
+		for (uint64_t row : mRows)
+		{
+			for (int shift = 56; shift >= 0; shift -= 8)
+				hash = (hash ^ static_cast<uint8_t>(row >> shift)) * 0x100000001B3;
+		}
+		return hash;
+	}
+
 	void Display::Render(SDL_Renderer* renderer)
 	{
+		TRACE_SCOPE("Display::Render");
+
 		// Clear anything on the display
 		int result = SDL_SetRenderDrawColor(renderer, 0, 0, 0, 0);
 		assert(result == 0);
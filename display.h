@@ -12,14 +12,29 @@ namespace chip8
 	public:
 		void Render(SDL_Renderer* renderer);
 
+		// Sprites wrap around to the opposite edge of the screen with Draw, and are
+		// cut off at the edge with DrawClipped. Both return whether any pixel was turned off.
 		bool Draw(uint8_t x, uint8_t y, uint8_t height, const uint8_t* data);
+		bool DrawClipped(uint8_t x, uint8_t y, uint8_t height, const uint8_t* data);
 		void Clear();
 
-	private:
 		// CHIP-8 uses 64x32 screen
 		static constexpr size_t kHeight = 32;
 		static constexpr size_t kWidth = 64;
 
+		// The screen as one bit per pixel, row by row with the leftmost pixel in the highest bit
+		static constexpr size_t kPackedSize = kHeight * kWidth / 8;
+		void Pack(uint8_t* packed) const;
+		void Unpack(const uint8_t* packed);
+
+		// FNV-1a of the packed screen, the same on every platform
+		uint64_t Hash() const;
+
+		// Pixels of a row, leftmost in the highest bit
+		uint64_t GetRow(size_t y) const { return mRows[y]; }
+
+	private:
+
 		uint64_t mRows[kHeight] = {};
 	};
 }
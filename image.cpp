@@ -1,8 +1,21 @@
 #include "image.h"
 
+#include "log.h"
+#include "zip_archive.h"
+
 #include <algorithm>
 #include <cassert>
 #include <cstdio>
+#include <cstring>
+#include <map>
+#include <mutex>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
 
 namespace
 {
@@ -136,32 +149,199 @@ namespace
 namespace chip8
 {
 	Image::Image(const std::filesystem::path& path)
-		: mData{}
+		: mShared(Load(path))
+	{
+		if (mShared == nullptr)
+			mShared = CreateMemory();
+		mData = mShared->data();
+	}
+
+	Image::Image(const uint8_t* program, size_t programSize)
+	{
+		assert(programSize <= kImageSize - kProgramStart);
+
+		std::shared_ptr<Memory> memory = CreateMemory();
+		std::copy_n(program, programSize, memory->data() + kProgramStart);
+
+		mShared = memory;
+		mData = mShared->data();
+	}
+
+	Image::Image(const Image& other)
+		: mShared(other.mShared)
+	{
+		if (other.mPrivate != nullptr)
+			mPrivate = std::make_unique<Memory>(*other.mPrivate);
+
+		mData = mPrivate != nullptr ? mPrivate->data() : mShared->data();
+	}
+
+	Image& Image::operator=(const Image& other)
 	{
+		if (this == &other)
+			return *this;
+
+		if (mPrivate != nullptr)
+		{
+			// Reuse the private copy we already have, so that restoring a saved image doesn't allocate
+			memcpy(mPrivate->data(), other.mData, kImageSize);
+		}
+		else if (other.mPrivate != nullptr)
+		{
+			mShared.reset();
+			mPrivate = std::make_unique<Memory>(*other.mPrivate);
+			mData = mPrivate->data();
+		}
+		else
+		{
+			mShared = other.mShared;
+			mData = mShared->data();
+		}
+		return *this;
+	}
+
+	std::shared_ptr<Image::Memory> Image::CreateMemory()
+	{
+		auto memory = std::make_shared<Memory>();
+		memory->fill(0);
+
+		// Copy sprites into the expected location
+		memcpy(memory->data() + kSpriteStart, sBuiltinSprites, sizeof(sBuiltinSprites));
+
+		return memory;
+	}
+
+	std::shared_ptr<const Image::Memory> Image::Load(const std::filesystem::path& path)
+	{
+		// Keep track of loaded ROMs, so that every instance of a ROM uses the same memory
+		static std::mutex sLoadedMutex;
+		static std::map<std::filesystem::path, std::weak_ptr<const Memory>> sLoaded;
+
+		std::lock_guard<std::mutex> lock(sLoadedMutex);
+
+		std::filesystem::path key = std::filesystem::weakly_canonical(path);
+		auto found = sLoaded.find(key);
+		if (found != sLoaded.end())
+		{
+			if (std::shared_ptr<const Memory> loaded = found->second.lock())
+				return loaded;
+		}
+
+		// Forget ROMs nothing uses any more, before they pile up
+		for (auto entry = sLoaded.begin(); entry != sLoaded.end();)
+		{
+			if (entry->second.expired())
+				entry = sLoaded.erase(entry);
+			else
+				++entry;
+		}
+
+		std::shared_ptr<Memory> memory = CreateMemory();
+
+		// A ROM inside a zip archive is inflated straight into place in the image
+		std::filesystem::path archivePath;
+		std::string name;
+		if (!std::filesystem::is_regular_file(path) && ZipArchive::Split(path, archivePath, name))
+		{
+			// Archives come from anywhere, so nothing in one is trusted
+			std::shared_ptr<const ZipArchive> archive = ZipArchive::Open(archivePath);
+			const ZipArchive::Entry* entry = archive != nullptr ? archive->Find(name) : nullptr;
+			if (entry == nullptr)
+			{
+				LOG_ERROR("No ROM at %s", path.string().c_str());
+				return nullptr;
+			}
+
+			if (entry->size == 0 || entry->size > kImageSize - kProgramStart)
+			{
+				LOG_ERROR("%s is %u bytes, a ROM has to be 1 to %zu", path.string().c_str(), entry->size, kImageSize - kProgramStart);
+				return nullptr;
+			}
+
+			// A corrupt entry may have been partly inflated, the memory is thrown away with it
+			if (!archive->Extract(*entry, memory->data() + kProgramStart))
+			{
+				LOG_ERROR("%s is corrupt", path.string().c_str());
+				return nullptr;
+			}
+
+			sLoaded[key] = memory;
+			return memory;
+		}
+
 #ifdef _WIN32
 		FILE* file = _wfopen(path.c_str(), L"rb");
+		if (file == nullptr)
+		{
+			LOG_ERROR("Unable to open %s", path.string().c_str());
+			return nullptr;
+		}
+
+		long fileSize = fseek(file, 0, SEEK_END) == 0 ? ftell(file) : -1;
+		if (fileSize <= 0 || static_cast<size_t>(fileSize) > kImageSize - kProgramStart)
+		{
+			LOG_ERROR("%s is %ld bytes, a ROM has to be 1 to %zu", path.string().c_str(), fileSize, kImageSize - kProgramStart);
+			fclose(file);
+			return nullptr;
+		}
+
+		// Read the file data into place in the image
+		bool read = fseek(file, 0, SEEK_SET) == 0 && fread(memory->data() + kProgramStart, fileSize, 1, file) == 1;
+		fclose(file);
+		if (!read)
+		{
+			LOG_ERROR("Unable to read %s", path.string().c_str());
+			return nullptr;
+		}
 #else
-		FILE* file = fopen(filePath.c_str(), "rb");
-#endif
-		assert(file != nullptr);
+		int file = open(path.c_str(), O_RDONLY);
+		if (file < 0)
+		{
+			LOG_ERROR("Unable to open %s", path.string().c_str());
+			return nullptr;
+		}
 
-		int result = fseek(file, 0, SEEK_END);
-		assert(result == 0);
+		struct stat fileStat;
+		if (fstat(file, &fileStat) != 0)
+		{
+			LOG_ERROR("Unable to read %s", path.string().c_str());
+			close(file);
+			return nullptr;
+		}
 
-		long fileSize = ftell(file);
-		assert(fileSize > 0);
-		assert(fileSize <= kImageSize - kProgramStart);
-		result = fseek(file, 0, SEEK_SET);
-		assert(fileSize);
+		size_t fileSize = fileStat.st_size;
+		if (fileSize == 0 || fileSize > kImageSize - kProgramStart)
+		{
+			LOG_ERROR("%s is %zu bytes, a ROM has to be 1 to %zu", path.string().c_str(), fileSize, kImageSize - kProgramStart);
+			close(file);
+			return nullptr;
+		}
 
-		// Read the file data into place in the image
-		size_t readElements = fread(mData + kProgramStart, fileSize, 1, file);
-		assert(readElements == 1);
+		// Map the file rather than reading it, the mapping only lives long enough to place it in the image
+		void* fileData = mmap(nullptr, fileSize, PROT_READ, MAP_PRIVATE, file, 0);
+		close(file);
+		if (fileData == MAP_FAILED)
+		{
+			LOG_ERROR("Unable to read %s", path.string().c_str());
+			return nullptr;
+		}
 
-		fclose(file);
+		memcpy(memory->data() + kProgramStart, fileData, fileSize);
+		munmap(fileData, fileSize);
+#endif
 
-		// Copy sprites into the expected location
-		memcpy(mData + kSpriteStart, sBuiltinSprites, sizeof(sBuiltinSprites));
+		sLoaded[key] = memory;
+		return memory;
+	}
+
+	void Image::MakePrivate()
+	{
+		assert(mPrivate == nullptr);
+		mPrivate = std::make_unique<Memory>(*mShared);
+		mData = mPrivate->data();
+
+		// Nothing reads from the shared copy any more
+		mShared.reset();
 	}
 
 	uint16_t Image::StartOffset()
@@ -1,9 +1,12 @@
 #ifndef CHIP8_IMAGE_H
 #define CHIP8_IMAGE_H
 
+#include <array>
 #include <cassert>
+#include <cstdint>
 #include <cstdlib>
 #include <filesystem>
+#include <memory>
 
 namespace chip8
 {
@@ -12,20 +15,56 @@ namespace chip8
 		// 4K memory available
 		static constexpr size_t kImageSize = 4 * 1024;
 
+		using Memory = std::array<uint8_t, kImageSize>;
+
 	public:
+		// A ROM which can't be used (missing, empty, too big for memory or, in a zip archive,
+		// corrupt) is logged, and leaves the image empty
 		Image(const std::filesystem::path& path);
+		Image(const uint8_t* program, size_t programSize);
+
+		// Copies share memory the same way as separately loaded images of a ROM
+		Image(const Image& other);
+		Image& operator=(const Image& other);
+		Image(Image&& other) = default;
+		Image& operator=(Image&& other) = default;
 
-		uint16_t StartOffset();
+		static uint16_t StartOffset();
 		uint16_t SpriteOffset(uint8_t index);
 
-		uint8_t& operator[](size_t offset) {
+		static constexpr size_t Size() { return kImageSize; }
+
+		const uint8_t& operator[](size_t offset) const {
 			assert(offset < kImageSize);
 			return mData[offset];
 		}
 
+		// Whether the memory is still shared with other images of the ROM, which keeps its address the same
+		bool IsShared() const { return mPrivate == nullptr; }
+
+		// Images of the same ROM share their memory until one of them is written to,
+		// at which point that image takes a private copy.
+		uint8_t* Write(size_t offset, size_t count) {
+			assert(offset + count <= kImageSize);
+			if (mPrivate == nullptr)
+				MakePrivate();
+			return mPrivate->data() + offset;
+		}
+
 	private:
-		uint8_t mData[kImageSize];
+		static std::shared_ptr<Memory> CreateMemory();
+		// nullptr if the ROM can't be used
+		static std::shared_ptr<const Memory> Load(const std::filesystem::path& path);
+
+		void MakePrivate();
+
+	private:
+		std::shared_ptr<const Memory> mShared;
+		std::unique_ptr<Memory> mPrivate;
+
+		// Whichever of the above is current
+		const uint8_t* mData;
 	};
 }
 
-#endif // CHIP8_SYSTEM_H
\ No newline at end of file
+#endif // CHIP8_IMAGE_H
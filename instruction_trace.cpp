@@ -0,0 +1,235 @@
+#include "instruction_trace.h"
+
+#include "log.h"
+
+#include <cassert>
+
+namespace
+{
+	constexpr size_t kReadSize = 64 * 1024;
+
+	uint16_t Read16(const uint8_t* input)
+	{
+		return static_cast<uint16_t>(input[0] | (input[1] << 8));
+	}
+}
+
+namespace chip8
+{
+	InstructionTrace::InstructionTrace(const std::filesystem::path& path)
+	{
+		mFile = fopen(path.string().c_str(), "wb");
+		if (mFile == nullptr)
+		{
+			LOG_ERROR("Unable to create instruction trace %s", path.string().c_str());
+			return;
+		}
+
+		fwrite(kHeader, sizeof(kHeader), 1, mFile);
+
+		mPages[0].resize(kPageSize);
+		mPages[1].resize(kPageSize);
+		mWriter = std::thread(&InstructionTrace::WriterThread, this);
+	}
+
+	InstructionTrace::~InstructionTrace()
+	{
+		if (mFile == nullptr)
+			return;
+
+		// Whatever's left in the current page, then wait for the writer to finish with it
+		SwapPages();
+		{
+			std::lock_guard<std::mutex> lock(mMutex);
+			mStopping = true;
+		}
+		mCondition.notify_all();
+		mWriter.join();
+
+		fclose(mFile);
+	}
+
+	uint8_t* InstructionTrace::WriteRegisters(uint8_t* output, uint8_t& flags, const uint8_t* registers, uint16_t mask)
+	{
+		if ((mask & (mask - 1)) == 0)
+		{
+			// Just the one, its index goes in the flags
+			uint8_t index = 0;
+			while ((mask & (1 << index)) == 0)
+				index++;
+
+			flags |= kOneRegister | (index << 4);
+			*output++ = registers[index];
+		}
+		else
+		{
+			flags |= kRegisters;
+			output = Write16(output, mask);
+			for (size_t index = 0; index < kNumRegisters; index++)
+			{
+				if (mask & (1 << index))
+					*output++ = registers[index];
+			}
+		}
+
+		std::memcpy(mRegisters, registers, kNumRegisters);
+		return output;
+	}
+
+	void InstructionTrace::SwapPages()
+	{
+		if (mFile == nullptr)
+		{
+			// Nowhere to write to, so just drop what's been recorded
+			mPageUsed = 0;
+			return;
+		}
+
+		std::unique_lock<std::mutex> lock(mMutex);
+		mCondition.wait(lock, [this]() { return mWriting == nullptr; });
+
+		mWriting = mPages[mPage].data();
+		mWritingSize = mPageUsed;
+		lock.unlock();
+		mCondition.notify_all();
+
+		mPage = 1 - mPage;
+		mPageUsed = 0;
+	}
+
+	void InstructionTrace::WriterThread()
+	{
+		std::unique_lock<std::mutex> lock(mMutex);
+		while (true)
+		{
+			mCondition.wait(lock, [this]() { return mWriting != nullptr || mStopping; });
+			if (mWriting == nullptr)
+				return;
+
+			// The page isn't touched again until it's handed back
+			const uint8_t* page = mWriting;
+			size_t size = mWritingSize;
+			lock.unlock();
+
+			size_t written = fwrite(page, 1, size, mFile);
+			if (written != size)
+				LOG_ERROR("Instruction trace truncated, only wrote %zu of %zu bytes", written, size);
+
+			lock.lock();
+			mWriting = nullptr;
+			mCondition.notify_all();
+		}
+	}
+
+	InstructionTraceReader::InstructionTraceReader(const std::filesystem::path& path)
+	{
+		mFile = fopen(path.string().c_str(), "rb");
+		if (mFile == nullptr)
+		{
+			LOG_ERROR("Unable to open instruction trace %s", path.string().c_str());
+			return;
+		}
+
+		mBuffer.resize(kReadSize);
+		if (!Fill(sizeof(InstructionTrace::kHeader)) || std::memcmp(mBuffer.data(), InstructionTrace::kHeader, sizeof(InstructionTrace::kHeader)) != 0)
+		{
+			LOG_ERROR("%s isn't an instruction trace", path.string().c_str());
+			fclose(mFile);
+			mFile = nullptr;
+			return;
+		}
+		mOffset += sizeof(InstructionTrace::kHeader);
+	}
+
+	InstructionTraceReader::~InstructionTraceReader()
+	{
+		if (mFile != nullptr)
+			fclose(mFile);
+	}
+
+	bool InstructionTraceReader::Fill(size_t size)
+	{
+		if (mSize - mOffset >= size)
+			return true;
+
+		// Keep what's left and read more after it
+		std::memmove(mBuffer.data(), mBuffer.data() + mOffset, mSize - mOffset);
+		mSize -= mOffset;
+		mOffset = 0;
+		mSize += fread(mBuffer.data() + mSize, 1, mBuffer.size() - mSize, mFile);
+
+		return mSize >= size;
+	}
+
+	bool InstructionTraceReader::Next(Entry& entry)
+	{
+		if (mFile == nullptr || !Fill(1))
+			return false;
+
+		// An entry is never longer than this, but the last one may be shorter
+		Fill(InstructionTrace::kMaxEntrySize);
+
+		const uint8_t* input = mBuffer.data() + mOffset;
+		const uint8_t* end = mBuffer.data() + mSize;
+		uint8_t flags = *input++;
+
+		auto have = [&](size_t size) { return static_cast<size_t>(end - input) >= size; };
+
+		uint16_t address = mNextAddress;
+		if (flags & InstructionTrace::kJumped)
+		{
+			if (!have(2))
+				return false;
+			address = Read16(input);
+			input += 2;
+		}
+
+		if (!have(2))
+			return false;
+		entry.opcode = Read16(input);
+		input += 2;
+
+		entry.changedRegisters = 0;
+		if (flags & InstructionTrace::kOneRegister)
+		{
+			if (!have(1))
+				return false;
+			uint8_t index = flags >> 4;
+			mRegisters[index] = *input++;
+			entry.changedRegisters = 1 << index;
+		}
+		else if (flags & InstructionTrace::kRegisters)
+		{
+			if (!have(2))
+				return false;
+			entry.changedRegisters = Read16(input);
+			input += 2;
+
+			for (size_t index = 0; index < InstructionTrace::kNumRegisters; index++)
+			{
+				if ((entry.changedRegisters & (1 << index)) == 0)
+					continue;
+				if (!have(1))
+					return false;
+				mRegisters[index] = *input++;
+			}
+		}
+
+		if (flags & InstructionTrace::kAddressRegister)
+		{
+			if (!have(2))
+				return false;
+			mAddressRegister = Read16(input);
+			input += 2;
+		}
+
+		mOffset = input - mBuffer.data();
+		mNextAddress = address + 2;
+
+		entry.index = mIndex++;
+		entry.address = address;
+		std::memcpy(entry.registers, mRegisters, sizeof(mRegisters));
+		entry.addressRegister = mAddressRegister;
+		return true;
+	}
+}
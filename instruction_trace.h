@@ -0,0 +1,188 @@
+#ifndef CHIP8_INSTRUCTION_TRACE_H
+#define CHIP8_INSTRUCTION_TRACE_H
+
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace chip8
+{
+	// Every instruction a program executes, written as it runs to a file that can be read back
+	// with InstructionTraceReader and compared with chip8_tracediff.
+	//
+	// The file is kHeader, then one entry per instruction holding only what changed:
+	//   flags      a byte of the kEntry flags below, with a register index in the top nibble
+	//   address    uint16_t, if kJumped: it wasn't the one after the previous instruction
+	//   opcode     uint16_t
+	//   registers  if kOneRegister, the new value of the register in the top nibble of flags,
+	//              if kRegisters, a uint16_t mask of the registers changed then their values
+	//   I          uint16_t, if kAddressRegister
+	// All little endian. Changes are from the previous entry, or from zero for the first.
+	//
+	// Entries are written into a page while the other is written to the file on a thread of
+	// its own, so a program runs at close to full speed while traced.
+	class InstructionTrace
+	{
+	public:
+		static constexpr char kHeader[8] = { 'C', '8', 'T', 'R', 'A', 'C', 'E', '1' };
+
+		enum EntryFlags : uint8_t
+		{
+			kJumped = 1 << 0,
+			kOneRegister = 1 << 1,
+			kRegisters = 1 << 2,
+			kAddressRegister = 1 << 3,
+		};
+
+		static constexpr size_t kNumRegisters = 16;
+		static constexpr size_t kMaxEntrySize = 1 + 2 + 2 + 2 + kNumRegisters + 2;
+
+		explicit InstructionTrace(const std::filesystem::path& path);
+		~InstructionTrace();
+
+		InstructionTrace(const InstructionTrace&) = delete;
+		InstructionTrace& operator=(const InstructionTrace&) = delete;
+
+		// After executing the opcode at address, with the registers as it left them
+		void Record(uint16_t address, uint16_t opcode, const uint8_t* registers, uint16_t addressRegister) {
+			if (mPageUsed + kMaxEntrySize > kPageSize)
+				SwapPages();
+
+			uint8_t* entry = mPages[mPage].data() + mPageUsed;
+			uint8_t* next = entry + 1;
+			uint8_t flags = 0;
+
+			if (address != mNextAddress)
+			{
+				flags |= kJumped;
+				next = Write16(next, address);
+			}
+			mNextAddress = address + 2;
+
+			next = Write16(next, opcode);
+
+			// Most opcodes change one register or none
+			if (uint16_t mask = ChangedRegisters(registers); mask != 0)
+				next = WriteRegisters(next, flags, registers, mask);
+
+			if (addressRegister != mAddressRegister)
+			{
+				flags |= kAddressRegister;
+				next = Write16(next, addressRegister);
+				mAddressRegister = addressRegister;
+			}
+
+			entry[0] = flags;
+			mPageUsed = next - mPages[mPage].data();
+		}
+
+	private:
+		static constexpr size_t kPageSize = 64 * 1024;
+
+		static uint8_t* Write16(uint8_t* output, uint16_t value) {
+			output[0] = value & 0xFF;
+			output[1] = value >> 8;
+			return output + 2;
+		}
+
+		// A bit for each register that differs from the last entry, eight at a time
+		uint16_t ChangedRegisters(const uint8_t* registers) const {
+			uint16_t mask = 0;
+			for (size_t half = 0; half < 2; half++)
+			{
+				uint64_t current;
+				uint64_t previous;
+				std::memcpy(&current, registers + half * 8, sizeof(current));
+				std::memcpy(&previous, mRegisters + half * 8, sizeof(previous));
+
+				// The top bit of each byte that differs, gathered into the top byte by the multiply
+				uint64_t difference = current ^ previous;
+				uint64_t nonZero = (((difference & 0x7F7F7F7F7F7F7F7F) + 0x7F7F7F7F7F7F7F7F) | difference) & 0x8080808080808080;
+				mask |= static_cast<uint16_t>(((nonZero >> 7) * 0x0102040810204080) >> 56) << (half * 8);
+			}
+			return mask;
+		}
+
+		uint8_t* WriteRegisters(uint8_t* output, uint8_t& flags, const uint8_t* registers, uint16_t mask);
+
+		// Hands the current page to the writer, waiting for it if it's still busy with the other
+		void SwapPages();
+		void WriterThread();
+
+	private:
+		FILE* mFile = nullptr;
+
+		// The page being filled
+		std::vector<uint8_t> mPages[2];
+		size_t mPage = 0;
+		size_t mPageUsed = 0;
+
+		// State as of the last entry
+		uint16_t mNextAddress = 0xFFFF;
+		uint8_t mRegisters[kNumRegisters] = {};
+		uint16_t mAddressRegister = 0;
+
+		// The page handed to the writer, if it hasn't finished with it
+		std::mutex mMutex;
+		std::condition_variable mCondition;
+		const uint8_t* mWriting = nullptr;
+		size_t mWritingSize = 0;
+		bool mStopping = false;
+
+		std::thread mWriter;
+	};
+
+	// Reads a trace back an entry at a time, without loading the whole file
+	class InstructionTraceReader
+	{
+	public:
+		struct Entry
+		{
+			// Position in the trace, from zero
+			uint64_t index;
+
+			uint16_t address;
+			uint16_t opcode;
+
+			// After executing the opcode
+			uint8_t registers[InstructionTrace::kNumRegisters];
+			uint16_t addressRegister;
+			uint16_t changedRegisters; // Mask
+		};
+
+		explicit InstructionTraceReader(const std::filesystem::path& path);
+		~InstructionTraceReader();
+
+		InstructionTraceReader(const InstructionTraceReader&) = delete;
+		InstructionTraceReader& operator=(const InstructionTraceReader&) = delete;
+
+		// False if the file couldn't be opened or isn't a trace
+		bool Valid() const { return mFile != nullptr; }
+
+		// Returns false at the end of the trace, or if it's truncated part way through an entry
+		bool Next(Entry& entry);
+
+	private:
+		bool Fill(size_t size);
+
+	private:
+		FILE* mFile = nullptr;
+
+		std::vector<uint8_t> mBuffer;
+		size_t mOffset = 0;
+		size_t mSize = 0;
+
+		uint64_t mIndex = 0;
+		uint16_t mNextAddress = 0xFFFF;
+		uint8_t mRegisters[InstructionTrace::kNumRegisters] = {};
+		uint16_t mAddressRegister = 0;
+	};
+}
+
+#endif // CHIP8_INSTRUCTION_TRACE_H
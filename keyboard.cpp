@@ -1,6 +1,6 @@
 ﻿#include "keyboard.h"
 
-#include <algorithm>
+#include <array>
 #include <cassert>
 
 namespace
@@ -18,7 +18,7 @@ namespace
 	// q w e r
 	// a s d f
 	// z x c v
-	SDL_Scancode kScancodes[] = {
+	constexpr SDL_Scancode kScancodes[] = {
 		SDL_SCANCODE_X,
 		SDL_SCANCODE_1,
 		SDL_SCANCODE_2,
@@ -37,35 +37,50 @@ namespace
 		SDL_SCANCODE_V,
 	};
 
-	constexpr uint8_t kNumKeys = 16;
+	using chip8::Keyboard;
 
-	static_assert(sizeof(kScancodes) == sizeof(SDL_Scancode) * kNumKeys, "Incorrect number of scancodes");
+	static_assert(sizeof(kScancodes) == sizeof(SDL_Scancode) * Keyboard::kNumKeys, "Incorrect number of scancodes");
+
+	// The reverse of kScancodes, covering every scancode so that a lookup is a single load
+	constexpr std::array<uint8_t, SDL_NUM_SCANCODES> kKeys = []() {
+		std::array<uint8_t, SDL_NUM_SCANCODES> keys = {};
+		for (size_t scancode = 0; scancode < keys.size(); scancode++)
+			keys[scancode] = Keyboard::kNoKey;
+		for (uint8_t key = 0; key < Keyboard::kNumKeys; key++)
+			keys[kScancodes[key]] = key;
+		return keys;
+	}();
 }
 
 namespace chip8
 {
-	void Keyboard::OnKeyDown(const SDL_Keysym& keysym)
+	uint8_t Keyboard::KeyFromScancode(SDL_Scancode scancode)
+	{
+		if (scancode < 0 || scancode >= SDL_NUM_SCANCODES)
+			return kNoKey;
+
+		return kKeys[scancode];
+	}
+
+	SDL_Scancode Keyboard::ScancodeFromKey(uint8_t keyIndex)
+	{
+		assert(keyIndex < kNumKeys);
+		return kScancodes[keyIndex];
+	}
+
+	void Keyboard::SetKeyState(uint8_t keyIndex, bool down)
 	{
-		auto it = std::find(std::begin(kScancodes), std::end(kScancodes), keysym.scancode);
-		if (it != std::end(kScancodes))
+		assert(keyIndex < kNumKeys);
+		uint16_t mask = (1u << keyIndex);
+		if (down)
 		{
-			size_t keyIndex = it - std::begin(kScancodes);
-			uint16_t mask = (1u << keyIndex);
 			mKeyState |= mask;
 			mPressedState |= mask;
 		}
-	}
-
-	void Keyboard::OnKeyUp(const SDL_Keysym& keysym)
-	{
-		auto it = std::find(std::begin(kScancodes), std::end(kScancodes), keysym.scancode);
-		if (it != std::end(kScancodes))
+		else
 		{
-			size_t keyIndex = it - std::begin(kScancodes);
-			uint16_t mask = ~(1u << keyIndex);
-
-			// Clear only the key state, the pressed state is cleared on frame end.
-			mKeyState &= mask;
+			// Only the key state, the pressed state lasts until ClearPressedKeys
+			mKeyState &= ~mask;
 		}
 	}
 
@@ -3,18 +3,32 @@
 
 #include "SDL.h"
 
+#include <cstdint>
+
 namespace chip8
 {
 	class Keyboard
 	{
 	public:
-		void OnKeyDown(const SDL_Keysym& keysym);
-		void OnKeyUp(const SDL_Keysym& keysym);
+		static constexpr uint8_t kNumKeys = 16;
+		static constexpr uint8_t kNoKey = 0xFF;
+
+		// The CHIP-8 key a scancode is mapped to, or kNoKey
+		static uint8_t KeyFromScancode(SDL_Scancode scancode);
+		static SDL_Scancode ScancodeFromKey(uint8_t keyIndex);
+
+		void SetKeyState(uint8_t keyIndex, bool down);
 
 		bool GetKeyState(uint8_t keyIndex);
+
+		// Whether the key has gone down since the last ClearPressedKeys
 		bool GetKeyPressed(uint8_t keyIndex);
 		void ClearPressedKeys();
 
+		// A bit per key
+		uint16_t GetHeldKeys() const { return mKeyState; }
+		uint16_t GetPressedKeys() const { return mPressedState; }
+
 	private:
 		uint16_t mKeyState = 0;
 		uint16_t mPressedState = 0;
@@ -0,0 +1,215 @@
+#include "latency.h"
+
+#ifdef CHIP8_LATENCY
+
+#include "keyboard.h"
+#include "log.h"
+
+#include "SDL.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <mutex>
+#include <vector>
+
+namespace
+{
+	using ClockType = std::chrono::steady_clock;
+
+	// Far enough apart that a press is normally done with before the next one
+	constexpr auto kPressInterval = std::chrono::milliseconds(500);
+	constexpr auto kHoldTime = std::chrono::milliseconds(100);
+
+	// A press still in flight after this long isn't going to reach the screen
+	constexpr auto kGiveUpTime = std::chrono::seconds(2);
+
+	constexpr uint8_t kDefaultKey = 0x5;
+
+	enum Stage : uint8_t
+	{
+		Injected,
+		Applied,
+		Read,
+		Displayed,
+		Presented,
+		kNumStages,
+	};
+
+	// What each stage measures, from the stage before it
+	constexpr const char* kStageNames[kNumStages] = {
+		"total",
+		"event queue and pacing",
+		"until the program reads it",
+		"until the program draws",
+		"render and present",
+	};
+
+	// The stage reached by the press in flight, kNumStages with none. Programs may run on
+	// worker threads, so it's checked before taking the lock to keep the hooks cheap.
+	std::atomic<uint8_t> sStage = kNumStages;
+
+	std::mutex sMutex;
+	ClockType::time_point sTimes[kNumStages];
+	uint64_t sReadHash = 0;
+
+	// Only used by OnFrame, on the main thread
+	uint8_t sKey = kDefaultKey;
+	bool sKeyDown = false;
+	bool sStarted = false;
+	ClockType::time_point sNextPress;
+	ClockType::time_point sRelease;
+
+	// Each stage's part of every press that reached the screen, with the total in place of Injected
+	std::vector<ClockType::duration> sLatencies[kNumStages];
+	uint64_t sGivenUp = 0;
+
+	void PushKey(bool down)
+	{
+		SDL_Event event = {};
+		event.type = down ? SDL_KEYDOWN : SDL_KEYUP;
+		event.key.timestamp = SDL_GetTicks();
+		event.key.state = down ? SDL_PRESSED : SDL_RELEASED;
+		event.key.keysym.scancode = chip8::Keyboard::ScancodeFromKey(sKey);
+
+		int result = SDL_PushEvent(&event);
+		if (result < 0)
+			LOG_WARNING("Unable to inject key: %s", SDL_GetError());
+
+		sKeyDown = down;
+	}
+
+	// Moves the press in flight on to the next stage if it's at the one before
+	bool Advance(Stage stage)
+	{
+		if (sStage.load(std::memory_order_relaxed) != stage - 1)
+			return false;
+
+		std::lock_guard<std::mutex> lock(sMutex);
+		if (sStage.load(std::memory_order_relaxed) != stage - 1)
+			return false;
+
+		sTimes[stage] = ClockType::now();
+		sStage.store(stage, std::memory_order_relaxed);
+		return true;
+	}
+
+	double Milliseconds(ClockType::duration duration)
+	{
+		return std::chrono::duration<double, std::milli>(duration).count();
+	}
+}
+
+namespace chip8
+{
+	void LatencyProbe::OnFrame()
+	{
+		auto now = ClockType::now();
+		if (!sStarted)
+		{
+			if (const char* key = std::getenv("CHIP8_LATENCY_KEY"))
+				sKey = static_cast<uint8_t>(std::strtoul(key, nullptr, 16) & 0xF);
+
+			LOG("Measuring input latency with key %X", sKey);
+			sNextPress = now + kPressInterval;
+			sStarted = true;
+		}
+
+		if (sKeyDown && now >= sRelease)
+			PushKey(false);
+
+		std::lock_guard<std::mutex> lock(sMutex);
+		uint8_t stage = sStage.load(std::memory_order_relaxed);
+		if (stage != kNumStages && now - sTimes[Injected] > kGiveUpTime)
+		{
+			sGivenUp++;
+			sStage.store(kNumStages, std::memory_order_relaxed);
+			stage = kNumStages;
+		}
+
+		if (stage == kNumStages && !sKeyDown && now >= sNextPress)
+		{
+			PushKey(true);
+			sTimes[Injected] = now;
+			sStage.store(Injected, std::memory_order_relaxed);
+			sRelease = now + kHoldTime;
+			sNextPress = now + kPressInterval;
+		}
+	}
+
+	void LatencyProbe::OnKeyApplied(uint8_t key, bool down)
+	{
+		if (down && key == sKey)
+			Advance(Applied);
+	}
+
+	void LatencyProbe::OnKeyRead(uint8_t key, const Display& display)
+	{
+		if (key != sKey || sStage.load(std::memory_order_relaxed) != Applied)
+			return;
+
+		// What's on screen now, so that the response can be told apart
+		uint64_t hash = display.Hash();
+		std::lock_guard<std::mutex> lock(sMutex);
+		if (sStage.load(std::memory_order_relaxed) == Applied)
+		{
+			sTimes[Read] = ClockType::now();
+			sReadHash = hash;
+			sStage.store(Read, std::memory_order_relaxed);
+		}
+	}
+
+	void LatencyProbe::OnDisplayWritten(const Display& display)
+	{
+		if (sStage.load(std::memory_order_relaxed) != Read)
+			return;
+
+		// Drawing nothing, or the same again, isn't a response
+		uint64_t hash = display.Hash();
+		std::lock_guard<std::mutex> lock(sMutex);
+		if (sStage.load(std::memory_order_relaxed) == Read && hash != sReadHash)
+		{
+			sTimes[Displayed] = ClockType::now();
+			sStage.store(Displayed, std::memory_order_relaxed);
+		}
+	}
+
+	void LatencyProbe::OnPresented()
+	{
+		if (!Advance(Presented))
+			return;
+
+		std::lock_guard<std::mutex> lock(sMutex);
+		sLatencies[Injected].push_back(sTimes[Presented] - sTimes[Injected]);
+		for (uint8_t stage = Applied; stage < kNumStages; stage++)
+			sLatencies[stage].push_back(sTimes[stage] - sTimes[stage - 1]);
+
+		sStage.store(kNumStages, std::memory_order_relaxed);
+	}
+
+	void LatencyProbe::Report()
+	{
+		std::lock_guard<std::mutex> lock(sMutex);
+
+		size_t count = sLatencies[Injected].size();
+		LOG("Input latency: %zu presses reached the screen, %llu didn't", count, static_cast<unsigned long long>(sGivenUp));
+		if (count == 0)
+			return;
+
+		LOG("  %-28s %8s %8s %8s %8s", "ms", "p50", "p90", "p99", "max");
+		for (uint8_t stage = Applied; stage <= kNumStages; stage++)
+		{
+			// The total goes last
+			std::vector<ClockType::duration>& latencies = sLatencies[stage % kNumStages];
+			std::sort(latencies.begin(), latencies.end());
+			LOG("  %-28s %8.2f %8.2f %8.2f %8.2f", kStageNames[stage % kNumStages],
+				Milliseconds(latencies[count / 2]),
+				Milliseconds(latencies[count * 9 / 10]),
+				Milliseconds(latencies[count * 99 / 100]),
+				Milliseconds(latencies.back()));
+		}
+	}
+}
+
+#endif // CHIP8_LATENCY
@@ -0,0 +1,61 @@
+#ifndef CHIP8_LATENCY_H
+#define CHIP8_LATENCY_H
+
+// Input latency measurement is only compiled in when CHIP8_LATENCY is defined, the
+// LATENCY_ macros below expand to nothing otherwise.
+#ifdef CHIP8_LATENCY
+
+#include "display.h"
+
+#include <cstdint>
+
+namespace chip8
+{
+	// Presses a key on its own every so often, and times how long it takes to get through each
+	// stage on the way to the screen:
+	//
+	//   injected   pushed onto the SDL event queue
+	//   applied    the program's keyboard sees it go down
+	//   read       the first EX9E/EXA1 for that key after that
+	//   displayed  the first change to the display after that
+	//   presented  SDL_RenderPresent returns with the change
+	//
+	// Only one press is in flight at a time. Presses the program never reacts to are given up
+	// on. The distribution for each stage is logged by Report.
+	//
+	// The key is set with CHIP8_LATENCY_KEY (0-F), it wants to be one the running program
+	// responds to by drawing.
+	class LatencyProbe
+	{
+	public:
+		// Once a frame, before events are polled, to inject the next press or release
+		static void OnFrame();
+
+		static void OnKeyApplied(uint8_t key, bool down);
+		static void OnKeyRead(uint8_t key, const Display& display);
+		static void OnDisplayWritten(const Display& display);
+		static void OnPresented();
+
+		static void Report();
+	};
+}
+
+#define LATENCY_FRAME() chip8::LatencyProbe::OnFrame()
+#define LATENCY_KEY_APPLIED(key, down) chip8::LatencyProbe::OnKeyApplied(key, down)
+#define LATENCY_KEY_READ(key, display) chip8::LatencyProbe::OnKeyRead(key, display)
+#define LATENCY_DISPLAY_WRITTEN(display) chip8::LatencyProbe::OnDisplayWritten(display)
+#define LATENCY_PRESENTED() chip8::LatencyProbe::OnPresented()
+#define LATENCY_REPORT() chip8::LatencyProbe::Report()
+
+#else
+
+#define LATENCY_FRAME() do {} while(0)
+#define LATENCY_KEY_APPLIED(key, down) do {} while(0)
+#define LATENCY_KEY_READ(key, display) do {} while(0)
+#define LATENCY_DISPLAY_WRITTEN(display) do {} while(0)
+#define LATENCY_PRESENTED() do {} while(0)
+#define LATENCY_REPORT() do {} while(0)
+
+#endif // CHIP8_LATENCY
+
+#endif // CHIP8_LATENCY_H
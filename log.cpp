@@ -0,0 +1,376 @@
+#include "log.h"
+
+#include <algorithm>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+namespace
+{
+	using ClockType = std::chrono::steady_clock;
+
+	// Records buffered per thread, further messages are dropped until the writer catches up
+	constexpr size_t kBufferCapacity = 1024;
+
+	// How often the writer looks for new records when nobody is flushing
+	constexpr auto kPollPeriod = std::chrono::milliseconds(10);
+
+	// Identical messages beyond this many in a window are counted instead of printed
+	constexpr uint32_t kRepeatLimit = 10;
+	constexpr auto kRepeatWindow = std::chrono::seconds(1);
+
+	constexpr size_t kMaxMessageSize = 1024;
+
+	// Only the owning thread writes records and moves head, only the writer moves tail
+	struct ThreadBuffer
+	{
+		std::atomic_uint64_t head = 0;
+		std::atomic_uint64_t tail = 0;
+		std::atomic_uint64_t dropped = 0;
+		chip8::LogRecord records[kBufferCapacity];
+	};
+
+	// Buffers are kept after their thread exits, so that their records still get printed
+	std::mutex sBuffersMutex;
+	std::vector<std::unique_ptr<ThreadBuffer>> sBuffers;
+
+	ThreadBuffer& CurrentBuffer()
+	{
+		// Registering takes the lock, but only the first time a thread logs
+		thread_local ThreadBuffer* tBuffer = []() {
+			std::lock_guard<std::mutex> lock(sBuffersMutex);
+			sBuffers.push_back(std::make_unique<ThreadBuffer>());
+			return sBuffers.back().get();
+		}();
+		return *tBuffer;
+	}
+
+	// Appends to message like snprintf, keeping length within size
+	template <typename... Args>
+	void Append(char* message, size_t size, size_t& length, const char* format, Args... args)
+	{
+		int written = std::snprintf(message + length, size - length, format, args...);
+		if (written > 0)
+			length = std::min(length + written, size - 1);
+	}
+
+	int64_t IntegerArg(const chip8::LogRecord& record, size_t index)
+	{
+		const chip8::LogRecord::Arg& arg = record.args[index];
+		switch (record.argTypes[index])
+		{
+		case chip8::LogRecord::ArgType::Signed:
+			return arg.signedValue;
+		case chip8::LogRecord::ArgType::Unsigned:
+			return static_cast<int64_t>(arg.unsignedValue);
+		case chip8::LogRecord::ArgType::Double:
+			return static_cast<int64_t>(arg.doubleValue);
+		default:
+			return 0;
+		}
+	}
+
+	// printf for a record. Length modifiers in the format are ignored, the captured
+	// arguments are already widened to 64 bits.
+	void Format(const chip8::LogRecord& record, char* message, size_t size)
+	{
+		size_t length = 0;
+		size_t argIndex = 0;
+		message[0] = '\0';
+
+		const char* c = record.format;
+		while (*c != '\0')
+		{
+			if (*c != '%' || c[1] == '%')
+			{
+				Append(message, size, length, "%c", *c);
+				c += *c == '%' ? 2 : 1;
+				continue;
+			}
+
+			// Flags, width and precision are passed through
+			char spec[32] = "%";
+			size_t specLength = 1;
+			for (c++; *c != '\0' && std::strchr("-+ #0123456789.", *c) != nullptr && specLength < sizeof(spec) - 4; c++)
+				spec[specLength++] = *c;
+			while (*c != '\0' && std::strchr("hljztL", *c) != nullptr)
+				c++;
+
+			char conversion = *c;
+			if (conversion == '\0')
+				break;
+			c++;
+
+			if (argIndex >= record.argCount)
+			{
+				Append(message, size, length, "%s", "<missing>");
+				continue;
+			}
+
+			size_t index = argIndex++;
+			switch (conversion)
+			{
+			case 'd':
+			case 'i':
+				std::strcpy(spec + specLength, "lld");
+				Append(message, size, length, spec, static_cast<long long>(IntegerArg(record, index)));
+				break;
+			case 'u':
+			case 'o':
+			case 'x':
+			case 'X':
+				spec[specLength] = 'l';
+				spec[specLength + 1] = 'l';
+				spec[specLength + 2] = conversion;
+				spec[specLength + 3] = '\0';
+				Append(message, size, length, spec, static_cast<unsigned long long>(IntegerArg(record, index)));
+				break;
+			case 'c':
+				std::strcpy(spec + specLength, "c");
+				Append(message, size, length, spec, static_cast<int>(IntegerArg(record, index)));
+				break;
+			case 'f':
+			case 'F':
+			case 'e':
+			case 'E':
+			case 'g':
+			case 'G':
+			case 'a':
+			case 'A':
+			{
+				spec[specLength] = conversion;
+				spec[specLength + 1] = '\0';
+				double value = record.argTypes[index] == chip8::LogRecord::ArgType::Double ? record.args[index].doubleValue : static_cast<double>(IntegerArg(record, index));
+				Append(message, size, length, spec, value);
+			}
+			break;
+			case 's':
+				std::strcpy(spec + specLength, "s");
+				Append(message, size, length, spec, record.argTypes[index] == chip8::LogRecord::ArgType::String ? record.strings + record.args[index].stringOffset : "<not a string>");
+				break;
+			case 'p':
+				std::strcpy(spec + specLength, "p");
+				Append(message, size, length, spec, record.argTypes[index] == chip8::LogRecord::ArgType::Pointer ? record.args[index].pointerValue : nullptr);
+				break;
+			default:
+				Append(message, size, length, "<bad conversion %c>", conversion);
+				break;
+			}
+		}
+	}
+
+	void Print(chip8::LogLevel level, const char* message)
+	{
+		switch (level)
+		{
+		case chip8::LogLevel::Warning:
+			std::fprintf(stderr, "warning: %s\n", message);
+			break;
+		case chip8::LogLevel::Error:
+			std::fprintf(stderr, "error: %s\n", message);
+			break;
+		default:
+			std::fprintf(stdout, "%s\n", message);
+			break;
+		}
+	}
+
+	// Drains the thread buffers and prints their records in time order
+	class LogWriter
+	{
+	public:
+		LogWriter()
+		{
+			if (const char* level = std::getenv("CHIP8_LOG_LEVEL"))
+			{
+				const char* names[] = { "debug", "info", "warning", "error" };
+				for (size_t index = 0; index < std::size(names); index++)
+				{
+					if (std::strcmp(level, names[index]) == 0)
+						chip8::Logger::SetLevel(static_cast<chip8::LogLevel>(index));
+				}
+			}
+
+			mThread = std::thread(&LogWriter::Main, this);
+		}
+
+		~LogWriter()
+		{
+			{
+				std::lock_guard<std::mutex> lock(mMutex);
+				mStopping = true;
+			}
+			mWake.notify_all();
+			mThread.join();
+		}
+
+		void Flush()
+		{
+			std::unique_lock<std::mutex> lock(mMutex);
+			uint64_t request = ++mFlushRequested;
+			mWake.notify_all();
+			mFlushed.wait(lock, [&]() { return mFlushCompleted >= request; });
+		}
+
+	private:
+		struct Repeats
+		{
+			ClockType::time_point windowStart;
+			uint32_t count = 0;
+			uint64_t suppressed = 0;
+			chip8::LogLevel level;
+		};
+
+		void Main()
+		{
+			std::unique_lock<std::mutex> lock(mMutex);
+			while (true)
+			{
+				mWake.wait_for(lock, kPollPeriod, [this]() { return mStopping || mFlushRequested != mFlushCompleted; });
+				bool stopping = mStopping;
+				uint64_t request = mFlushRequested;
+
+				lock.unlock();
+				Drain(stopping);
+				lock.lock();
+
+				mFlushCompleted = request;
+				mFlushed.notify_all();
+
+				if (stopping)
+					return;
+			}
+		}
+
+		void Drain(bool final)
+		{
+			mBatch.clear();
+			{
+				std::lock_guard<std::mutex> lock(sBuffersMutex);
+				for (const auto& buffer : sBuffers)
+				{
+					uint64_t tail = buffer->tail.load(std::memory_order_relaxed);
+					uint64_t head = buffer->head.load(std::memory_order_acquire);
+					for (uint64_t index = tail; index < head; index++)
+						mBatch.push_back(buffer->records[index % kBufferCapacity]);
+					buffer->tail.store(head, std::memory_order_release);
+
+					if (uint64_t dropped = buffer->dropped.exchange(0, std::memory_order_relaxed); dropped > 0)
+					{
+						char message[64];
+						std::snprintf(message, sizeof(message), "Log buffer full, dropped %llu messages", static_cast<unsigned long long>(dropped));
+						Print(chip8::LogLevel::Warning, message);
+					}
+				}
+			}
+
+			std::stable_sort(mBatch.begin(), mBatch.end(), [](const chip8::LogRecord& a, const chip8::LogRecord& b) { return a.time < b.time; });
+
+			char message[kMaxMessageSize];
+			for (const chip8::LogRecord& record : mBatch)
+			{
+				Format(record, message, sizeof(message));
+
+				Repeats& repeats = mRepeats[message];
+				if (record.time - repeats.windowStart >= kRepeatWindow)
+				{
+					Summarise(message, repeats);
+					repeats.windowStart = record.time;
+					repeats.count = 0;
+				}
+
+				repeats.level = record.level;
+				if (repeats.count < kRepeatLimit)
+				{
+					repeats.count++;
+					Print(record.level, message);
+				}
+				else
+				{
+					repeats.suppressed++;
+				}
+			}
+
+			// Report anything held back once its window is over rather than waiting for the next
+			// repeat, and forget messages which have stopped repeating
+			ClockType::time_point now = ClockType::now();
+			for (auto repeats = mRepeats.begin(); repeats != mRepeats.end();)
+			{
+				if (final || now - repeats->second.windowStart >= kRepeatWindow)
+				{
+					Summarise(repeats->first.c_str(), repeats->second);
+					repeats = mRepeats.erase(repeats);
+				}
+				else
+				{
+					++repeats;
+				}
+			}
+
+			std::fflush(stdout);
+			std::fflush(stderr);
+		}
+
+		void Summarise(const char* repeated, Repeats& repeats)
+		{
+			if (repeats.suppressed == 0)
+				return;
+
+			char message[kMaxMessageSize + 64];
+			std::snprintf(message, sizeof(message), "Suppressed %llu repeats of \"%s\"", static_cast<unsigned long long>(repeats.suppressed), repeated);
+			Print(repeats.level, message);
+			repeats.suppressed = 0;
+		}
+
+	private:
+		std::thread mThread;
+
+		std::mutex mMutex;
+		std::condition_variable mWake;
+		std::condition_variable mFlushed;
+		bool mStopping = false;
+		uint64_t mFlushRequested = 0;
+		uint64_t mFlushCompleted = 0;
+
+		// Only used by the writer thread
+		std::vector<chip8::LogRecord> mBatch;
+		std::unordered_map<std::string, Repeats> mRepeats;
+	};
+
+	// Declared after the buffers, so that it's destroyed (and drains them) first
+	LogWriter sWriter;
+}
+
+namespace chip8
+{
+	void Logger::Flush()
+	{
+		sWriter.Flush();
+	}
+
+	LogRecord* Logger::BeginRecord()
+	{
+		ThreadBuffer& buffer = CurrentBuffer();
+
+		uint64_t head = buffer.head.load(std::memory_order_relaxed);
+		if (head - buffer.tail.load(std::memory_order_acquire) >= kBufferCapacity)
+		{
+			buffer.dropped.fetch_add(1, std::memory_order_relaxed);
+			return nullptr;
+		}
+
+		return &buffer.records[head % kBufferCapacity];
+	}
+
+	void Logger::EndRecord()
+	{
+		ThreadBuffer& buffer = CurrentBuffer();
+		buffer.head.store(buffer.head.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+	}
+}
@@ -1,10 +1,190 @@
 #ifndef CHIP8_LOG_H
 #define CHIP8_LOG_H
 
-#include <cstdio>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <type_traits>
 
-#define LOG(message, ...) do { \
-	printf(message "\n", __VA_ARGS__); \
+// Lowest level compiled in, calls below it expand to nothing: 0 debug, 1 info, 2 warning, 3 error
+#ifndef CHIP8_LOG_LEVEL
+#define CHIP8_LOG_LEVEL 1
+#endif
+
+// Checks the arguments against the format, as for printf
+#if defined(__GNUC__) || defined(__clang__)
+#define CHIP8_LOG_FORMAT(formatIndex, firstArg) __attribute__((format(printf, formatIndex, firstArg)))
+#else
+#define CHIP8_LOG_FORMAT(formatIndex, firstArg)
+#endif
+
+namespace chip8
+{
+	enum class LogLevel : uint8_t
+	{
+		Debug,
+		Info,
+		Warning,
+		Error,
+	};
+
+	// A message waiting to be formatted. The format has to be a string literal, the arguments
+	// are copied (strings included) so that they can be formatted later on another thread.
+	struct LogRecord
+	{
+		static constexpr size_t kMaxArgs = 10;
+		static constexpr size_t kStringCapacity = 128;
+
+		enum class ArgType : uint8_t
+		{
+			Signed,
+			Unsigned,
+			Double,
+			Pointer,
+			String,
+		};
+
+		union Arg
+		{
+			int64_t signedValue;
+			uint64_t unsignedValue;
+			double doubleValue;
+			const void* pointerValue;
+			uint16_t stringOffset;
+		};
+
+		const char* format;
+		std::chrono::steady_clock::time_point time;
+		LogLevel level;
+		uint8_t argCount;
+		uint16_t stringSize;
+		ArgType argTypes[kMaxArgs];
+		Arg args[kMaxArgs];
+		char strings[kStringCapacity];
+	};
+
+	// Messages go to a lock free ring buffer owned by the calling thread, and a background thread
+	// formats and prints them. Writing never blocks or makes a system call, if the buffer is full
+	// the message is dropped (and counted). Identical messages repeated too often are held back,
+	// and summarised once they calm down.
+	//
+	// Errors are the exception: they're often followed by an assert, so writing one waits until
+	// it's been printed, and it's never dropped.
+	class Logger
+	{
+	public:
+		template <typename... Args>
+		static void Write(LogLevel level, const char* format, Args... args)
+		{
+			static_assert(sizeof...(Args) <= LogRecord::kMaxArgs, "Too many arguments to log");
+
+			LogRecord* record = BeginRecord();
+			if (record == nullptr && level == LogLevel::Error)
+			{
+				Flush();
+				record = BeginRecord();
+			}
+			if (record == nullptr)
+				return;
+
+			record->format = format;
+			record->time = std::chrono::steady_clock::now();
+			record->level = level;
+			record->argCount = 0;
+			record->stringSize = 0;
+			(Capture(*record, args), ...);
+
+			EndRecord();
+
+			if (level == LogLevel::Error)
+				Flush();
+		}
+
+		// Write takes its arguments as a template pack, which the format attribute can't check, so
+		// LOG_AT also names this in an unevaluated operand. Never defined or called.
+		CHIP8_LOG_FORMAT(2, 3) static void CheckFormat(LogLevel level, const char* format, ...);
+
+		// Runtime filter on top of CHIP8_LOG_LEVEL, also set by the CHIP8_LOG_LEVEL environment variable
+		static void SetLevel(LogLevel level) { sLevel.store(level, std::memory_order_relaxed); }
+		static bool IsEnabled(LogLevel level) { return level >= sLevel.load(std::memory_order_relaxed); }
+
+		// Blocks until everything logged so far has been printed
+		static void Flush();
+
+	private:
+		// The calling thread's next free record, or nullptr if its buffer is full
+		static LogRecord* BeginRecord();
+		static void EndRecord();
+
+		template <typename T>
+		static void Capture(LogRecord& record, T value)
+		{
+			LogRecord::Arg& arg = record.args[record.argCount];
+			LogRecord::ArgType& type = record.argTypes[record.argCount];
+			record.argCount++;
+
+			if constexpr (std::is_same_v<T, const char*> || std::is_same_v<T, char*>)
+			{
+				// Copy as much as fits, the pointer may not live as long as the record.
+				// Once full, the last terminator stands in as an empty string.
+				type = LogRecord::ArgType::String;
+				size_t available = LogRecord::kStringCapacity - record.stringSize;
+				if (available == 0)
+				{
+					arg.stringOffset = LogRecord::kStringCapacity - 1;
+					return;
+				}
+
+				size_t size = std::min(std::strlen(value), available - 1);
+				std::memcpy(record.strings + record.stringSize, value, size);
+				record.strings[record.stringSize + size] = '\0';
+
+				arg.stringOffset = record.stringSize;
+				record.stringSize += static_cast<uint16_t>(size + 1);
+			}
+			else if constexpr (std::is_pointer_v<T>)
+			{
+				type = LogRecord::ArgType::Pointer;
+				arg.pointerValue = value;
+			}
+			else if constexpr (std::is_floating_point_v<T>)
+			{
+				type = LogRecord::ArgType::Double;
+				arg.doubleValue = value;
+			}
+			else if constexpr (std::is_signed_v<T>)
+			{
+				static_assert(std::is_integral_v<T>, "Unsupported log argument");
+				type = LogRecord::ArgType::Signed;
+				arg.signedValue = value;
+			}
+			else
+			{
+				static_assert(std::is_integral_v<T>, "Unsupported log argument");
+				type = LogRecord::ArgType::Unsigned;
+				arg.unsignedValue = value;
+			}
+		}
+
+	private:
+		static inline std::atomic<LogLevel> sLevel = LogLevel::Info;
+	};
+}
+
+#define LOG_AT(level, message, ...) do { \
+	(void)sizeof((chip8::Logger::CheckFormat(chip8::LogLevel::level, message, __VA_ARGS__), 0)); \
+	if constexpr (static_cast<int>(chip8::LogLevel::level) >= CHIP8_LOG_LEVEL) { \
+		if (chip8::Logger::IsEnabled(chip8::LogLevel::level)) \
+			chip8::Logger::Write(chip8::LogLevel::level, message, __VA_ARGS__); \
+	} \
 } while(0)
 
-#endif // CHIP8_LOG_H
\ No newline at end of file
+#define LOG_DEBUG(message, ...) LOG_AT(Debug, message, __VA_ARGS__)
+#define LOG(message, ...) LOG_AT(Info, message, __VA_ARGS__)
+#define LOG_WARNING(message, ...) LOG_AT(Warning, message, __VA_ARGS__)
+#define LOG_ERROR(message, ...) LOG_AT(Error, message, __VA_ARGS__)
+
+#endif // CHIP8_LOG_H
@@ -0,0 +1,145 @@
+#include "multi_session.h"
+
+#include "image.h"
+#include "tracer.h"
+
+#include <cassert>
+#include <cmath>
+
+namespace
+{
+	constexpr size_t kTileWidth = chip8::Display::kWidth;
+	constexpr size_t kTileHeight = chip8::Display::kHeight;
+
+	// Pixels between tiles
+	constexpr size_t kTileGap = 1;
+
+	constexpr uint32_t kPixelOn = 0xFFFFFFFF;
+	constexpr uint32_t kPixelOff = 0xFF000000;
+	constexpr uint32_t kFocusedPixelOff = 0xFF000050;
+	constexpr uint32_t kGapColor = 0xFF404040;
+}
+
+namespace chip8
+{
+	MultiSession::MultiSession(const std::vector<std::filesystem::path>& paths, AudioDevice* audioDevice)
+		: mAudioDevice(audioDevice)
+	{
+		assert(!paths.empty());
+
+		// Every session keeps its sound timer running, but dozens of programs beeping at once
+		// wouldn't help anyone, so the ones without the focus are muted
+		for (const std::filesystem::path& path : paths)
+		{
+			mSessions.push_back(std::make_unique<Program>(Image(path), Quirks(), audioDevice));
+			mSessions.back()->SetMuted(mSessions.size() - 1 != mFocus);
+		}
+
+		mColumns = static_cast<int>(std::ceil(std::sqrt(static_cast<double>(mSessions.size()))));
+		mRows = static_cast<int>((mSessions.size() + mColumns - 1) / mColumns);
+		mAtlasWidth = static_cast<int>(mColumns * (kTileWidth + kTileGap) - kTileGap);
+		mAtlasHeight = static_cast<int>(mRows * (kTileHeight + kTileGap) - kTileGap);
+
+		mPixels.assign(static_cast<size_t>(mAtlasWidth) * mAtlasHeight, kGapColor);
+	}
+
+	MultiSession::~MultiSession()
+	{
+		if (mAtlas != nullptr)
+			SDL_DestroyTexture(mAtlas);
+	}
+
+	void MultiSession::Render(SDL_Renderer* renderer)
+	{
+		if (mAtlas == nullptr)
+		{
+			mAtlas = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_ARGB8888, SDL_TEXTUREACCESS_STREAMING, mAtlasWidth, mAtlasHeight);
+			assert(mAtlas != nullptr);
+		}
+
+		// Each session only touches its own program and tile, so they can all run at once
+		auto updateStart = std::chrono::steady_clock::now();
+		mWorkers.Run(mSessions.size(), [this](size_t index) {
+			mSessions[index]->Update();
+			Composite(index);
+		});
+		mLastUpdateTime = std::chrono::steady_clock::now() - updateStart;
+
+		TRACE_SCOPE("MultiSession::Draw");
+
+		int result = SDL_UpdateTexture(mAtlas, nullptr, mPixels.data(), mAtlasWidth * sizeof(uint32_t));
+		assert(result == 0);
+
+		result = SDL_SetRenderDrawColor(renderer, 0, 0, 0, 0);
+		assert(result == 0);
+		result = SDL_RenderClear(renderer);
+		assert(result == 0);
+
+		result = SDL_RenderCopy(renderer, mAtlas, nullptr, nullptr);
+		assert(result == 0);
+	}
+
+	void MultiSession::OnKeyDown(const SDL_KeyboardEvent& event)
+	{
+		if (event.keysym.scancode != SDL_SCANCODE_TAB)
+		{
+			mSessions[mFocus]->OnKeyDown(event);
+			return;
+		}
+
+		// Release everything held in the session losing focus, it won't see the key up
+		for (uint8_t key = 0; key < Keyboard::kNumKeys; key++)
+			mSessions[mFocus]->SetKeyState(key, false);
+
+		if (event.keysym.mod & KMOD_SHIFT)
+			SetFocus((mFocus + mSessions.size() - 1) % mSessions.size());
+		else
+			SetFocus((mFocus + 1) % mSessions.size());
+	}
+
+	void MultiSession::SetFocus(size_t focus)
+	{
+		mSessions[mFocus]->SetMuted(true);
+		mFocus = focus;
+		mSessions[mFocus]->SetMuted(false);
+	}
+
+	void MultiSession::OnKeyUp(const SDL_KeyboardEvent& event)
+	{
+		if (event.keysym.scancode != SDL_SCANCODE_TAB)
+			mSessions[mFocus]->OnKeyUp(event);
+	}
+
+	ProcessStats MultiSession::GetStats()
+	{
+		// Totals across the sessions, but the time they took together and the device they share
+		ProcessStats stats;
+		for (const std::unique_ptr<Program>& session : mSessions)
+		{
+			ProcessStats sessionStats = session->GetStats();
+			stats.opcodesExecuted += sessionStats.opcodesExecuted;
+			stats.targetOpcodeRate += sessionStats.targetOpcodeRate;
+		}
+		stats.audioUnderruns = mAudioDevice != nullptr ? mAudioDevice->GetUnderruns() : 0;
+		stats.executeTime = mLastUpdateTime;
+		return stats;
+	}
+
+	void MultiSession::Composite(size_t index)
+	{
+		uint8_t packed[Display::kPackedSize];
+		mSessions[index]->GetDisplay().Pack(packed);
+
+		uint32_t off = index == mFocus ? kFocusedPixelOff : kPixelOff;
+
+		size_t left = (index % mColumns) * (kTileWidth + kTileGap);
+		size_t top = (index / mColumns) * (kTileHeight + kTileGap);
+		for (size_t row = 0; row < kTileHeight; row++)
+		{
+			uint32_t* pixel = &mPixels[(top + row) * mAtlasWidth + left];
+			const uint8_t* bytes = &packed[row * kTileWidth / 8];
+			for (size_t col = 0; col < kTileWidth; col++)
+				*pixel++ = (bytes[col / 8] & (0x80 >> (col % 8))) ? kPixelOn : off;
+		}
+	}
+}
@@ -0,0 +1,60 @@
+#ifndef CHIP8_MULTI_SESSION_H
+#define CHIP8_MULTI_SESSION_H
+
+#include "audio_device.h"
+#include "process.h"
+#include "program.h"
+#include "worker_pool.h"
+
+#include "SDL.h"
+
+#include <filesystem>
+#include <memory>
+#include <vector>
+
+namespace chip8
+{
+	// Runs a program per path side by side in a grid. The programs are updated across a
+	// worker pool, then composited into one texture which is drawn with a single copy.
+	// Tab (or shift+tab) moves the keyboard focus between sessions, and only the session with
+	// the focus is heard.
+	class MultiSession : public Process
+	{
+	public:
+		explicit MultiSession(const std::vector<std::filesystem::path>& paths, AudioDevice* audioDevice = nullptr);
+		~MultiSession();
+
+		void Render(SDL_Renderer* renderer) override;
+		bool Finished() override { return false; }
+
+		void OnKeyDown(const SDL_KeyboardEvent& event) override;
+		void OnKeyUp(const SDL_KeyboardEvent& event) override;
+
+		ProcessStats GetStats() override;
+
+	private:
+		void Composite(size_t index);
+		void SetFocus(size_t focus);
+
+	private:
+		std::vector<std::unique_ptr<Program>> mSessions;
+		size_t mFocus = 0;
+		AudioDevice* mAudioDevice;
+
+		// Time taken by the workers in the last Render
+		std::chrono::steady_clock::duration mLastUpdateTime{};
+
+		WorkerPool mWorkers;
+
+		// Grid of sessions, each a tile in the atlas
+		int mColumns;
+		int mRows;
+		int mAtlasWidth;
+		int mAtlasHeight;
+
+		std::vector<uint32_t> mPixels;
+		SDL_Texture* mAtlas = nullptr;
+	};
+}
+
+#endif // CHIP8_MULTI_SESSION_H
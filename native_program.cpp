@@ -0,0 +1,56 @@
+#include "native_program.h"
+
+#include <cassert>
+
+namespace
+{
+	std::vector<chip8::NativeCode>& Registry()
+	{
+		// Function local so that it exists before the generated code registers itself
+		static std::vector<chip8::NativeCode> sRegistry;
+		return sRegistry;
+	}
+}
+
+namespace chip8
+{
+	bool NativeCode::IsCode(size_t address, size_t count) const
+	{
+		for (size_t offset = address; offset < address + count && offset < Image::Size(); offset++)
+		{
+			if (codeMap[offset / 8] & (1u << (offset % 8)))
+				return true;
+		}
+		return false;
+	}
+
+	bool NativeProgram::Register(const NativeCode& code)
+	{
+		assert(code.romSize <= Image::Size());
+		Registry().push_back(code);
+		return true;
+	}
+
+	const NativeCode* NativeProgram::Find(Image& image)
+	{
+		size_t start = image.StartOffset();
+		for (const NativeCode& code : Registry())
+		{
+			if (start + code.romSize > Image::Size())
+				continue;
+
+			// Anything after the ROM must still be zero filled, otherwise this is a longer ROM
+			// that happens to start the same way
+			bool matches = true;
+			for (size_t offset = 0; offset < code.romSize && matches; offset++)
+				matches = image[start + offset] == code.rom[offset];
+
+			for (size_t offset = start + code.romSize; offset < Image::Size() && matches; offset++)
+				matches = image[offset] == 0;
+
+			if (matches)
+				return &code;
+		}
+		return nullptr;
+	}
+}
@@ -0,0 +1,54 @@
+#ifndef CHIP8_NATIVE_PROGRAM_H
+#define CHIP8_NATIVE_PROGRAM_H
+
+#include "program.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace chip8
+{
+	// A ROM recompiled ahead of time to C++ by chip8_recompile
+	struct NativeCode
+	{
+		// Runs from the current program counter until opcodeCount opcodes have been executed, or
+		// until control reaches an address that wasn't recompiled. Returns the number executed.
+		using RunFunction = uint32_t (*)(Program& program, uint32_t opcodeCount);
+
+		// The ROM as it was recompiled, a program only uses this code if its image matches
+		const uint8_t* rom;
+		size_t romSize;
+
+		// One bit per image byte, set for every byte decoded as an instruction
+		const uint8_t* codeMap;
+
+		RunFunction run;
+
+		bool IsCode(size_t address, size_t count) const;
+	};
+
+	// Registry of recompiled ROMs, and the access to Program state the generated code needs
+	class NativeProgram
+	{
+	public:
+		static bool Register(const NativeCode& code);
+		static const NativeCode* Find(Image& image);
+
+		static uint8_t* Registers(Program& program) { return program.mRegister; }
+		static uint16_t& AddressRegister(Program& program) { return program.mAddressRegister; }
+		static uint16_t& ProgramCounter(Program& program) { return program.mProgramCounter; }
+		static chip8::Stack& Stack(Program& program) { return program.mStack; }
+
+		// Cleared once the program writes over its own code
+		static bool HasNativeCode(Program& program) { return program.mNativeCode != nullptr; }
+
+		// Whether the native code has to hand back to the interpreter, after a fault, a write over its code or FX0A
+		static bool Stopped(Program& program) { return program.mNativeCode == nullptr || program.mFault != Program::Fault::None || program.mWaitingForKey; }
+
+		// Opcodes that aren't worth recompiling are handed to the interpreter
+		static void ExecuteOpcode(Program& program, uint16_t opcode) { program.ExecuteOpcode(opcode); }
+	};
+}
+
+#endif // CHIP8_NATIVE_PROGRAM_H
@@ -0,0 +1,161 @@
+#include "performance_overlay.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cinttypes>
+#include <cstdio>
+
+namespace
+{
+	// Frames taking longer than one and a half vsyncs at 60hz miss one
+	constexpr auto kDroppedFrameTime = std::chrono::microseconds(25000);
+
+	// Redrawing the text every frame would be unreadable, and slow
+	constexpr auto kLineUpdatePeriod = std::chrono::milliseconds(250);
+
+	constexpr int kMargin = 4;
+
+	double ToMilliseconds(chip8::PerformanceOverlay::Duration duration)
+	{
+		return std::chrono::duration<double, std::milli>(duration).count();
+	}
+}
+
+namespace chip8
+{
+	PerformanceOverlay::PerformanceOverlay(Resources& resources)
+		: mResources(resources)
+	{
+	}
+
+	PerformanceOverlay::~PerformanceOverlay()
+	{
+		for (SDL_Texture* line : mLines)
+		{
+			if (line != nullptr)
+				SDL_DestroyTexture(line);
+		}
+	}
+
+	void PerformanceOverlay::AddFrame(Duration frameTime, Duration idleTime, Duration renderTime, Duration presentTime, const ProcessStats& stats)
+	{
+		// A new process starts counting from zero
+		uint64_t opcodes = stats.opcodesExecuted >= mLastOpcodesExecuted ? stats.opcodesExecuted - mLastOpcodesExecuted : stats.opcodesExecuted;
+		mLastOpcodesExecuted = stats.opcodesExecuted;
+
+		mFrames[mNextFrame] = { frameTime, idleTime, renderTime, presentTime, stats.executeTime, opcodes };
+		mNextFrame = (mNextFrame + 1) % kHistorySize;
+		mFrameCount = std::min(mFrameCount + 1, kHistorySize);
+
+		if (frameTime > kDroppedFrameTime)
+			mDroppedFrames++;
+
+		mAudioUnderruns = stats.audioUnderruns;
+		mTargetOpcodeRate = stats.targetOpcodeRate;
+	}
+
+	void PerformanceOverlay::Render(SDL_Renderer* renderer)
+	{
+		if (!mVisible || mFrameCount == 0)
+			return;
+
+		auto now = std::chrono::steady_clock::now();
+		if (mLines[0] == nullptr || now - mLastLineUpdate >= kLineUpdatePeriod)
+		{
+			UpdateLines(renderer);
+			mLastLineUpdate = now;
+		}
+
+		SDL_Rect background{ 0, 0, 0, kMargin };
+		for (const SDL_Rect& rect : mLineRects)
+		{
+			background.w = std::max(background.w, rect.x + rect.w + kMargin);
+			background.h += rect.h;
+		}
+		background.h += kMargin;
+
+		int result = SDL_SetRenderDrawBlendMode(renderer, SDL_BLENDMODE_BLEND);
+		assert(result == 0);
+		result = SDL_SetRenderDrawColor(renderer, 0, 0, 0, 0xC0);
+		assert(result == 0);
+		result = SDL_RenderFillRect(renderer, &background);
+		assert(result == 0);
+		result = SDL_SetRenderDrawBlendMode(renderer, SDL_BLENDMODE_NONE);
+		assert(result == 0);
+
+		for (size_t line = 0; line < kNumLines; line++)
+		{
+			result = SDL_RenderCopy(renderer, mLines[line], nullptr, &mLineRects[line]);
+			assert(result == 0);
+		}
+	}
+
+	void PerformanceOverlay::UpdateLines(SDL_Renderer* renderer)
+	{
+		Duration totalFrameTime{};
+		Duration totalIdleTime{};
+		Duration totalRenderTime{};
+		Duration totalPresentTime{};
+		Duration totalExecuteTime{};
+		uint64_t totalOpcodes = 0;
+		for (size_t index = 0; index < mFrameCount; index++)
+		{
+			const Frame& frame = mFrames[index];
+			totalFrameTime += frame.frameTime;
+			totalIdleTime += frame.idleTime;
+			totalRenderTime += frame.renderTime;
+			totalPresentTime += frame.presentTime;
+			totalExecuteTime += frame.executeTime;
+			totalOpcodes += frame.opcodes;
+
+			mSortedFrameTimes[index] = frame.frameTime;
+		}
+
+		auto sortedEnd = mSortedFrameTimes.begin() + mFrameCount;
+		auto p50 = mSortedFrameTimes.begin() + mFrameCount / 2;
+		std::nth_element(mSortedFrameTimes.begin(), p50, sortedEnd);
+		Duration p50FrameTime = *p50;
+		auto p99 = mSortedFrameTimes.begin() + mFrameCount * 99 / 100;
+		std::nth_element(mSortedFrameTimes.begin(), p99, sortedEnd);
+		Duration p99FrameTime = *p99;
+
+		// Rates go by the wall clock, sleeps included, while the percentiles are of the work alone
+		double seconds = std::chrono::duration<double>(totalFrameTime + totalIdleTime).count();
+		double framesPerSecond = seconds > 0 ? mFrameCount / seconds : 0;
+		double opcodesPerSecond = seconds > 0 ? totalOpcodes / seconds : 0;
+
+		// Execute happens inside the process render, so split it out
+		double executeTime = ToMilliseconds(totalExecuteTime) / mFrameCount;
+		double renderTime = std::max(0.0, ToMilliseconds(totalRenderTime) / mFrameCount - executeTime);
+		double presentTime = ToMilliseconds(totalPresentTime) / mFrameCount;
+
+		char text[kNumLines][128];
+		std::snprintf(text[0], sizeof(text[0]), "%.0f fps, frame p50 %.1f ms, p99 %.1f ms",
+			framesPerSecond, ToMilliseconds(p50FrameTime), ToMilliseconds(p99FrameTime));
+		if (mTargetOpcodeRate > 0)
+			std::snprintf(text[1], sizeof(text[1]), "%.0f of %" PRIu32 " opcodes/s (%.0f%%)",
+				opcodesPerSecond, mTargetOpcodeRate, 100 * opcodesPerSecond / mTargetOpcodeRate);
+		else
+			std::snprintf(text[1], sizeof(text[1]), "No program running");
+		std::snprintf(text[2], sizeof(text[2]), "execute %.2f ms, render %.2f ms, present %.2f ms",
+			executeTime, renderTime, presentTime);
+		std::snprintf(text[3], sizeof(text[3]), "%" PRIu64 " dropped frames, %" PRIu64 " audio underruns",
+			mDroppedFrames, mAudioUnderruns);
+
+		SDL_Color color{ 0xFF, 0xFF, 0x00, 0xFF };
+		int y = kMargin;
+		for (size_t line = 0; line < kNumLines; line++)
+		{
+			if (mLines[line] != nullptr)
+				SDL_DestroyTexture(mLines[line]);
+
+			SDL_Surface* surface = TTF_RenderUTF8_Solid(mResources.GetFont(), text[line], color);
+			assert(surface != nullptr);
+			mLines[line] = SDL_CreateTextureFromSurface(renderer, surface);
+			assert(mLines[line] != nullptr);
+			mLineRects[line] = { kMargin, y, surface->w, surface->h };
+			y += surface->h;
+			SDL_FreeSurface(surface);
+		}
+	}
+}
@@ -0,0 +1,78 @@
+#ifndef CHIP8_PERFORMANCE_OVERLAY_H
+#define CHIP8_PERFORMANCE_OVERLAY_H
+
+#include "process.h"
+#include "resources.h"
+
+#include "SDL.h"
+
+#include <array>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+
+namespace chip8
+{
+	// Frame rate, frame time percentiles and what the process has been doing over the last few
+	// seconds, drawn over the top of the process. Collects every frame whether shown or not.
+	class PerformanceOverlay
+	{
+	public:
+		using Duration = std::chrono::steady_clock::duration;
+
+		explicit PerformanceOverlay(Resources& resources);
+		~PerformanceOverlay();
+
+		PerformanceOverlay(const PerformanceOverlay&) = delete;
+		PerformanceOverlay& operator=(const PerformanceOverlay&) = delete;
+
+		void Toggle() { mVisible = !mVisible; }
+
+		// frameTime covers the work of the frame and idleTime the sleep after it, waiting for the
+		// process to have something to do. renderTime is the process render (including executeTime
+		// in stats).
+		void AddFrame(Duration frameTime, Duration idleTime, Duration renderTime, Duration presentTime, const ProcessStats& stats);
+
+		void Render(SDL_Renderer* renderer);
+
+	private:
+		struct Frame
+		{
+			Duration frameTime;
+			Duration idleTime;
+			Duration renderTime;
+			Duration presentTime;
+			Duration executeTime;
+			uint64_t opcodes;
+		};
+
+		// About four seconds at 60hz
+		static constexpr size_t kHistorySize = 240;
+		static constexpr size_t kNumLines = 4;
+
+		// Formats the history into the line textures
+		void UpdateLines(SDL_Renderer* renderer);
+
+	private:
+		std::array<Frame, kHistorySize> mFrames;
+		size_t mNextFrame = 0;
+		size_t mFrameCount = 0;
+
+		// Scratch space for the percentiles, so nothing is allocated per frame
+		std::array<Duration, kHistorySize> mSortedFrameTimes;
+
+		uint64_t mLastOpcodesExecuted = 0;
+		uint64_t mDroppedFrames = 0;
+		uint64_t mAudioUnderruns = 0;
+		uint32_t mTargetOpcodeRate = 0;
+
+		bool mVisible = false;
+
+		Resources& mResources;
+		std::array<SDL_Texture*, kNumLines> mLines = {};
+		std::array<SDL_Rect, kNumLines> mLineRects = {};
+		std::chrono::steady_clock::time_point mLastLineUpdate;
+	};
+}
+
+#endif // CHIP8_PERFORMANCE_OVERLAY_H
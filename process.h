@@ -3,10 +3,26 @@
 
 #include "SDL.h"
 
+#include <chrono>
+#include <cstdint>
 #include <memory>
 
 namespace chip8
 {
+	// What a process has been doing, for the performance overlay
+	struct ProcessStats
+	{
+		// Totals since the process started
+		uint64_t opcodesExecuted = 0;
+		uint64_t audioUnderruns = 0;
+
+		// Opcodes per second the process is aiming for, zero if it isn't running a program
+		uint32_t targetOpcodeRate = 0;
+
+		// Time spent executing opcodes in the last Render
+		std::chrono::steady_clock::duration executeTime{};
+	};
+
 	class Process
 	{
 	public:
@@ -17,8 +33,14 @@ namespace chip8
 
 		virtual std::unique_ptr<Process> NextProcess() { return nullptr; }
 
-		virtual void OnKeyDown(const SDL_Keysym& keysym) {}
-		virtual void OnKeyUp(const SDL_Keysym& keysym) {}
+		// Milliseconds the process has nothing to do for, the system waits for input for up to this long
+		virtual uint32_t IdleTime() { return 0; }
+
+		virtual ProcessStats GetStats() { return {}; }
+
+		// The whole event, so that input can be placed by its timestamp
+		virtual void OnKeyDown(const SDL_KeyboardEvent& event) {}
+		virtual void OnKeyUp(const SDL_KeyboardEvent& event) {}
 	};
 }
 
@@ -0,0 +1,165 @@
+#include "profiler.h"
+
+#ifdef CHIP8_PROFILE
+
+#include "log.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cstdio>
+#include <mutex>
+#include <numeric>
+
+namespace
+{
+	constexpr char kReportFile[] = "chip8_profile.json";
+
+	// Number of entries shown in the logged report for each table
+	constexpr size_t kReportTopCount = 16;
+
+	constexpr size_t kNumOpcodes = 0x10000;
+	constexpr size_t kNumAddresses = 0x1000;
+
+	std::mutex sTotalsMutex;
+
+	// Indices of the non-zero entries of counts, most frequent first
+	std::vector<size_t> SortedIndices(const uint64_t* counts, size_t numCounts)
+	{
+		std::vector<size_t> indices;
+		for (size_t i = 0; i < numCounts; i++)
+		{
+			if (counts[i] > 0)
+				indices.push_back(i);
+		}
+
+		std::stable_sort(indices.begin(), indices.end(), [counts](size_t a, size_t b) {
+			return counts[a] > counts[b];
+		});
+		return indices;
+	}
+
+	void WriteCounts(FILE* file, const char* name, const uint64_t* counts, size_t numCounts, bool last)
+	{
+		fprintf(file, "\t\"%s\": {", name);
+
+		bool first = true;
+		for (size_t index : SortedIndices(counts, numCounts))
+		{
+			fprintf(file, "%s\n\t\t\"0x%04zX\": %llu", first ? "" : ",", index, static_cast<unsigned long long>(counts[index]));
+			first = false;
+		}
+
+		fprintf(file, "\n\t}%s\n", last ? "" : ",");
+	}
+}
+
+namespace chip8
+{
+	Profiler::Counts::Counts()
+		: opcodes(kNumOpcodes, 0)
+		, addresses(kNumAddresses, 0)
+	{
+	}
+
+	void Profiler::Counts::Add(const Counts& other)
+	{
+		for (size_t i = 0; i < std::size(classes); i++)
+			classes[i] += other.classes[i];
+		for (size_t i = 0; i < opcodes.size(); i++)
+			opcodes[i] += other.opcodes[i];
+		for (size_t i = 0; i < addresses.size(); i++)
+			addresses[i] += other.addresses[i];
+
+		drawTime += other.drawTime;
+		drawCount += other.drawCount;
+		drawCollisions += other.drawCollisions;
+		delayTimerReads += other.delayTimerReads;
+		delayTimerPolls += other.delayTimerPolls;
+	}
+
+	Profiler::~Profiler()
+	{
+		std::lock_guard<std::mutex> lock(sTotalsMutex);
+		Totals().Add(mCounts);
+	}
+
+	Profiler::Counts& Profiler::Totals()
+	{
+		static Counts sTotals;
+		return sTotals;
+	}
+
+	void Profiler::OnDrawEnd(bool collided)
+	{
+		mCounts.drawTime += ClockType::now() - mDrawStart;
+		mCounts.drawCount++;
+		if (collided)
+			mCounts.drawCollisions++;
+	}
+
+	void Profiler::OnDelayTimerRead(uint8_t value)
+	{
+		mCounts.delayTimerReads++;
+		if (value == mLastDelayTimerValue)
+			mCounts.delayTimerPolls++;
+		mLastDelayTimerValue = value;
+	}
+
+	void Profiler::Report()
+	{
+		std::lock_guard<std::mutex> lock(sTotalsMutex);
+		const Counts& counts = Totals();
+
+		uint64_t total = std::accumulate(std::begin(counts.classes), std::end(counts.classes), uint64_t(0));
+		if (total == 0)
+			return;
+
+		auto percentage = [](uint64_t count, uint64_t total) {
+			return total > 0 ? 100.0 * count / total : 0.0;
+		};
+		auto drawNanoseconds = std::chrono::duration_cast<std::chrono::nanoseconds>(counts.drawTime).count();
+		double drawAverage = counts.drawCount > 0 ? static_cast<double>(drawNanoseconds) / counts.drawCount : 0.0;
+
+		LOG("Executed %llu opcodes", static_cast<unsigned long long>(total));
+
+		LOG("%s", "By class:");
+		for (size_t index : SortedIndices(counts.classes, std::size(counts.classes)))
+			LOG("  %zXNNN %12llu %6.2f%%", index, static_cast<unsigned long long>(counts.classes[index]), percentage(counts.classes[index], total));
+
+		LOG("%s", "By opcode:");
+		std::vector<size_t> opcodes = SortedIndices(counts.opcodes.data(), counts.opcodes.size());
+		for (size_t i = 0; i < std::min(opcodes.size(), kReportTopCount); i++)
+			LOG("  %04zX %12llu %6.2f%%", opcodes[i], static_cast<unsigned long long>(counts.opcodes[opcodes[i]]), percentage(counts.opcodes[opcodes[i]], total));
+
+		LOG("%s", "By address:");
+		std::vector<size_t> addresses = SortedIndices(counts.addresses.data(), counts.addresses.size());
+		for (size_t i = 0; i < std::min(addresses.size(), kReportTopCount); i++)
+			LOG("  %03zX %12llu %6.2f%%", addresses[i], static_cast<unsigned long long>(counts.addresses[addresses[i]]), percentage(counts.addresses[addresses[i]], total));
+
+		LOG("DXYN: %llu draws, %.2f%% collided, %.0fns average",
+			static_cast<unsigned long long>(counts.drawCount), percentage(counts.drawCollisions, counts.drawCount), drawAverage);
+		LOG("FX07: %llu reads, %.2f%% polling an unchanged value",
+			static_cast<unsigned long long>(counts.delayTimerReads), percentage(counts.delayTimerPolls, counts.delayTimerReads));
+
+		// Full counts for tooling
+		FILE* file = fopen(kReportFile, "w");
+		assert(file != nullptr);
+		if (file == nullptr)
+			return;
+
+		fprintf(file, "{\n");
+		fprintf(file, "\t\"total\": %llu,\n", static_cast<unsigned long long>(total));
+		fprintf(file, "\t\"draw\": { \"count\": %llu, \"collisions\": %llu, \"nanoseconds\": %lld },\n",
+			static_cast<unsigned long long>(counts.drawCount), static_cast<unsigned long long>(counts.drawCollisions), static_cast<long long>(drawNanoseconds));
+		fprintf(file, "\t\"delayTimer\": { \"reads\": %llu, \"polls\": %llu },\n",
+			static_cast<unsigned long long>(counts.delayTimerReads), static_cast<unsigned long long>(counts.delayTimerPolls));
+		WriteCounts(file, "classes", counts.classes, std::size(counts.classes), false);
+		WriteCounts(file, "opcodes", counts.opcodes.data(), counts.opcodes.size(), false);
+		WriteCounts(file, "addresses", counts.addresses.data(), counts.addresses.size(), true);
+		fprintf(file, "}\n");
+
+		fclose(file);
+	}
+}
+
+#endif // CHIP8_PROFILE
@@ -0,0 +1,85 @@
+#ifndef CHIP8_PROFILER_H
+#define CHIP8_PROFILER_H
+
+// Opcode profiling is only compiled in when CHIP8_PROFILE is defined, the
+// PROFILE_ macros below expand to nothing otherwise.
+#ifdef CHIP8_PROFILE
+
+#include <chrono>
+#include <cstdint>
+#include <vector>
+
+namespace chip8
+{
+	// Each program counts into its own profiler, which adds its counts to the process-wide totals
+	// when it goes. Report writes those totals, once, when the emulator exits.
+	class Profiler
+	{
+		using ClockType = std::chrono::steady_clock;
+
+	public:
+		Profiler() = default;
+		~Profiler();
+
+		void OnOpcode(uint16_t address, uint16_t opcode) {
+			mCounts.classes[opcode >> 12]++;
+			mCounts.opcodes[opcode]++;
+			mCounts.addresses[address & 0xFFF]++;
+		}
+
+		void OnDrawBegin() { mDrawStart = ClockType::now(); }
+		void OnDrawEnd(bool collided);
+
+		void OnDelayTimerRead(uint8_t value);
+
+		// Writes the human readable report of every profiler so far to the log, and the full
+		// counts to kReportFile
+		static void Report();
+
+	private:
+		struct Counts
+		{
+			Counts();
+			void Add(const Counts& other);
+
+			uint64_t classes[16] = {};
+			std::vector<uint64_t> opcodes;
+			std::vector<uint64_t> addresses;
+
+			// DXYN
+			ClockType::duration drawTime = {};
+			uint64_t drawCount = 0;
+			uint64_t drawCollisions = 0;
+
+			// FX07 - repeated reads of an unchanged value are the program polling the timer
+			uint64_t delayTimerReads = 0;
+			uint64_t delayTimerPolls = 0;
+		};
+
+		static Counts& Totals();
+
+	private:
+		Counts mCounts;
+
+		ClockType::time_point mDrawStart;
+		int mLastDelayTimerValue = -1;
+	};
+}
+
+#define PROFILE_OPCODE(profiler, address, opcode) (profiler).OnOpcode(address, opcode)
+#define PROFILE_DRAW_BEGIN(profiler) (profiler).OnDrawBegin()
+#define PROFILE_DRAW_END(profiler, collided) (profiler).OnDrawEnd(collided)
+#define PROFILE_DELAY_TIMER_READ(profiler, value) (profiler).OnDelayTimerRead(value)
+#define PROFILE_REPORT() chip8::Profiler::Report()
+
+#else
+
+#define PROFILE_OPCODE(profiler, address, opcode) do {} while(0)
+#define PROFILE_DRAW_BEGIN(profiler) do {} while(0)
+#define PROFILE_DRAW_END(profiler, collided) do {} while(0)
+#define PROFILE_DELAY_TIMER_READ(profiler, value) do {} while(0)
+#define PROFILE_REPORT() do {} while(0)
+
+#endif // CHIP8_PROFILE
+
+#endif // CHIP8_PROFILER_H
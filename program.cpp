@@ -1,15 +1,32 @@
 ﻿#include "program.h"
 
+#include "audio_device.h"
+#include "latency.h"
 #include "log.h"
+#include "native_program.h"
+#include "profiler.h"
+#include "sound_timer.h"
+#include "tracer.h"
 
 #include <cassert>
 #include <cstdint>
 #include <cstring>
 
+#include <algorithm>
 #include <iterator>
+#include <map>
+#include <mutex>
+#include <utility>
 
 namespace
 {
+#ifdef CHIP8_PROFILE
+	// Every opcode goes through the interpreter, so the profiler sees it
+	constexpr bool kProfile = true;
+#else
+	constexpr bool kProfile = false;
+#endif
+
 	// Helpers for extracting information from opcodes
 	uint8_t OpRegisterX(uint16_t opcode)
 	{
@@ -31,57 +48,485 @@ namespace
 		return opcode & 0x00FF;
 	};
 
-	// Operates at 500 hz
-	auto kOpcodeDuration = std::chrono::milliseconds(2);
+	// Word at a time. It only has to tell states apart within a run, unlike Display::Hash which
+	// has to be the same everywhere.
+	class StateHasher
+	{
+	public:
+		void Add(uint64_t value)
+		{
+			mHash = (mHash ^ value) * 0x9E3779B97F4A7C15;
+			mHash ^= mHash >> 32;
+		}
+
+		void Add(const uint8_t* data, size_t size)
+		{
+			for (; size >= sizeof(uint64_t); data += sizeof(uint64_t), size -= sizeof(uint64_t))
+			{
+				uint64_t word;
+				memcpy(&word, data, sizeof(word));
+				Add(word);
+			}
+			for (; size > 0; data++, size--)
+				Add(*data);
+		}
+
+		uint64_t Get() const { return mHash; }
+
+	private:
+		uint64_t mHash = 0xCBF29CE484222325;
+	};
+
+	// Longest loop body checked for idling, in opcodes
+	constexpr uint16_t kMaxIdleLoopLength = 16;
+
+	// Longest the system is told to wait for an idle program, so the window stays responsive
+	auto kMaxIdleTime = std::chrono::milliseconds(16);
+
+	// Waiting for a key can only end with input, which wakes the system anyway, so this just
+	// keeps the performance overlay ticking over
+	constexpr uint32_t kMaxKeyWaitTime = 250;
 }
 
 namespace chip8
 {
-	Program::Program(Image&& image)
+	Program::Program(Image&& image, const Quirks& quirks, AudioDevice* audioDevice)
 		: mImage(std::move(image))
+		, mAudioDevice(audioDevice)
+		, mHandlers(SelectHandlers(quirks.Index(), std::make_index_sequence<Quirks::kCount>()))
 	{
 		mProgramCounter = mImage.StartOffset();
+		mNativeCode = NativeProgram::Find(mImage);
+		mSharedFusions = ShareFusions(mImage);
+		mFusions = mSharedFusions->data();
 		mLastExecution = std::chrono::system_clock::now();
+		mTimerNow = Timer::ClockType::now();
+
+		if (mAudioDevice != nullptr)
+		{
+			mSoundTimer = std::make_unique<SoundTimer>(mAudioDevice->GetFrequency());
+			if (!mAudioDevice->Attach(mSoundTimer.get()))
+			{
+				LOG_WARNING("More than %zu programs playing sound, this one will be silent", AudioMixer::kMaxVoices);
+				mSoundTimer.reset();
+			}
+		}
+	}
+
+	Program::~Program()
+	{
+		if (mSoundTimer != nullptr)
+			mAudioDevice->Detach(mSoundTimer.get());
+	}
+
+	template <size_t... kIndices>
+	Program::Handlers Program::SelectHandlers(uint32_t index, std::index_sequence<kIndices...>)
+	{
+		// Every combination of quirks gets its own specialisation of the interpreter
+		static constexpr Handlers kHandlers[] = {
+			{
+				&Program::ExecuteLoop<QuirkPolicy<kIndices>, false>,
+				&Program::ExecuteLoop<QuirkPolicy<kIndices>, true>,
+				&Program::ExecuteOpcode<QuirkPolicy<kIndices>>,
+			}...
+		};
+
+		assert(index < std::size(kHandlers));
+		return kHandlers[index];
 	}
 
 	void Program::Render(SDL_Renderer* renderer)
+	{
+		Update();
+		mDisplay.Render(renderer);
+	}
+
+	void Program::Update()
 	{
 		auto executionTime = std::chrono::system_clock::now();
 		auto executionDuration = executionTime - mLastExecution;
-		uint32_t opcodeCount = executionDuration / kOpcodeDuration;
+		uint32_t opcodeCount = executionDuration / mOpcodeDuration;
 
 		// Increment only by the amount of opcodes we've executed
-		mLastExecution += opcodeCount * kOpcodeDuration;
+		mLastExecution += opcodeCount * mOpcodeDuration;
 
+		Fault previousFault = mFault;
+		auto executeStart = std::chrono::steady_clock::now();
 		Execute(opcodeCount);
+		mLastExecuteTime = std::chrono::steady_clock::now() - executeStart;
+		if (mFault != previousFault)
+			LOG_WARNING("Program stopped by %s at %03X", FaultName(mFault), mFaultAddress);
 
-		mDisplay.Render(renderer);
+		if (mSpectator != nullptr)
+			mSpectator->Publish(mDisplay);
+	}
+
+	void Program::SetOpcodeRate(uint32_t opcodeRate)
+	{
+		assert(opcodeRate > 0 && opcodeRate <= 1000000);
+		mOpcodeRate = opcodeRate;
+		mOpcodeDuration = std::chrono::microseconds(1000000 / opcodeRate);
+	}
+
+	uint32_t Program::FrameOpcodes(uint32_t frame) const
+	{
+		uint64_t start = static_cast<uint64_t>(frame) * mOpcodeRate / kFrameRate;
+		uint64_t end = static_cast<uint64_t>(frame + 1) * mOpcodeRate / kFrameRate;
+		return static_cast<uint32_t>(end - start);
+	}
+
+	void Program::SetGain(float gain)
+	{
+		if (mSoundTimer != nullptr)
+			mSoundTimer->SetGain(gain);
+	}
+
+	void Program::SetMuted(bool muted)
+	{
+		if (mSoundTimer != nullptr)
+			mSoundTimer->SetMuted(muted);
+	}
+
+	ProcessStats Program::GetStats()
+	{
+		ProcessStats stats;
+		stats.opcodesExecuted = mCycle;
+		stats.audioUnderruns = mAudioDevice != nullptr ? mAudioDevice->GetUnderruns() : 0;
+		stats.targetOpcodeRate = mOpcodeRate;
+		stats.executeTime = mLastExecuteTime;
+		return stats;
+	}
+
+	const char* Program::FaultName(Fault fault)
+	{
+		switch (fault)
+		{
+		case Fault::None:
+			return "no fault";
+		case Fault::IllegalOpcode:
+			return "illegal opcode";
+		case Fault::StackOverflow:
+			return "stack overflow";
+		case Fault::StackUnderflow:
+			return "stack underflow";
+		case Fault::ProgramCounterOutOfRange:
+			return "program counter out of range";
+		case Fault::MemoryOutOfRange:
+			return "memory access out of range";
+		}
+
+		assert(false);
+		return "unknown fault";
 	}
 
-	void Program::OnKeyDown(const SDL_Keysym& keysym)
+	Program::Snapshot Program::Save() const
 	{
-		mKeyboard.OnKeyDown(keysym);
+		Snapshot snapshot{ mImage, mDisplay, mKeyboard, mWaitingForKey, mKeyRegister, {}, mAddressRegister, mProgramCounter, mStack, mDelayTimer, mTimerNow, mRandom, mSharedFusions, mNativeCode, mFault, mFaultAddress };
+		if (mPrivateFusions != nullptr)
+			snapshot.fusions = std::make_shared<const FusionTable>(*mPrivateFusions);
+		std::copy_n(mRegister, kNumRegisters, snapshot.registers);
+		return snapshot;
 	}
 
-	void Program::OnKeyUp(const SDL_Keysym& keysym)
+	void Program::Restore(const Snapshot& snapshot)
 	{
-		mKeyboard.OnKeyUp(keysym);
+		mImage = snapshot.image;
+		mDisplay = snapshot.display;
+		mKeyboard = snapshot.keyboard;
+		mWaitingForKey = snapshot.waitingForKey;
+		mKeyRegister = snapshot.keyRegister;
+
+		// Input queued for the state being replaced no longer applies
+		mInput.clear();
+
+		std::copy_n(snapshot.registers, kNumRegisters, mRegister);
+		mAddressRegister = snapshot.addressRegister;
+		mProgramCounter = snapshot.programCounter;
+		mStack = snapshot.stack;
+
+		mDelayTimer = snapshot.delayTimer;
+		mTimerNow = snapshot.timerNow;
+		mRandom = snapshot.random;
+
+		// The program can't read the sound timer, so just make sure it's quiet
+		if (mSoundTimer != nullptr)
+			mSoundTimer->SetValue(0);
+
+		// Shared with the snapshot until memory is next written
+		mSharedFusions = snapshot.fusions;
+		mPrivateFusions.reset();
+		mFusions = mSharedFusions->data();
+		mNativeCode = snapshot.nativeCode;
+		mFault = snapshot.fault;
+		mFaultAddress = snapshot.faultAddress;
+
+		mIdleLoop = IdleLoop();
+		mIdle = false;
+	}
+
+	uint64_t Program::StateHash() const
+	{
+		StateHasher hasher;
+		hasher.Add(&mImage[0], Image::Size());
+		hasher.Add(mRegister, kNumRegisters);
+		hasher.Add(mAddressRegister | (mProgramCounter << 16) | (static_cast<uint64_t>(mWaitingForKey) << 32) | (static_cast<uint64_t>(mFault) << 40));
+
+		hasher.Add(mStack.Size());
+		for (uint16_t address : mStack)
+			hasher.Add(address);
+
+		for (size_t y = 0; y < Display::kHeight; y++)
+			hasher.Add(mDisplay.GetRow(y));
+
+		// Keys pressed, and the register the next goes in, only count while FX0A is waiting
+		hasher.Add(mKeyboard.GetHeldKeys());
+		if (mWaitingForKey)
+			hasher.Add(mKeyboard.GetPressedKeys() | (mKeyRegister << 16));
+
+		// The delay timer as the program would read it, and how far it is from changing
+		Timer delayTimer = mDelayTimer;
+		hasher.Add(delayTimer.GetValue(mTimerNow));
+		hasher.Add(delayTimer.TimeUntilDecrement(mTimerNow).count());
+
+		// Each state of the generator has a different next value
+		std::minstd_rand random = mRandom;
+		hasher.Add(random());
+
+		return hasher.Get();
+	}
+
+	void Program::WriteMemory(uint16_t address, const uint8_t* data, size_t size)
+	{
+		std::copy_n(data, size, mImage.Write(address, size));
+		OnMemoryWritten(address, size);
+
+		// Loading code this way is worth looking for pairs in
+		Fuse(address < 3 ? 0 : address - 3, address + size);
+	}
+
+	void Program::OnKeyDown(const SDL_KeyboardEvent& event)
+	{
+		switch (event.keysym.scancode)
+		{
+		case SDL_SCANCODE_F5: // Pause/continue
+			if (mDebugger.Paused())
+				mDebugger.Continue();
+			else
+				mDebugger.Pause();
+			break;
+		case SDL_SCANCODE_F9: // Toggle breakpoint at the current opcode
+			if (mDebugger.HasBreakpoint(mProgramCounter))
+				mDebugger.RemoveBreakpoints(mProgramCounter);
+			else
+				mDebugger.AddBreakpoint(mProgramCounter);
+			break;
+		case SDL_SCANCODE_F10: // Single step
+			mDebugger.Step();
+			break;
+		default:
+			// Held keys repeat, but a CHIP-8 key is either down or not
+			if (uint8_t key = Keyboard::KeyFromScancode(event.keysym.scancode); key != Keyboard::kNoKey && !event.repeat)
+				QueueKey(CycleAt(event.timestamp), key, true);
+			break;
+		}
+	}
+
+	void Program::OnKeyUp(const SDL_KeyboardEvent& event)
+	{
+		if (uint8_t key = Keyboard::KeyFromScancode(event.keysym.scancode); key != Keyboard::kNoKey)
+			QueueKey(CycleAt(event.timestamp), key, false);
+	}
+
+	void Program::SetKeyState(uint8_t keyIndex, bool down)
+	{
+		mKeyboard.SetKeyState(keyIndex, down);
+		LATENCY_KEY_APPLIED(keyIndex, down);
+
+		// FX0A takes the first key released after being pressed during the wait, as the
+		// original interpreter did. Keys already held when it started don't count.
+		if (mWaitingForKey && !down && mKeyboard.GetKeyPressed(keyIndex))
+		{
+			mRegister[mKeyRegister] = keyIndex;
+			mWaitingForKey = false;
+		}
+	}
+
+	uint64_t Program::CycleAt(uint32_t timestamp) const
+	{
+		// SDL stamps events in milliseconds since it started. mLastExecution is the host time
+		// the program has run up to, which is mCycle.
+		int32_t age = static_cast<int32_t>(SDL_GetTicks() - timestamp);
+		auto time = std::chrono::system_clock::now() - std::chrono::milliseconds(std::max(age, 0));
+		if (time <= mLastExecution)
+			return mCycle;
+
+		return mCycle + (time - mLastExecution) / mOpcodeDuration;
+	}
+
+	void Program::QueueKey(uint64_t cycle, uint8_t key, bool down)
+	{
+		// Never ahead of an event queued earlier, so the queue stays in order
+		if (!mInput.empty())
+			cycle = std::max(cycle, mInput.back().cycle);
+
+		mInput.push_back({ cycle, key, down });
+	}
+
+	uint32_t Program::IdleTime()
+	{
+		// Nothing runs until a key is released, so the system can wait for it
+		if (mWaitingForKey && mFault == Fault::None)
+			return kMaxKeyWaitTime;
+
+		if (!mIdle)
+			return 0;
+
+		// Nothing changes until the delay timer next decrements or a key is pressed
+		auto idleTime = std::min<std::chrono::steady_clock::duration>(mDelayTimer.TimeUntilDecrement(mEmulatedTime ? mTimerNow : Timer::ClockType::now()), kMaxIdleTime);
+		return static_cast<uint32_t>(std::max<int64_t>(std::chrono::duration_cast<std::chrono::milliseconds>(idleTime).count(), 0));
 	}
 
 	void Program::Execute(uint32_t opcodeCount)
 	{
-		for (uint32_t i = 0; i < opcodeCount; i++)
+		// Timers are read at the same time throughout a call, which saves reading the clock for every FX07
+		if (!mEmulatedTime)
+			mTimerNow = Timer::ClockType::now();
+		auto startTime = mTimerNow;
+
+		// Run up to each queued event in turn, so that input lands on the same opcode however
+		// the opcodes are split between calls
+		uint64_t start = mCycle;
+		uint64_t end = mCycle + opcodeCount;
+		size_t nextInput = 0;
+		while (true)
 		{
-			uint16_t opcode = (static_cast<uint16_t>(mImage[mProgramCounter]) << 8) + mImage[mProgramCounter + 1];
+			for (; nextInput < mInput.size() && mInput[nextInput].cycle <= mCycle; nextInput++)
+				SetKeyState(mInput[nextInput].key, mInput[nextInput].down);
+
+			uint64_t runEnd = nextInput < mInput.size() ? std::min(end, mInput[nextInput].cycle) : end;
+			if (mCycle >= runEnd)
+				break;
+
+			if (mEmulatedTime)
+				mTimerNow = startTime + (mCycle - start) * mOpcodeDuration;
+
+			// Only switch to the instrumented loop while the debugger or a trace needs it, or as the reference
+			uint32_t runCount = static_cast<uint32_t>(runEnd - mCycle);
+			if (mWaitingForKey)
+				mCycle = runEnd; // Nothing can happen before the next event
+			else if (mDebugger.Active() || mReferenceEngine || mInstructionTrace != nullptr)
+				(this->*mHandlers.executeDebug)(runCount);
+			else
+				(this->*mHandlers.execute)(runCount);
+
+			// Stopped by a fault or the debugger, rather than by FX0A
+			if (mCycle < runEnd && !mWaitingForKey)
+				break;
+		}
+
+		mInput.erase(mInput.begin(), mInput.begin() + nextInput);
+
+		if (mEmulatedTime)
+			mTimerNow = startTime + opcodeCount * mOpcodeDuration;
+	}
+
+	void Program::ExecuteOpcode(uint16_t opcode)
+	{
+		(this->*mHandlers.executeOpcode)(opcode);
+	}
+
+	template <typename Policy, bool kDebug>
+	void Program::ExecuteLoop(uint32_t opcodeCount)
+	{
+		TRACE_SCOPE("Program::Execute");
+
+		mIdle = false;
+
+		uint32_t i = 0;
+		uint32_t skipped = 0;
+		for (; i < opcodeCount && mFault == Fault::None && !mWaitingForKey; i++)
+		{
+			// Run as far as possible natively, interpreting a single opcode whenever that stops
+			// short (e.g. a computed jump to an address that wasn't recompiled)
+			if (!kDebug && !kProfile && mNativeCode != nullptr)
+			{
+				i += mNativeCode->run(*this, opcodeCount - i);
+				if (i == opcodeCount || mFault != Fault::None || mWaitingForKey)
+					break;
+			}
+
+			if (mProgramCounter + 1u >= Image::Size())
+			{
+				Fail(Fault::ProgramCounterOutOfRange, mProgramCounter);
+				break;
+			}
+
+			uint16_t address = mProgramCounter;
+			uint16_t opcode = ReadOpcode(address);
+			PROFILE_OPCODE(mProfiler, address, opcode);
+
+			if constexpr (kDebug)
+			{
+				if (!mDebugger.BeforeExecute(address, opcode, mRegister, mAddressRegister))
+					break;
+			}
+			else
+			{
+				// Anything outside the loop could have side effects, so it has to be observed again
+				if (mIdleLoop.observed && (address < mIdleLoop.start || address > mIdleLoop.end))
+					mIdleLoop.observed = false;
+			}
 
 			// Move the program counter so that it points to the next operation.
 			// Individual opcodes such as jump or call may change this.
 			mProgramCounter += 2;
 
-			ExecuteOpcode(opcode);
+			// Execute both opcodes of a fused pair if there's room for them
+			if constexpr (!kDebug)
+			{
+				Fusion fusion = mFusions[address];
+				if (fusion != Fusion::None && i + 1 < opcodeCount)
+				{
+					uint16_t second = ReadOpcode(address + 2);
+					PROFILE_OPCODE(mProfiler, address + 2, second);
+
+					ExecuteFusion<Policy>(fusion, opcode, second);
+					i++;
+					continue;
+				}
+			}
+
+			ExecuteOpcode<Policy>(opcode);
+
+			if constexpr (kDebug)
+			{
+				if (mInstructionTrace != nullptr)
+					mInstructionTrace->Record(address, opcode, mRegister, mAddressRegister);
+			}
+
+			// The rest of the opcodes would only go round the same loop again. Whole laps change
+			// nothing, so skip those and run what's left of the last one, ending up exactly where
+			// executing every opcode would. When profiling they're run anyway, to be counted.
+			if (!kDebug && !mIdle && (opcode & 0xF000) == 0x1000 && mProgramCounter <= address)
+			{
+				if (uint32_t period = IdleLoopPeriod(address, mCycle + i + 1); period > 0)
+				{
+					if constexpr (!kProfile)
+					{
+						uint32_t remaining = opcodeCount - (i + 1);
+						skipped = remaining - remaining % period;
+						opcodeCount -= skipped;
+					}
+					mIdle = true;
+				}
+			}
 		}
+
+		// Skipped laps count as executed
+		mCycle += i + skipped;
 	}
 
+	template <typename Policy>
 	void Program::ExecuteOpcode(uint16_t opcode)
 	{
 		switch ((opcode & 0xF000) >> 12)
@@ -94,7 +539,12 @@ namespace chip8
 			break;
 		case 0x2: // 2NNN: Call NNN
 			// Only the program counter is saved, the registers are ignored
-			mStack.push_back(mProgramCounter);
+			if (mStack.Full())
+			{
+				Fail(Fault::StackOverflow, mProgramCounter - 2);
+				break;
+			}
+			mStack.Push(mProgramCounter);
 			mProgramCounter = opcode & 0x0FFF;
 			break;
 		case 0x3: // 3XNN: Skip if register X equal NN
@@ -106,7 +556,11 @@ namespace chip8
 				mProgramCounter += 2;
 			break;
 		case 0x5: // 5XYN: Skip if register X equals register Y
-			assert((opcode & 0x000F) == 0); // What would this mean?
+			if ((opcode & 0x000F) != 0) // What would this mean?
+			{
+				Fail(Fault::IllegalOpcode, mProgramCounter - 2);
+				break;
+			}
 			if (mRegister[OpRegisterX(opcode)] == mRegister[OpRegisterY(opcode)])
 				mProgramCounter += 2;
 			break;
@@ -117,29 +571,94 @@ namespace chip8
 			mRegister[OpRegisterX(opcode)] += OpValue(opcode);
 			break;
 		case 0x8: // 8XYN: Two register operations
-			ExecuteOpcode8(opcode);
+			ExecuteOpcode8<Policy>(opcode);
+			break;
+		case 0x9: // 9XYN: Skip if register X not equal register Y
+			if ((opcode & 0x000F) != 0)
+			{
+				Fail(Fault::IllegalOpcode, mProgramCounter - 2);
+				break;
+			}
+			if (mRegister[OpRegisterX(opcode)] != mRegister[OpRegisterY(opcode)])
+				mProgramCounter += 2;
 			break;
 		case 0xA: // ANNN: Mem register = NNN
 			mAddressRegister = OpAddress(opcode);
 			break;
-		case 0xB: // BNNN: Jump to v0 + NNN
-			mProgramCounter = mRegister[0] + OpAddress(opcode);
+		case 0xB: // BNNN: Jump to v0 + NNN, or BXNN: Jump to register X + XNN
+			mProgramCounter = mRegister[Policy::kJumpUsesX ? OpRegisterX(opcode) : 0] + OpAddress(opcode);
 			break;
 		case 0xC: // CXNN: Register X = rand & NN
-			mRegister[OpRegisterX(opcode)] = rand() & OpValue(opcode);
+			mRegister[OpRegisterX(opcode)] = mRandom() & OpValue(opcode);
 			break;
 		case 0xD:
-			ExecuteOpcodeD(opcode);
+			ExecuteOpcodeD<Policy>(opcode);
 			break;
 		case 0xE:
 			ExecuteOpcodeE(opcode);
 			break;
 		case 0xF:
-			ExecuteOpcodeF(opcode);
+			ExecuteOpcodeF<Policy>(opcode);
 			break;
 		}
 	}
 
+	template <typename Policy>
+	void Program::ExecuteFusion(Fusion fusion, uint16_t first, uint16_t second)
+	{
+		// The program counter has only been moved past the first opcode
+		mProgramCounter += 2;
+
+		switch (fusion)
+		{
+		case Fusion::None:
+			assert(false);
+			break;
+		case Fusion::LoadDraw:
+			mAddressRegister = OpAddress(first);
+			ExecuteOpcodeD<Policy>(second);
+			break;
+		case Fusion::LoadLoad:
+			mRegister[OpRegisterX(first)] = OpValue(first);
+			mRegister[OpRegisterX(second)] = OpValue(second);
+			break;
+		case Fusion::AddSkipEqual:
+		{
+			uint8_t& reg = mRegister[OpRegisterX(first)];
+			reg += OpValue(first);
+			if (reg == OpValue(second))
+				mProgramCounter += 2;
+		}
+		break;
+		case Fusion::AddSkipNotEqual:
+		{
+			uint8_t& reg = mRegister[OpRegisterX(first)];
+			reg += OpValue(first);
+			if (reg != OpValue(second))
+				mProgramCounter += 2;
+		}
+		break;
+		case Fusion::TimerSkipEqual:
+		{
+			uint8_t& reg = mRegister[OpRegisterX(first)];
+			reg = mDelayTimer.GetValue(mTimerNow);
+			PROFILE_DELAY_TIMER_READ(mProfiler, reg);
+			if (reg == OpValue(second))
+				mProgramCounter += 2;
+		}
+		break;
+		case Fusion::TimerSkipNotEqual:
+		{
+			uint8_t& reg = mRegister[OpRegisterX(first)];
+			reg = mDelayTimer.GetValue(mTimerNow);
+			PROFILE_DELAY_TIMER_READ(mProfiler, reg);
+			if (reg != OpValue(second))
+				mProgramCounter += 2;
+		}
+		break;
+		}
+	}
+
 	void Program::ExecuteOpcode0(uint16_t opcode)
 	{
 		assert((opcode & 0xF000) == 0x0000);
@@ -148,18 +667,23 @@ namespace chip8
 		{
 		case 0x00E0: // Clear the display
 			mDisplay.Clear();
+			LATENCY_DISPLAY_WRITTEN(mDisplay);
 			break;
 		case 0x00EE: // Return
-			assert(!mStack.empty());
-			mProgramCounter = mStack.back();
-			mStack.pop_back();
+			if (mStack.Empty())
+			{
+				Fail(Fault::StackUnderflow, mProgramCounter - 2);
+				break;
+			}
+			mProgramCounter = mStack.Pop();
 			break;
-		default: // Old machine codes, not needed for interpreting the program?
-			LOG("Ignoring opcode %u", opcode);
+		default: // Old machine code routines, which can't be emulated
+			LOG_DEBUG("Ignoring opcode %04X", opcode);
 			break;
 		}
 	}
 
+	template <typename Policy>
 	void Program::ExecuteOpcode8(uint16_t opcode)
 	{
 		assert((opcode & 0xF000) == 0x8000);
@@ -167,8 +691,7 @@ namespace chip8
 		uint8_t& regX = mRegister[OpRegisterX(opcode)];
 		uint8_t& regY = mRegister[OpRegisterY(opcode)];
 
-		bool xOrYIsCarry = OpRegisterX(opcode) == kCarryRegister || OpRegisterY(opcode) == kCarryRegister;
-
+		// The carry register is written last, so it holds the carry even when it's also register X
 		switch (opcode & 0xF)
 		{
 		case 0x0: // 8XY0: register X = register Y
@@ -176,16 +699,21 @@ namespace chip8
 			break;
 		case 0x1: // 8XY1: register X |= register Y
 			regX |= regY;
+			if constexpr (Policy::kLogicResetsCarry)
+				mRegister[kCarryRegister] = 0;
 			break;
 		case 0x2: // 8XY2: register X &= register Y
 			regX &= regY;
+			if constexpr (Policy::kLogicResetsCarry)
+				mRegister[kCarryRegister] = 0;
 			break;
 		case 0x3: // 8XY3: register X ^= register Y
 			regX ^= regY;
+			if constexpr (Policy::kLogicResetsCarry)
+				mRegister[kCarryRegister] = 0;
 			break;
 		case 0x4: // 8XY4: register X += register Y, with carry
 		{
-			assert(!xOrYIsCarry); // What happens if the carry register is also one of the register being used?
 			uint16_t result = static_cast<uint16_t>(regX) + static_cast<uint16_t>(regY);
 			regX = static_cast<uint8_t>(result & 0xFF);
 			mRegister[kCarryRegister] = result > 0xFF ? 1 : 0;
@@ -193,38 +721,39 @@ namespace chip8
 		break;
 		case 0x5: // 8XY5: register X -= register Y, carry = !borrow
 		{
-			assert(!xOrYIsCarry); // What happens if the carry register is also one of the register being used?
 			uint16_t result = static_cast<uint16_t>(regX) - static_cast<uint16_t>(regY);
 			regX = static_cast<uint8_t>(result & 0xFF);
 			mRegister[kCarryRegister] = result > 0xFF ? 0 : 1;
 		}
 		break;
-		case 0x6: // 8XY6: register X >>= 1, carry = register X & 1;
-			assert(OpRegisterX(opcode) == OpRegisterY(opcode));
-			assert(!xOrYIsCarry);
-			mRegister[kCarryRegister] = regX & 0x1;
-			regX >>= 1;
-			break;
+		case 0x6: // 8XY6: register X >>= 1, carry = register X & 1 (or register X = register Y >> 1)
+		{
+			uint8_t source = Policy::kShiftUsesY ? regY : regX;
+			regX = source >> 1;
+			mRegister[kCarryRegister] = source & 0x1;
+		}
+		break;
 		case 0x7: // 8XY7: register X = register Y - register X, carry = !borrow
 		{
-			assert(!xOrYIsCarry);
-			uint16_t result = static_cast<uint16_t>(regX) - static_cast<uint16_t>(regY);
+			uint16_t result = static_cast<uint16_t>(regY) - static_cast<uint16_t>(regX);
 			regX = static_cast<uint8_t>(result & 0xFF);
 			mRegister[kCarryRegister] = result > 0xFF ? 0 : 1;
 		}
 		break;
-		case 0xE: // 8XYE: register X <<= 1, carry = register X highest bit;
-			assert((opcode & 0x000) == 0);
-			assert(!xOrYIsCarry);
-			mRegister[kCarryRegister] = regX >> 7;
-			regX <<= 1;
-			break;
+		case 0xE: // 8XYE: register X <<= 1, carry = register X highest bit (or register X = register Y << 1)
+		{
+			uint8_t source = Policy::kShiftUsesY ? regY : regX;
+			regX = source << 1;
+			mRegister[kCarryRegister] = source >> 7;
+		}
+		break;
 		default:
-			assert(false); // TODO
+			Fail(Fault::IllegalOpcode, mProgramCounter - 2);
 			break;
 		}
 	}
 
+	template <typename Policy>
 	void Program::ExecuteOpcodeD(uint16_t opcode)
 	{
 		// DXYN - Display sprite (from memomry address register) at coordinates given by registers X and Y
@@ -236,9 +765,23 @@ namespace chip8
 		uint8_t x = mRegister[OpRegisterX(opcode)];
 		uint8_t y = mRegister[OpRegisterY(opcode)];
 
-		assert(mAddressRegister + height * width < sizeof(mImage));
+		if (mAddressRegister + height > mImage.Size())
+		{
+			Fail(Fault::MemoryOutOfRange, mProgramCounter - 2);
+			return;
+		}
+
+		if (static_cast<size_t>(x) + width > Display::kWidth || static_cast<size_t>(y) + height > Display::kHeight)
+			mSpritesOffScreen++;
 
-		bool flipped = mDisplay.Draw(x, y, height, &mImage[mAddressRegister]);
+		PROFILE_DRAW_BEGIN(mProfiler);
+		bool flipped;
+		if constexpr (Policy::kClipSprites)
+			flipped = mDisplay.DrawClipped(x, y, height, &mImage[mAddressRegister]);
+		else
+			flipped = mDisplay.Draw(x, y, height, &mImage[mAddressRegister]);
+		PROFILE_DRAW_END(mProfiler, flipped);
+		LATENCY_DISPLAY_WRITTEN(mDisplay);
 
 		// The carry bit is set depending on whether any pixels were turned off
 		mRegister[kCarryRegister] = flipped ? 1 : 0;
@@ -251,22 +794,27 @@ namespace chip8
 
 		uint8_t registerIndex = OpRegisterX(opcode);
 
+		// Only the low nibble selects a key, as on the original interpreter
+		uint8_t key = mRegister[registerIndex] & 0xF;
+		LATENCY_KEY_READ(key, mDisplay);
+
 		switch (opcode & 0xFF)
 		{
 		case 0x9E: // EX9E - Skip if key in VX is pressed
-			if (mKeyboard.GetKeyState(mRegister[registerIndex]))
+			if (mKeyboard.GetKeyState(key))
 				mProgramCounter += 2;
 			break;
 		case 0xA1: // EX9E - Skip if key in VX isn't pressed
-			if (!mKeyboard.GetKeyState(mRegister[registerIndex]))
+			if (!mKeyboard.GetKeyState(key))
 				mProgramCounter += 2;
 			break;
 		default:
-			assert(false); // TODO
+			Fail(Fault::IllegalOpcode, mProgramCounter - 2);
 			break;
 		}
 	}
 
+	template <typename Policy>
 	void Program::ExecuteOpcodeF(uint16_t opcode)
 	{
 		// FXNN - Functions using one register
@@ -274,37 +822,256 @@ namespace chip8
 
 		uint8_t registerIndex = OpRegisterX(opcode);
 
+		// Check that anything accessing memory stays within it. The rest don't touch memory, so they
+		// carry on with I past the end, which FX1E can leave it.
+		size_t accessSize = 0;
+		switch (opcode & 0xFF)
+		{
+		case 0x33:
+			accessSize = 3;
+			break;
+		case 0x55:
+		case 0x65:
+			accessSize = registerIndex + 1;
+			break;
+		}
+		if (accessSize > 0 && mAddressRegister + accessSize > mImage.Size())
+		{
+			Fail(Fault::MemoryOutOfRange, mProgramCounter - 2);
+			return;
+		}
+
 		switch (opcode & 0xFF)
 		{
 		case 0x07: // FX07 - Get the delay timer to register X
-			mRegister[registerIndex] = mDelayTimer.GetValue();
+			mRegister[registerIndex] = mDelayTimer.GetValue(mTimerNow);
+			PROFILE_DELAY_TIMER_READ(mProfiler, mRegister[registerIndex]);
+			break;
+		case 0x0A: // FX0A - Wait for a key, and put it in register X
+			mKeyboard.ClearPressedKeys();
+			mKeyRegister = registerIndex;
+			mWaitingForKey = true;
 			break;
 		case 0x15: // FX15 - Set the delay timer to register X
-			mDelayTimer.SetValue(mRegister[registerIndex]);
+			mDelayTimer.SetValue(mRegister[registerIndex], mTimerNow);
 			break;
 		case 0x18: // FX18 - Set the sound timer to register X
-			mSoundTimer.SetValue(mRegister[registerIndex]);
+			if (mSoundTimer != nullptr)
+				mSoundTimer->SetValue(mRegister[registerIndex]);
+			break;
+		case 0x1E: // FX1E - Add register X to address register
+			mAddressRegister += mRegister[registerIndex];
 			break;
 		case 0x29: // FX29 - Set address register to sprite for character in register X
 		{
-			uint8_t value = mRegister[registerIndex];
+			uint8_t value = mRegister[registerIndex] & 0xF;
 			mAddressRegister = mImage.SpriteOffset(value);
 		}
 			break;
 		case 0x33: // FX33 - Dump BCD encoding to memory, most signifcant first
-			mImage[mAddressRegister] = (mRegister[registerIndex] / 100);
-			mImage[mAddressRegister + 1] = (mRegister[registerIndex] / 10) % 10;
-			mImage[mAddressRegister + 2] = mRegister[registerIndex] % 10;
+		{
+			uint8_t* data = mImage.Write(mAddressRegister, 3);
+			data[0] = (mRegister[registerIndex] / 100);
+			data[1] = (mRegister[registerIndex] / 10) % 10;
+			data[2] = mRegister[registerIndex] % 10;
+			OnMemoryWritten(mAddressRegister, 3);
+		}
 			break;
 		case 0x55: // FX55 - Dump registers 0 to X (inclusive) to memory
-			std::copy_n(mRegister, registerIndex + 1, &mImage[mAddressRegister]);
+			std::copy_n(mRegister, registerIndex + 1, mImage.Write(mAddressRegister, registerIndex + 1));
+			OnMemoryWritten(mAddressRegister, registerIndex + 1);
+			if constexpr (Policy::kLoadStoreIncrementsAddress)
+				mAddressRegister += registerIndex + 1;
 			break;
 		case 0x65: // FX65 - Load registers 0 to X (inclusive) to memory
 			std::copy_n(&mImage[mAddressRegister], registerIndex + 1, mRegister);
+			if constexpr (Policy::kLoadStoreIncrementsAddress)
+				mAddressRegister += registerIndex + 1;
 			break;
 		default:
-			assert(false); // TODO
+			Fail(Fault::IllegalOpcode, mProgramCounter - 2);
 			break;
 		}
 	}
+
+	void Program::Fail(Fault fault, uint16_t address)
+	{
+		// Keep the first fault, the program stops there
+		if (mFault != Fault::None)
+			return;
+
+		mFault = fault;
+		mFaultAddress = address;
+	}
+
+	uint32_t Program::IdleLoopPeriod(uint16_t jumpAddress, uint64_t cycle)
+	{
+		uint16_t start = mProgramCounter;
+		if (!mIdleLoop.known || mIdleLoop.start != start || mIdleLoop.end != jumpAddress)
+		{
+			mIdleLoop.known = true;
+			mIdleLoop.pure = IsPureLoop(start, jumpAddress);
+			mIdleLoop.start = start;
+			mIdleLoop.end = jumpAddress;
+			mIdleLoop.observed = false;
+		}
+
+		if (!mIdleLoop.pure)
+			return 0;
+
+		// The lap has to be from this call (mCycle is where it started), so that it saw the same
+		// delay timer and keys as the rest of the call will. Skips can depend on those without
+		// changing any register.
+		bool unchanged = mIdleLoop.observed
+			&& mIdleLoop.cycle > mCycle
+			&& mIdleLoop.addressRegister == mAddressRegister
+			&& std::equal(mRegister, mRegister + kNumRegisters, mIdleLoop.registers);
+		uint32_t period = unchanged ? static_cast<uint32_t>(cycle - mIdleLoop.cycle) : 0;
+
+		std::copy_n(mRegister, kNumRegisters, mIdleLoop.registers);
+		mIdleLoop.addressRegister = mAddressRegister;
+		mIdleLoop.cycle = cycle;
+		mIdleLoop.observed = true;
+
+		return period;
+	}
+
+	bool Program::IsPureLoop(uint16_t start, uint16_t end) const
+	{
+		// Only opcodes which can't affect anything outside the registers, and which only depend on
+		// the registers, delay timer and keyboard. Skips can only leave the loop by skipping the jump back.
+		if ((end - start) / 2 >= kMaxIdleLoopLength)
+			return false;
+
+		for (uint16_t address = start; address < end; address += 2)
+		{
+			uint16_t opcode = ReadOpcode(address);
+			switch (opcode >> 12)
+			{
+			case 0x3: // 3XNN/4XNN/5XY0/9XY0: Skips
+			case 0x4:
+			case 0x5:
+			case 0x9:
+			case 0x6: // 6XNN/7XNN/8XYN: Register operations
+			case 0x7:
+			case 0x8:
+			case 0xA: // ANNN: Address register = NNN
+				break;
+			case 0xE: // EX9E/EXA1: Skip on key
+				break;
+			case 0xF:
+				if ((opcode & 0xFF) != 0x07 && (opcode & 0xFF) != 0x1E) // FX07: Read delay timer, FX1E: Address register += X
+					return false;
+				break;
+			default:
+				return false;
+			}
+		}
+
+		return true;
+	}
+
+	Program::Fusion Program::FindFusion(uint16_t first, uint16_t second)
+	{
+		bool sameRegister = OpRegisterX(first) == OpRegisterX(second);
+
+		switch (first >> 12)
+		{
+		case 0x6:
+			if ((second >> 12) == 0x6)
+				return Fusion::LoadLoad;
+			break;
+		case 0x7:
+			if ((second >> 12) == 0x3 && sameRegister)
+				return Fusion::AddSkipEqual;
+			if ((second >> 12) == 0x4 && sameRegister)
+				return Fusion::AddSkipNotEqual;
+			break;
+		case 0xA:
+			if ((second >> 12) == 0xD)
+				return Fusion::LoadDraw;
+			break;
+		case 0xF:
+			if ((first & 0xFF) == 0x07 && (second >> 12) == 0x3 && sameRegister)
+				return Fusion::TimerSkipEqual;
+			if ((first & 0xFF) == 0x07 && (second >> 12) == 0x4 && sameRegister)
+				return Fusion::TimerSkipNotEqual;
+			break;
+		}
+
+		return Fusion::None;
+	}
+
+	std::shared_ptr<const Program::FusionTable> Program::ShareFusions(const Image& image)
+	{
+		// Keyed by the image's shared memory. The table is only shared by programs whose images
+		// haven't been written, and they keep the memory alive, so the key can't be reused.
+		static std::mutex sSharedMutex;
+		static std::map<const uint8_t*, std::weak_ptr<const FusionTable>> sShared;
+
+		std::lock_guard<std::mutex> lock(sSharedMutex);
+
+		const uint8_t* memory = &image[0];
+		if (image.IsShared())
+		{
+			if (std::shared_ptr<const FusionTable> shared = sShared[memory].lock())
+				return shared;
+		}
+
+		// Both opcodes of a pair have to be within memory
+		auto fusions = std::make_shared<FusionTable>();
+		fusions->fill(Fusion::None);
+		for (size_t address = 0; address + 3 < Image::Size(); address++)
+		{
+			uint16_t first = (static_cast<uint16_t>(image[address]) << 8) + image[address + 1];
+			uint16_t second = (static_cast<uint16_t>(image[address + 2]) << 8) + image[address + 3];
+			(*fusions)[address] = FindFusion(first, second);
+		}
+
+		if (!image.IsShared())
+			return fusions;
+
+		// Images come and go, e.g. while fuzzing, so don't hold on to the keys of expired tables
+		for (auto it = sShared.begin(); it != sShared.end();)
+			it = it->second.expired() ? sShared.erase(it) : std::next(it);
+
+		sShared[memory] = fusions;
+		return fusions;
+	}
+
+	Program::FusionTable& Program::WriteFusions()
+	{
+		if (mPrivateFusions == nullptr)
+		{
+			mPrivateFusions = std::make_unique<FusionTable>(*mSharedFusions);
+			mSharedFusions.reset();
+			mFusions = mPrivateFusions->data();
+		}
+		return *mPrivateFusions;
+	}
+
+	void Program::Fuse(size_t start, size_t end)
+	{
+		// Both opcodes of a pair have to be within memory
+		FusionTable& fusions = WriteFusions();
+		for (size_t address = start; address < end && address + 3 < Image::Size(); address++)
+			fusions[address] = FindFusion(ReadOpcode(address), ReadOpcode(address + 2));
+	}
+
+	void Program::OnMemoryWritten(uint16_t address, size_t count)
+	{
+		// Drop any pair overlapping the write. Missing a new pair only costs a little speed, so
+		// they're not looked for again here (it's too slow for FX33/FX55 in a loop).
+		size_t start = address < 3 ? 0 : address - 3;
+		size_t end = std::min(address + count, Image::Size());
+		FusionTable& fusions = WriteFusions();
+		std::fill(fusions.begin() + start, fusions.begin() + end, Fusion::None);
+
+		// The loop might have been written over
+		mIdleLoop.known = false;
+
+		// Recompiled code assumes it isn't modified, so stop using it once it is
+		if (mNativeCode != nullptr && mNativeCode->IsCode(address, count))
+			mNativeCode = nullptr;
+	}
 }
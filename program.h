@@ -1,64 +1,312 @@
 #ifndef CHIP8_PROGRAM_H
 #define CHIP8_PROGRAM_H
 
+#include "debugger.h"
 #include "display.h"
 #include "image.h"
+#include "instruction_trace.h"
 #include "keyboard.h"
 #include "process.h"
-#include "sound_timer.h"
+#include "profiler.h"
+#include "quirks.h"
+#include "spectator.h"
+#include "stack.h"
 #include "timer.h"
 
+#include <array>
 #include <cstddef>
+#include <memory>
+#include <random>
+#include <utility>
 #include <vector>
 
 namespace chip8
 {
-	class Program : public Process
+	class AudioDevice;
+	struct NativeCode;
+	class SoundTimer;
+
+	// Aligned so that the registers and stack, which come straight after the vtable pointer, are
+	// in the first cache line
+	class alignas(64) Program : public Process
 	{
 		// See https://en.wikipedia.org/wiki/CHIP-8
 	public:
-		Program(Image&& image);
+		// Programs created without an audio device are silent, e.g. for tools and tests
+		Program(Image&& image, const Quirks& quirks = Quirks(), AudioDevice* audioDevice = nullptr);
+		~Program();
 
 		void Render(SDL_Renderer* renderer) override;
+
+		// Runs the opcodes due since the last update, Render does this before drawing
+		void Update();
 		bool Finished() override { return false; };
 
-		void OnKeyDown(const SDL_Keysym& keysym) override;
-		void OnKeyUp(const SDL_Keysym& keysym) override;
+		// CHIP-8 keys are queued, and reach the program at the cycle matching the event's timestamp
+		void OnKeyDown(const SDL_KeyboardEvent& event) override;
+		void OnKeyUp(const SDL_KeyboardEvent& event) override;
 
-	private:
+		uint32_t IdleTime() override;
+		ProcessStats GetStats() override;
+
+		// Opcodes executed per second, unless the ROM is known to want another rate
+		static constexpr uint32_t kOpcodeRate = 500;
+		void SetOpcodeRate(uint32_t opcodeRate);
+
+		// Headless runs go a frame at a time, this is how many opcodes are due in the given frame
+		// at the current rate. They're spread so that there's no drift when the rate isn't a
+		// multiple of the frame rate, so every tool replays input at the same opcodes.
+		static constexpr uint32_t kFrameRate = 60;
+		uint32_t FrameOpcodes(uint32_t frame) const;
+
+		// Queued input due within the opcodes is applied between them, at the cycle it was stamped with
 		void Execute(uint32_t opcodeCount);
 
+		// For repeatable runs: CXNN draws from a generator seeded here, and once on emulated time
+		// the timers advance by the time the opcodes passed to Execute take, not the host clock.
+		void Seed(uint32_t seed) { mRandom.seed(seed); }
+		void UseEmulatedTime() { mEmulatedTime = true; }
+
+		// Runs every opcode on its own through the interpreter, with no pairs, recompiled code or
+		// idle loop skipping. The other engines have to match it exactly, see chip8_regress --lockstep.
+		void UseReferenceEngine() { mReferenceEngine = true; }
+
+		Debugger& GetDebugger() { return mDebugger; }
+		const Display& GetDisplay() const { return mDisplay; }
+		uint16_t GetProgramCounter() const { return mProgramCounter; }
+		uint8_t GetRegister(uint8_t index) const { return mRegister[index]; }
+		uint8_t ReadMemory(uint16_t address) const { return mImage[address]; }
+
+		// Problems with the program which stop it running, rather than aborting the emulator
+		enum class Fault : uint8_t
+		{
+			None,
+			IllegalOpcode,
+			StackOverflow,
+			StackUnderflow,
+			ProgramCounterOutOfRange,
+			MemoryOutOfRange,
+		};
+
+		static const char* FaultName(Fault fault);
+
+		Fault GetFault() const { return mFault; }
+		uint16_t GetFaultAddress() const { return mFaultAddress; }
+
+		// Sprites drawn partly or wholly off the edge of the screen. Few ROMs do this often, so
+		// lots of them suggests the ROM is running with the wrong quirks.
+		uint32_t GetSpritesOffScreen() const { return mSpritesOffScreen; }
+
+		// Complete machine state, so that a program can be reset without constructing a new one
+		struct Snapshot;
+
+		Snapshot Save() const;
+		void Restore(const Snapshot& snapshot);
+
+		// Hash of the machine state: memory, registers, stack, delay timer, display, keys and the
+		// CXNN generator. Programs with the same hash carry on the same given the same input, so
+		// states already seen can be recognised without keeping them, see chip8_search.
+		uint64_t StateHash() const;
+
+		// For programs created with an audio device, which all play at once
+		void SetGain(float gain);
+		void SetMuted(bool muted);
+
+		// Publishes the display after every frame rendered
+		void SetSpectator(std::unique_ptr<Spectator> spectator) { mSpectator = std::move(spectator); }
+
+		// Records every instruction from now on. Like the debugger, this runs the program on the
+		// instrumented interpreter loop.
+		void SetInstructionTrace(std::unique_ptr<InstructionTrace> trace) { mInstructionTrace = std::move(trace); }
+
+		// Applies immediately, ahead of anything queued
+		void SetKeyState(uint8_t keyIndex, bool down);
+		void WriteMemory(uint16_t address, const uint8_t* data, size_t size);
+
+	private:
+		friend class NativeProgram;
+
+		// The interpreter specialised for the quirks selected on load
+		struct Handlers
+		{
+			void (Program::*execute)(uint32_t opcodeCount);
+			void (Program::*executeDebug)(uint32_t opcodeCount);
+			void (Program::*executeOpcode)(uint16_t opcode);
+		};
+
+		template <size_t... kIndices>
+		static Handlers SelectHandlers(uint32_t index, std::index_sequence<kIndices...>);
+
 		void ExecuteOpcode(uint16_t opcode);
 
+		template <typename Policy, bool kDebug> void ExecuteLoop(uint32_t opcodeCount);
+		template <typename Policy> void ExecuteOpcode(uint16_t opcode);
+
+		// Pairs of opcodes which are executed by a single handler
+		enum class Fusion : uint8_t
+		{
+			None,
+			LoadDraw,          // ANNN, DXYN
+			LoadLoad,          // 6XNN, 6YNN
+			AddSkipEqual,      // 7XNN, 3XNN
+			AddSkipNotEqual,   // 7XNN, 4XNN
+			TimerSkipEqual,    // FX07, 3XNN
+			TimerSkipNotEqual, // FX07, 4XNN
+		};
+
+		using FusionTable = std::array<Fusion, Image::Size()>;
+
+		static Fusion FindFusion(uint16_t first, uint16_t second);
+		void Fuse(size_t start, size_t end);
+		static std::shared_ptr<const FusionTable> ShareFusions(const Image& image);
+		FusionTable& WriteFusions();
+		template <typename Policy> void ExecuteFusion(Fusion fusion, uint16_t first, uint16_t second);
+
+		uint16_t ReadOpcode(uint16_t address) const { return (static_cast<uint16_t>(mImage[address]) << 8) + mImage[address + 1]; }
+
 		// Sub categories of opcodes
 		void ExecuteOpcode0(uint16_t opcode);
-		void ExecuteOpcode8(uint16_t opcode);
-		void ExecuteOpcodeD(uint16_t opcode);
+		template <typename Policy> void ExecuteOpcode8(uint16_t opcode);
+		template <typename Policy> void ExecuteOpcodeD(uint16_t opcode);
 		void ExecuteOpcodeE(uint16_t opcode);
-		void ExecuteOpcodeF(uint16_t opcode);
+		template <typename Policy> void ExecuteOpcodeF(uint16_t opcode);
+
+		void OnMemoryWritten(uint16_t address, size_t count);
+
+		// Idle loop detection, called after jumping backwards from jumpAddress at the given cycle.
+		// Returns the opcodes in a lap of the loop if it's idle, zero otherwise.
+		uint32_t IdleLoopPeriod(uint16_t jumpAddress, uint64_t cycle);
+		bool IsPureLoop(uint16_t start, uint16_t end) const;
+
+		void Fail(Fault fault, uint16_t address);
+
+		// The cycle an SDL event happened at, going by how far behind the host clock the program is
+		uint64_t CycleAt(uint32_t timestamp) const;
+		void QueueKey(uint64_t cycle, uint8_t key, bool down);
 
 	private:
+		// Registers and stack, first so that they share a cache line
+		static constexpr size_t  kNumRegisters  = 16;
+		static constexpr uint8_t kCarryRegister = 0xF;
+		uint8_t  mRegister[kNumRegisters] = {};
+		uint16_t mAddressRegister = 0;
+		uint16_t mProgramCounter  = 0;
+		Stack    mStack;
+
 		// System
 		Display mDisplay;
 		Keyboard mKeyboard;
 		std::chrono::system_clock::time_point mLastExecution;
 
+		// Opcodes executed since the program started, the clock input is stamped against.
+		// Idle loops and waiting for a key count as executing.
+		uint64_t mCycle = 0;
+
+		struct KeyEvent
+		{
+			uint64_t cycle;
+			uint8_t key;
+			bool down;
+		};
+
+		// In cycle order
+		std::vector<KeyEvent> mInput;
+
+		// FX0A parks the program until a key is pressed and released
+		bool mWaitingForKey = false;
+		uint8_t mKeyRegister = 0;
+
 		// Memory
 		Image mImage;
 
-		// Registers
-		static constexpr size_t  kNumRegisters  = 16;
-		static constexpr uint8_t kCarryRegister = 0xF;
-		uint8_t  mRegister[kNumRegisters] = {};
-		uint16_t mAddressRegister         = 0;
-		uint16_t mProgramCounter          = 0;
+		// Timers. The program can't read the sound timer, so there's only one while an audio device is playing it.
+		Timer mDelayTimer;
+		std::unique_ptr<SoundTimer> mSoundTimer; // TODO - this needs to set off a bell when it hits 0
+		AudioDevice* mAudioDevice;
 
-		// Stack
-		std::vector<uint16_t> mStack;
+		// What the timers take as the current time during Execute
+		Timer::ClockType::time_point mTimerNow;
+		bool mEmulatedTime = false;
 
-		// Timers
-		Timer mDelayTimer;
-		SoundTimer mSoundTimer; // TODO - this needs to set off a bell when it hits 0
+		uint32_t mOpcodeRate = kOpcodeRate;
+		std::chrono::microseconds mOpcodeDuration{ 1000000 / kOpcodeRate };
+
+		bool mReferenceEngine = false;
+
+		std::minstd_rand mRandom;
+
+		// Execution
+		Handlers mHandlers;
+
+		// The fusion starting at each address, kept up to date as memory is written. A jump to
+		// the second opcode of a pair just executes it on its own.
+		//
+		// Like the image, programs of the same ROM share one table until memory is written, at
+		// which point the program takes a private copy. mFusions points to whichever is current.
+		std::shared_ptr<const FusionTable> mSharedFusions;
+		std::unique_ptr<FusionTable> mPrivateFusions;
+		const Fusion* mFusions = nullptr;
+
+		// The last loop jumped back to. Once a pure loop has gone round with no change to the
+		// registers it will keep doing so until the delay timer or keyboard changes, so whole
+		// laps of the rest of the opcodes being executed can be skipped.
+		struct IdleLoop
+		{
+			bool known = false;
+			bool pure = false;
+			uint16_t start = 0;
+			uint16_t end = 0;
+
+			// Registers and cycle at the last jump back, cleared if the program counter leaves the loop
+			bool observed = false;
+			uint64_t cycle = 0;
+			uint8_t registers[kNumRegisters] = {};
+			uint16_t addressRegister = 0;
+		};
+
+		IdleLoop mIdleLoop;
+		bool mIdle = false;
+
+		// For the performance overlay
+		std::chrono::steady_clock::duration mLastExecuteTime{};
+
+		// Recompiled version of this ROM, if one was built in
+		const NativeCode* mNativeCode = nullptr;
+
+		Debugger mDebugger;
+		std::unique_ptr<Spectator> mSpectator;
+		std::unique_ptr<InstructionTrace> mInstructionTrace;
+
+		Fault mFault = Fault::None;
+		uint16_t mFaultAddress = 0;
+		uint32_t mSpritesOffScreen = 0;
+
+#ifdef CHIP8_PROFILE
+		Profiler mProfiler;
+#endif
+	};
+
+	struct Program::Snapshot
+	{
+		Image image;
+		Display display;
+		Keyboard keyboard;
+		bool waitingForKey;
+		uint8_t keyRegister;
+
+		uint8_t  registers[kNumRegisters];
+		uint16_t addressRegister;
+		uint16_t programCounter;
+		Stack stack;
+
+		Timer delayTimer;
+		Timer::ClockType::time_point timerNow;
+		std::minstd_rand random;
+
+		std::shared_ptr<const FusionTable> fusions;
+		const NativeCode* nativeCode;
+		Fault fault;
+		uint16_t faultAddress;
 	};
 }
 
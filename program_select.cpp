@@ -1,35 +1,120 @@
 ﻿#include "program_select.h"
 
 #include "image.h"
+#include "log.h"
+#include "multi_session.h"
 #include "program.h"
+#include "rom_profile.h"
+#include "tracer.h"
+#include "zip_archive.h"
 
+#include <algorithm>
 #include <cassert>
 
 namespace
 {
 	constexpr char kImageExtension[] = ".ch8";
-	constexpr char kFont[] = "DejaVuSans.ttf";
-	constexpr int kFontSize = 12;
+	constexpr char kArchiveExtension[] = ".zip";
+
+	// Set to a socket path to publish the display of each program run, see spectator.h
+	constexpr char kSpectatorSocketVariable[] = "CHIP8_SPECTATOR_SOCKET";
+
+	// Set to a file path to record every instruction executed, see instruction_trace.h
+	constexpr char kInstructionTraceVariable[] = "CHIP8_INSTRUCTION_TRACE";
+
+	// Copies of a single program run side by side, e.g. for soak testing
+	constexpr size_t kSessionCopies = 16;
 
 	const SDL_Color kTextColor{ 0xFF, 0xFF, 0xFF, 0xFF };
 	const SDL_Color kHighlightedTextColor{ 0x00, 0x00, 0xFF, 0xFF };
+
+	// Zip archives browse like directories, and so do the directories within them
+
+	bool IsDirectory(const std::filesystem::path& path)
+	{
+		std::filesystem::path archivePath;
+		std::string name;
+		if (std::filesystem::is_directory(path))
+			return true;
+		if (!chip8::ZipArchive::Split(path, archivePath, name))
+			return false;
+
+		std::shared_ptr<const chip8::ZipArchive> archive = chip8::ZipArchive::Open(archivePath);
+		return archive != nullptr && archive->IsDirectory(name);
+	}
+
+	bool FitsInMemory(uintmax_t size)
+	{
+		return size > 0 && size <= chip8::Image::Size() - chip8::Image::StartOffset();
+	}
+
+	// ROMs which wouldn't fit in memory, such as most SCHIP and XO-CHIP ones, aren't offered
+	bool IsProgram(const std::filesystem::path& path)
+	{
+		if (path.extension() != kImageExtension)
+			return false;
+
+		std::filesystem::path archivePath;
+		std::string name;
+		if (std::filesystem::is_regular_file(path))
+		{
+			std::error_code error;
+			uintmax_t size = std::filesystem::file_size(path, error);
+			return !error && FitsInMemory(size);
+		}
+		if (!chip8::ZipArchive::Split(path, archivePath, name))
+			return false;
+
+		std::shared_ptr<const chip8::ZipArchive> archive = chip8::ZipArchive::Open(archivePath);
+		const chip8::ZipArchive::Entry* entry = archive != nullptr ? archive->Find(name) : nullptr;
+		return entry != nullptr && FitsInMemory(entry->size);
+	}
+
+	// The directories and programs in a directory, in name order
+	std::vector<std::filesystem::path> ListChildren(const std::filesystem::path& path)
+	{
+		std::vector<std::filesystem::path> children;
+
+		std::filesystem::path archivePath;
+		std::string name;
+		if (!std::filesystem::is_directory(path) && chip8::ZipArchive::Split(path, archivePath, name))
+		{
+			std::shared_ptr<const chip8::ZipArchive> archive = chip8::ZipArchive::Open(archivePath);
+			if (archive == nullptr)
+				return children;
+
+			// Archives within archives aren't opened, they'd have to be inflated first
+			for (const chip8::ZipArchive::Child& child : archive->List(name))
+			{
+				std::filesystem::path childPath = path / child.name;
+				if (child.directory || childPath.extension() == kImageExtension)
+					children.push_back(childPath);
+			}
+			return children;
+		}
+
+		for (const auto& child : std::filesystem::directory_iterator(path))
+		{
+			if (child.is_directory() ||
+				(child.is_regular_file() && (child.path().extension() == kImageExtension || child.path().extension() == kArchiveExtension)))
+			{
+				children.push_back(child.path());
+			}
+		}
+		std::sort(children.begin(), children.end());
+		return children;
+	}
 }
 
 namespace chip8
 {
-	ProgramSelect::ProgramSelect()
-		: mCurrentPath(std::filesystem::current_path())
+	ProgramSelect::ProgramSelect(Resources& resources)
+		: mResources(resources)
+		, mCurrentPath(std::filesystem::current_path())
 		, mSelectedIndex(0)
 		, mChangingCurrentPath(true)
 		, mProgramSelected(false)
 	{
-		mFont = TTF_OpenFont(kFont, kFontSize);
-		assert(mFont != nullptr);
-	}
-
-	ProgramSelect::~ProgramSelect()
-	{
-		TTF_CloseFont(mFont);
 	}
 
 	void ProgramSelect::Render(SDL_Renderer* renderer)
@@ -50,30 +135,27 @@ namespace chip8
 
 		// Get the selected entry
 		assert(mSelectedIndex < mEntries.size());
-		SDL_Surface* surface = CreateTextSurface(mEntries[mSelectedIndex], kHighlightedTextColor);
+		const Resources::Text& selected = GetEntryText(renderer, mEntries[mSelectedIndex], kHighlightedTextColor);
 
-		int pixelsStart = (height / 2) - (surface->h / 2);
-		int pixelsEnd = pixelsStart + surface->h;
+		int pixelsStart = (height / 2) - (selected.height / 2);
+		int pixelsEnd = pixelsStart + selected.height;
 
-		RenderSurface(renderer, surface, pixelsStart, width, height);
-		SDL_FreeSurface(surface);
+		RenderText(renderer, selected, pixelsStart, width, height);
 
 		// Then add entries above
 		for (int i = mSelectedIndex - 1; i >= 0 && pixelsStart > 0; i--)
 		{
-			SDL_Surface* surface = CreateTextSurface(mEntries[i], kTextColor);
-			pixelsStart -= surface->h;
-			RenderSurface(renderer, surface, pixelsStart, width, height);
-			SDL_FreeSurface(surface);
+			const Resources::Text& text = GetEntryText(renderer, mEntries[i], kTextColor);
+			pixelsStart -= text.height;
+			RenderText(renderer, text, pixelsStart, width, height);
 		}
 
 		// Then add entries below
 		for (int i = mSelectedIndex + 1; i < mEntries.size() && pixelsEnd < height; i++)
 		{
-			SDL_Surface* surface = CreateTextSurface(mEntries[i], kTextColor);
-			RenderSurface(renderer, surface, pixelsEnd, width, height);
-			pixelsEnd += surface->h;
-			SDL_FreeSurface(surface);
+			const Resources::Text& text = GetEntryText(renderer, mEntries[i], kTextColor);
+			RenderText(renderer, text, pixelsEnd, width, height);
+			pixelsEnd += text.height;
 		}
 	}
 
@@ -84,67 +166,101 @@ namespace chip8
 
 	std::unique_ptr<Process> ProgramSelect::NextProcess()
 	{
+		if (!mSessionPaths.empty())
+			return std::make_unique<MultiSession>(mSessionPaths, &mResources.GetAudioDevice());
+
 		Image image(mCurrentPath);
-		return std::make_unique<Program>(std::move(image));
+
+		// A ROM seen for the first time runs with the defaults, while it's tried out headless in
+		// the background to find the quirks and rate it wants from then on. One which couldn't
+		// be loaded runs empty, there's nothing to detect.
+		RomProfiles& profiles = mResources.GetRomProfiles();
+		RomProfile profile;
+		if (!profiles.Find(RomProfiles::Hash(image), profile) && IsProgram(mCurrentPath))
+			profiles.DetectInBackground(image, mResources.GetWorkers(), mCurrentPath.filename().string());
+
+		auto program = std::make_unique<Program>(std::move(image), profile.quirks, &mResources.GetAudioDevice());
+		program->SetOpcodeRate(profile.opcodeRate);
+
+		if (const char* socketPath = SDL_getenv(kSpectatorSocketVariable))
+			program->SetSpectator(std::make_unique<Spectator>(socketPath));
+
+		if (const char* tracePath = SDL_getenv(kInstructionTraceVariable))
+			program->SetInstructionTrace(std::make_unique<InstructionTrace>(tracePath));
+
+		return program;
 	}
 
-	void ProgramSelect::OnKeyUp(const SDL_Keysym& keysym)
+	void ProgramSelect::OnKeyUp(const SDL_KeyboardEvent& event)
 	{
 		if (!mChangingCurrentPath)
 		{
 			// If we aren't in the process of changing the current path,
 			// navigate the available selections
-			if (keysym.scancode == SDL_SCANCODE_UP)
+			if (event.keysym.scancode == SDL_SCANCODE_UP)
 			{
 				if (mSelectedIndex > 0)
 					mSelectedIndex--;
 				else
 					mSelectedIndex = mEntries.size() - 1;
 			}
-			else if (keysym.scancode == SDL_SCANCODE_DOWN)
+			else if (event.keysym.scancode == SDL_SCANCODE_DOWN)
 			{
 				if (mSelectedIndex < mEntries.size() - 1)
 					mSelectedIndex++;
 				else
 					mSelectedIndex = 0;
 			}
-			else if (keysym.scancode == SDL_SCANCODE_RETURN)
+			else if (event.keysym.scancode == SDL_SCANCODE_RETURN)
 			{
 				mChangingCurrentPath = true;
 			}
+			else if (event.keysym.scancode == SDL_SCANCODE_M)
+			{
+				// Run every program in a directory, or copies of a single program, side by side
+				const std::filesystem::path& path = mEntries[mSelectedIndex];
+				if (IsProgram(path))
+				{
+					mSessionPaths.assign(kSessionCopies, path);
+				}
+				else if (IsDirectory(path))
+				{
+					for (const std::filesystem::path& child : ListChildren(path))
+					{
+						if (IsProgram(child))
+							mSessionPaths.push_back(child);
+					}
+				}
+
+				mProgramSelected = !mSessionPaths.empty();
+			}
 		}
 	}
 
 	void ProgramSelect::UpdatePaths()
 	{
+		TRACE_SCOPE("ProgramSelect::UpdatePaths");
+
 		if (mChangingCurrentPath)
 		{
 			if (mSelectedIndex < mEntries.size())
 				mCurrentPath = mEntries[mSelectedIndex];
 
-			std::filesystem::directory_entry currentEntry(mCurrentPath);
-			if (currentEntry.is_regular_file())
+			if (!IsDirectory(mCurrentPath))
 			{
 				// This is a file - attempt to load it as a program
+				assert(IsProgram(mCurrentPath));
 				mProgramSelected = true;
 			}
 			else
 			{
-				assert(currentEntry.is_directory());
-
 				mEntries.clear();
 				// Add the parent path - we want this at the top of the list to navigate up one
 				mEntries.push_back(mCurrentPath.parent_path());
 
 				// Then add valid children
-				for (const auto& child : std::filesystem::directory_iterator(mCurrentPath))
-				{
-					if (child.is_directory() ||
-						(child.is_regular_file() && child.path().extension() == kImageExtension))
-					{
-						mEntries.push_back(child.path());
-					}
-				}
+				std::vector<std::filesystem::path> children = ListChildren(mCurrentPath);
+				mEntries.insert(mEntries.end(), children.begin(), children.end());
 
 				mChangingCurrentPath = false;
 				mSelectedIndex = 0;
@@ -152,33 +268,21 @@ namespace chip8
 		}
 	}
 
-	SDL_Surface* ProgramSelect::CreateTextSurface(const std::filesystem::path& path, const SDL_Color& color)
+	const Resources::Text& ProgramSelect::GetEntryText(SDL_Renderer* renderer, const std::filesystem::path& path, const SDL_Color& color)
 	{
-#if _WIN32
-		SDL_Surface* surface = TTF_RenderUNICODE_Solid(mFont, reinterpret_cast<const Uint16*>(path.filename().c_str()), color);
-#else
-		SDL_Surface* surface = TTF_RenderUTF8_Solid(mFont, path.filename().c_str(), color);
-#endif
-		assert(surface != nullptr);
-		return surface;
+		// The textures are cached, so returning to a directory doesn't render its names again
+		return mResources.GetText(renderer, path.filename().u8string(), color);
 	}
 
-	void ProgramSelect::RenderSurface(SDL_Renderer* renderer, SDL_Surface* surface, int pixelsY, int width, int height)
+	void ProgramSelect::RenderText(SDL_Renderer* renderer, const Resources::Text& text, int pixelsY, int width, int height)
 	{
-		// TODO: This is almost certainly horrifically inefficient - should at least cache textures.
-		assert(surface != nullptr);
-
-		SDL_Texture* texture = SDL_CreateTextureFromSurface(renderer, surface);
-		assert(texture != nullptr);
-
 		int copyStart = std::max(0, pixelsY);
-		int copyWidth = std::min(surface->w, width);
-		int copyHeight = std::min({ surface->h, height - pixelsY, pixelsY + surface->h }); // Surface height, pixels to end, pixels from start
+		int copyWidth = std::min(text.width, width);
+		int copyHeight = std::min({ text.height, height - pixelsY, pixelsY + text.height }); // Text height, pixels to end, pixels from start
 		SDL_Rect srcRect{ 0, 0, copyWidth, copyHeight };
 		SDL_Rect dstRect{ 0, copyStart, copyWidth, copyHeight };
 
-		int result = SDL_RenderCopy(renderer, texture, &srcRect, &dstRect);
+		int result = SDL_RenderCopy(renderer, text.texture, &srcRect, &dstRect);
 		assert(result == 0);
-		SDL_DestroyTexture(texture);
 	};
 }
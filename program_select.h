@@ -2,34 +2,35 @@
 #define CHIP8_PROGRAM_SELECT_H
 
 #include "process.h"
-
-#include "SDL_ttf.h"
+#include "resources.h"
 
 #include <filesystem>
+#include <vector>
 
 namespace chip8
 {
 	class ProgramSelect : public Process
 	{
 	public:
-		ProgramSelect();
-		~ProgramSelect();
+		explicit ProgramSelect(Resources& resources);
 
 		void Render(SDL_Renderer* renderer) override;
 		bool Finished() override;
 
 		std::unique_ptr<Process> NextProcess() override;
 
-		void OnKeyDown(const SDL_Keysym& keysym) override {};
-		void OnKeyUp(const SDL_Keysym& keysym) override;
+		void OnKeyDown(const SDL_KeyboardEvent& event) override {};
+		void OnKeyUp(const SDL_KeyboardEvent& event) override;
 
 	private:
 		void UpdatePaths();
 
-		SDL_Surface* CreateTextSurface(const std::filesystem::path& path, const SDL_Color& color);
-		void RenderSurface(SDL_Renderer* renderer, SDL_Surface* surface, int pixelsY, int width, int height);
+		const Resources::Text& GetEntryText(SDL_Renderer* renderer, const std::filesystem::path& path, const SDL_Color& color);
+		void RenderText(SDL_Renderer* renderer, const Resources::Text& text, int pixelsY, int width, int height);
 
 	private:
+		Resources& mResources;
+
 		std::filesystem::path mCurrentPath;
 		std::vector<std::filesystem::path> mEntries;
 
@@ -37,7 +38,8 @@ namespace chip8
 		bool mChangingCurrentPath;
 		bool mProgramSelected;
 
-		TTF_Font* mFont;
+		// Set when several programs are selected to run side by side
+		std::vector<std::filesystem::path> mSessionPaths;
 	};
 }
 
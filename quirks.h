@@ -0,0 +1,67 @@
+#ifndef CHIP8_QUIRKS_H
+#define CHIP8_QUIRKS_H
+
+#include <cstdint>
+
+namespace chip8
+{
+	// Behaviours which differ between CHIP-8 interpreters, ROMs are written for one or the other.
+	// The defaults are the behaviour of this interpreter before quirks were selectable.
+	struct Quirks
+	{
+		// 8XY6/8XYE shift register Y into register X, rather than shifting register X in place
+		bool shiftUsesY = false;
+
+		// FX55/FX65 leave the address register pointing after the last register stored or loaded
+		bool loadStoreIncrementsAddress = false;
+
+		// BNNN jumps to register X + NNN (i.e. BXNN), rather than register 0 + NNN
+		bool jumpUsesX = false;
+
+		// 8XY1/8XY2/8XY3 reset the carry register
+		bool logicResetsCarry = false;
+
+		// Sprites are clipped at the edges of the screen, rather than wrapping around
+		bool clipSprites = false;
+
+		static constexpr uint32_t kCount = 1 << 5;
+
+		static Quirks FromIndex(uint32_t index)
+		{
+			Quirks quirks;
+			quirks.shiftUsesY = (index & 1) != 0;
+			quirks.loadStoreIncrementsAddress = (index & 2) != 0;
+			quirks.jumpUsesX = (index & 4) != 0;
+			quirks.logicResetsCarry = (index & 8) != 0;
+			quirks.clipSprites = (index & 16) != 0;
+			return quirks;
+		}
+
+		uint32_t Index() const
+		{
+			return (shiftUsesY ? 1 : 0)
+				| (loadStoreIncrementsAddress ? 2 : 0)
+				| (jumpUsesX ? 4 : 0)
+				| (logicResetsCarry ? 8 : 0)
+				| (clipSprites ? 16 : 0);
+		}
+
+		bool operator==(const Quirks& other) const { return Index() == other.Index(); }
+		bool operator!=(const Quirks& other) const { return Index() != other.Index(); }
+	};
+
+	// Compile time version of Quirks, for specialising the interpreter
+	template <uint32_t kIndex>
+	struct QuirkPolicy
+	{
+		static_assert(kIndex < Quirks::kCount);
+
+		static constexpr bool kShiftUsesY = (kIndex & 1) != 0;
+		static constexpr bool kLoadStoreIncrementsAddress = (kIndex & 2) != 0;
+		static constexpr bool kJumpUsesX = (kIndex & 4) != 0;
+		static constexpr bool kLogicResetsCarry = (kIndex & 8) != 0;
+		static constexpr bool kClipSprites = (kIndex & 16) != 0;
+	};
+}
+
+#endif // CHIP8_QUIRKS_H
@@ -0,0 +1,112 @@
+#include "resources.h"
+
+#include "tracer.h"
+
+#include <cassert>
+
+namespace
+{
+	constexpr char kFont[] = "DejaVuSans.ttf";
+	constexpr int kFontSize = 12;
+
+	// Quirks and rates found for ROMs loaded before, see rom_profile.h
+	constexpr char kRomProfiles[] = "chip8_profiles.txt";
+
+	// Text is cached as it's drawn, a big enough directory could otherwise hold on to a lot of textures
+	constexpr size_t kMaxTexts = 512;
+}
+
+namespace chip8
+{
+	Resources::~Resources()
+	{
+		for (auto& [key, text] : mTexts)
+			SDL_DestroyTexture(text.texture);
+
+		if (mFont != nullptr)
+			TTF_CloseFont(mFont);
+
+		if (mTtfInitialised)
+			TTF_Quit();
+	}
+
+	TTF_Font* Resources::GetFont()
+	{
+		if (mFont == nullptr)
+		{
+			TRACE_SCOPE("Resources::GetFont");
+
+			if (!mTtfInitialised)
+			{
+				int result = TTF_Init();
+				assert(result == 0);
+				mTtfInitialised = true;
+			}
+
+			mFont = TTF_OpenFont(kFont, kFontSize);
+			assert(mFont != nullptr);
+		}
+
+		return mFont;
+	}
+
+	AudioDevice& Resources::GetAudioDevice()
+	{
+		if (mAudioDevice == nullptr)
+		{
+			TRACE_SCOPE("Resources::GetAudioDevice");
+			mAudioDevice = std::make_unique<AudioDevice>();
+		}
+
+		return *mAudioDevice;
+	}
+
+	WorkerPool& Resources::GetWorkers()
+	{
+		if (mWorkers == nullptr)
+			mWorkers = std::make_unique<WorkerPool>();
+
+		return *mWorkers;
+	}
+
+	RomProfiles& Resources::GetRomProfiles()
+	{
+		if (mRomProfiles == nullptr)
+		{
+			TRACE_SCOPE("Resources::GetRomProfiles");
+			mRomProfiles = std::make_unique<RomProfiles>(kRomProfiles);
+		}
+
+		return *mRomProfiles;
+	}
+
+	const Resources::Text& Resources::GetText(SDL_Renderer* renderer, const std::string& text, const SDL_Color& color)
+	{
+		std::string key;
+		key.reserve(4 + text.size());
+		key += static_cast<char>(color.r);
+		key += static_cast<char>(color.g);
+		key += static_cast<char>(color.b);
+		key += static_cast<char>(color.a);
+		key += text;
+
+		if (auto cached = mTexts.find(key); cached != mTexts.end())
+			return cached->second;
+
+		if (mTexts.size() >= kMaxTexts)
+		{
+			for (auto& [cachedKey, cachedText] : mTexts)
+				SDL_DestroyTexture(cachedText.texture);
+			mTexts.clear();
+		}
+
+		SDL_Surface* surface = TTF_RenderUTF8_Solid(GetFont(), text.c_str(), color);
+		assert(surface != nullptr);
+
+		Text rendered{ SDL_CreateTextureFromSurface(renderer, surface), surface->w, surface->h };
+		assert(rendered.texture != nullptr);
+		SDL_FreeSurface(surface);
+
+		return mTexts.emplace(std::move(key), rendered).first->second;
+	}
+}
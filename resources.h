@@ -0,0 +1,57 @@
+#ifndef CHIP8_RESOURCES_H
+#define CHIP8_RESOURCES_H
+
+#include "audio_device.h"
+#include "rom_profile.h"
+#include "worker_pool.h"
+
+#include "SDL.h"
+#include "SDL_ttf.h"
+
+#include <memory>
+#include <string>
+#include <unordered_map>
+
+namespace chip8
+{
+	// Things which are slow to create and shared between processes, owned by the system so that
+	// switching between the program select and a program doesn't load them again. Each is only
+	// created (along with the subsystem it needs) the first time it's asked for.
+	class Resources
+	{
+	public:
+		Resources() = default;
+		~Resources();
+
+		Resources(const Resources&) = delete;
+		Resources& operator=(const Resources&) = delete;
+
+		TTF_Font* GetFont();
+		AudioDevice& GetAudioDevice();
+		WorkerPool& GetWorkers();
+		RomProfiles& GetRomProfiles();
+
+		struct Text
+		{
+			SDL_Texture* texture;
+			int width;
+			int height;
+		};
+
+		// A line of UTF-8 text in the font, the texture is kept for the next time it's drawn
+		const Text& GetText(SDL_Renderer* renderer, const std::string& text, const SDL_Color& color);
+
+	private:
+		bool mTtfInitialised = false;
+		TTF_Font* mFont = nullptr;
+
+		std::unique_ptr<AudioDevice> mAudioDevice;
+		std::unique_ptr<WorkerPool> mWorkers;
+		std::unique_ptr<RomProfiles> mRomProfiles;
+
+		// Keyed by colour then text
+		std::unordered_map<std::string, Text> mTexts;
+	};
+}
+
+#endif // CHIP8_RESOURCES_H
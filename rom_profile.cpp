@@ -0,0 +1,268 @@
+#include "rom_profile.h"
+
+#include "log.h"
+#include "worker_pool.h"
+
+#include <algorithm>
+#include <cinttypes>
+#include <cstdio>
+#include <fstream>
+#include <iterator>
+#include <limits>
+#include <string>
+#include <vector>
+
+namespace
+{
+	// Long enough to get past most title screens with the input below
+	constexpr uint32_t kTrialFrames = 10 * chip8::Program::kFrameRate;
+
+	// Slowest first
+	constexpr uint32_t kOpcodeRates[] = { chip8::Program::kOpcodeRate, 1000, 1500, 3000 };
+	constexpr size_t kOpcodeRateCount = std::size(kOpcodeRates);
+
+	// There's nobody to press keys, so each is tapped in turn to get past title screens and set
+	// games going
+	constexpr uint32_t kKeyPeriod = 20;
+	constexpr uint32_t kKeyHeldFrames = 4;
+
+	// A fault ends the run, the earlier the worse. Anything else is scored per frame.
+	constexpr int64_t kFaultPenalty = 4 * kTrialFrames;
+	constexpr int64_t kOffScreenPenalty = 2;
+
+	// At a rate with time to spare, a ROM paced by the delay timer idles at the end of most frames
+	constexpr uint32_t kMinIdleFraction = 4;
+
+	struct Trial
+	{
+		chip8::RomProfile profile;
+
+		chip8::Program::Fault fault = chip8::Program::Fault::None;
+		uint32_t frames = 0; // Completed before any fault
+		uint32_t displayChanges = 0;
+		uint32_t spritesOffScreen = 0;
+		uint32_t idleFrames = 0;
+
+		int64_t Score() const
+		{
+			int64_t score = displayChanges;
+			score -= kOffScreenPenalty * std::min(spritesOffScreen, kTrialFrames);
+			if (fault != chip8::Program::Fault::None)
+				score -= kFaultPenalty - frames;
+			return score;
+		}
+
+		bool HasTimeToSpare() const
+		{
+			return fault == chip8::Program::Fault::None && idleFrames * kMinIdleFraction >= frames;
+		}
+	};
+
+	void Run(const chip8::Image& image, Trial& trial)
+	{
+		chip8::Image copy(image);
+		chip8::Program program(std::move(copy), trial.profile.quirks);
+		program.SetOpcodeRate(trial.profile.opcodeRate);
+		program.UseEmulatedTime();
+
+		uint64_t lastHash = program.GetDisplay().Hash();
+		for (uint32_t frame = 0; frame < kTrialFrames; frame++)
+		{
+			uint8_t key = (frame / kKeyPeriod) % 16;
+			if (frame % kKeyPeriod == 0)
+				program.SetKeyState(key, true);
+			else if (frame % kKeyPeriod == kKeyHeldFrames)
+				program.SetKeyState(key, false);
+
+			program.Execute(program.FrameOpcodes(frame));
+
+			trial.fault = program.GetFault();
+			if (trial.fault != chip8::Program::Fault::None)
+				break;
+			trial.frames++;
+
+			uint64_t hash = program.GetDisplay().Hash();
+			trial.displayChanges += hash != lastHash ? 1 : 0;
+			lastHash = hash;
+
+			trial.idleFrames += program.IdleTime() > 0 ? 1 : 0;
+		}
+
+		trial.spritesOffScreen = program.GetSpritesOffScreen();
+	}
+
+	uint32_t QuirksSet(uint32_t index)
+	{
+		uint32_t count = 0;
+		for (; index != 0; index &= index - 1)
+			count++;
+		return count;
+	}
+}
+
+namespace chip8
+{
+	bool DetectProfile(const Image& image, WorkerPool& workers, RomProfile& profile)
+	{
+		std::vector<Trial> trials(Quirks::kCount * kOpcodeRateCount);
+		for (size_t index = 0; index < trials.size(); index++)
+		{
+			trials[index].profile.quirks = Quirks::FromIndex(static_cast<uint32_t>(index / kOpcodeRateCount));
+			trials[index].profile.opcodeRate = kOpcodeRates[index % kOpcodeRateCount];
+		}
+
+		workers.Run(trials.size(), [&](size_t index) { Run(image, trials[index]); });
+
+		bool allFaulted = std::all_of(trials.begin(), trials.end(), [](const Trial& trial) { return trial.fault != Program::Fault::None; });
+		if (allFaulted)
+			return false;
+
+		// Quirks go by their total over every rate, so one lucky run doesn't decide it
+		uint32_t bestQuirks = 0;
+		int64_t bestScore = std::numeric_limits<int64_t>::min();
+		for (uint32_t quirks = 0; quirks < Quirks::kCount; quirks++)
+		{
+			int64_t score = 0;
+			for (size_t rate = 0; rate < kOpcodeRateCount; rate++)
+				score += trials[quirks * kOpcodeRateCount + rate].Score();
+
+			if (score > bestScore || (score == bestScore && QuirksSet(quirks) < QuirksSet(bestQuirks)))
+			{
+				bestQuirks = quirks;
+				bestScore = score;
+			}
+		}
+
+		// A ROM which never waits is left at the default rate, there's nothing to say it wants another
+		profile = RomProfile();
+		profile.quirks = Quirks::FromIndex(bestQuirks);
+		for (size_t rate = 0; rate < kOpcodeRateCount; rate++)
+		{
+			const Trial& trial = trials[bestQuirks * kOpcodeRateCount + rate];
+			if (trial.HasTimeToSpare())
+			{
+				profile.opcodeRate = trial.profile.opcodeRate;
+				break;
+			}
+		}
+
+		return true;
+	}
+
+	RomProfiles::RomProfiles(const std::filesystem::path& path)
+		: mPath(path)
+	{
+		// Nothing's been stored yet if it doesn't exist
+		std::ifstream file(path);
+		std::string line;
+		for (size_t lineNumber = 1; std::getline(file, line); lineNumber++)
+		{
+			if (line.empty() || line[0] == '#')
+				continue;
+
+			// Later lines replace earlier ones for the same ROM
+			uint64_t hash;
+			uint32_t quirks;
+			RomProfile profile;
+			if (std::sscanf(line.c_str(), "%" SCNx64 " quirks=%" SCNu32 " rate=%" SCNu32, &hash, &quirks, &profile.opcodeRate) != 3 ||
+				quirks >= Quirks::kCount || profile.opcodeRate == 0)
+			{
+				LOG_WARNING("%s:%zu: expected <hash> quirks=<index> rate=<n>", path.string().c_str(), lineNumber);
+				continue;
+			}
+
+			profile.quirks = Quirks::FromIndex(quirks);
+			mProfiles[hash] = profile;
+		}
+	}
+
+	RomProfiles::~RomProfiles()
+	{
+		{
+			std::lock_guard<std::mutex> lock(mMutex);
+			mStopping = true;
+		}
+		mPendingAdded.notify_all();
+
+		if (mDetector.joinable())
+			mDetector.join();
+	}
+
+	uint64_t RomProfiles::Hash(const Image& image)
+	{
+		// FNV-1a
+		uint64_t hash = 0xCBF29CE484222325;
+		for (size_t offset = 0; offset < Image::Size(); offset++)
+			hash = (hash ^ image[offset]) * 0x100000001B3;
+		return hash;
+	}
+
+	bool RomProfiles::Find(uint64_t hash, RomProfile& profile) const
+	{
+		std::lock_guard<std::mutex> lock(mMutex);
+		auto found = mProfiles.find(hash);
+		if (found == mProfiles.end())
+			return false;
+
+		profile = found->second;
+		return true;
+	}
+
+	void RomProfiles::Store(uint64_t hash, const RomProfile& profile)
+	{
+		std::lock_guard<std::mutex> lock(mMutex);
+		mProfiles[hash] = profile;
+
+		std::ofstream file(mPath, std::ios::app);
+		char line[64];
+		std::snprintf(line, sizeof(line), "%016" PRIx64 " quirks=%" PRIu32 " rate=%" PRIu32 "\n", hash, profile.quirks.Index(), profile.opcodeRate);
+		if (!(file << line))
+			LOG_ERROR("Unable to write %s", mPath.string().c_str());
+	}
+
+	void RomProfiles::DetectInBackground(const Image& image, WorkerPool& workers, const std::string& name)
+	{
+		uint64_t hash = Hash(image);
+
+		std::lock_guard<std::mutex> lock(mMutex);
+		for (const Pending& pending : mPending)
+		{
+			if (pending.hash == hash)
+				return;
+		}
+
+		mPending.push_back({ hash, image, name });
+		if (!mDetector.joinable())
+			mDetector = std::thread(&RomProfiles::DetectorMain, this, std::ref(workers));
+		mPendingAdded.notify_one();
+	}
+
+	void RomProfiles::DetectorMain(WorkerPool& workers)
+	{
+		std::unique_lock<std::mutex> lock(mMutex);
+		while (true)
+		{
+			mPendingAdded.wait(lock, [this]() { return mStopping || !mPending.empty(); });
+			if (mStopping)
+				return;
+
+			// Left at the front until it's stored, so that it isn't queued again in the meantime
+			Pending pending = mPending.front();
+			lock.unlock();
+
+			RomProfile profile;
+			if (DetectProfile(pending.image, workers, profile))
+			{
+				Store(pending.hash, profile);
+				LOG("Detected quirks %u at %u opcodes a second for %s", profile.quirks.Index(), profile.opcodeRate, pending.name.c_str());
+			}
+			else
+			{
+				LOG_WARNING("Every trial of %s faulted, it keeps the default quirks and rate", pending.name.c_str());
+			}
+
+			lock.lock();
+			mPending.pop_front();
+		}
+	}
+}
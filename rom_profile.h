@@ -0,0 +1,90 @@
+#ifndef CHIP8_ROM_PROFILE_H
+#define CHIP8_ROM_PROFILE_H
+
+#include "image.h"
+#include "program.h"
+#include "quirks.h"
+
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <filesystem>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+
+namespace chip8
+{
+	class WorkerPool;
+
+	// How a ROM expects to be run
+	struct RomProfile
+	{
+		Quirks quirks;
+		uint32_t opcodeRate = Program::kOpcodeRate;
+	};
+
+	// Runs the ROM headless for a few seconds under every combination of quirks and opcode
+	// rate, spread across the workers, and picks the one it seems to have been written for.
+	//
+	// Each run is scored on how it went: a fault (illegal opcode, stack underflow in 00EE and so
+	// on) is worst, then sprites drawn off screen, while a display which keeps changing counts in
+	// its favour. Quirks the ROM never exercises score the same either way, so ties go to the
+	// defaults. The rate is the slowest at which the ROM has time to spare waiting on the delay
+	// timer or a key, i.e. it can keep up with itself.
+	//
+	// Returns false if every run faulted, there's nothing to go on then.
+	bool DetectProfile(const Image& image, WorkerPool& workers, RomProfile& profile);
+
+	// Profiles already found, so each ROM is only analysed once. Kept in a text file with a
+	// line per ROM, keyed by a hash of its image so renamed or archived copies are found too:
+	//   <hash> quirks=<index> rate=<opcodes a second>
+	class RomProfiles
+	{
+	public:
+		explicit RomProfiles(const std::filesystem::path& path);
+
+		// Waits for the ROM being detected, if any, the rest are dropped
+		~RomProfiles();
+
+		RomProfiles(const RomProfiles&) = delete;
+		RomProfiles& operator=(const RomProfiles&) = delete;
+
+		static uint64_t Hash(const Image& image);
+
+		bool Find(uint64_t hash, RomProfile& profile) const;
+
+		// Also appended to the file
+		void Store(uint64_t hash, const RomProfile& profile);
+
+		// Detects the ROM's profile on a thread of its own, which uses the workers, and stores
+		// it. Detection takes a while, so the ROM can carry on with the defaults in the meantime.
+		// Nothing else may use the workers until this has been destroyed.
+		void DetectInBackground(const Image& image, WorkerPool& workers, const std::string& name);
+
+	private:
+		struct Pending
+		{
+			uint64_t hash;
+			Image image;
+			std::string name;
+		};
+
+		void DetectorMain(WorkerPool& workers);
+
+	private:
+		std::filesystem::path mPath;
+
+		mutable std::mutex mMutex;
+		std::unordered_map<uint64_t, RomProfile> mProfiles;
+
+		// The front is being detected
+		std::deque<Pending> mPending;
+		std::condition_variable mPendingAdded;
+		std::thread mDetector;
+		bool mStopping = false;
+	};
+}
+
+#endif // CHIP8_ROM_PROFILE_H
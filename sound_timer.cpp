@@ -2,43 +2,38 @@
 
 #include <algorithm>
 #include <cassert>
+#include <map>
+#include <mutex>
 
 namespace chip8
 {
-	SoundTimer::SoundTimer()
+	SoundTimer::SoundTimer(uint32_t frequency)
+		: mDeviceFrequency(frequency)
+		, mWaveform(ShareWaveform(frequency))
 	{
-		SDL_AudioSpec desiredSpec = {};
-		SDL_AudioSpec obtainedSpec = {};
-
-		desiredSpec.format = AUDIO_F32SYS;
-		desiredSpec.channels = 1;
-		desiredSpec.callback = &RenderCallback;
-		desiredSpec.userdata = this;
-
-		mDevice = SDL_OpenAudioDevice(NULL, SDL_FALSE, &desiredSpec, &obtainedSpec, SDL_TRUE);
-		assert(mDevice > 0);
+	}
 
-		assert(obtainedSpec.format == AUDIO_F32SYS);
-		assert(obtainedSpec.channels == 1);
+	std::shared_ptr<const std::vector<float>> SoundTimer::ShareWaveform(uint32_t frequency)
+	{
+		// Every timer at a frequency plays the same waveform, so they share it
+		static std::mutex sSharedMutex;
+		static std::map<uint32_t, std::weak_ptr<const std::vector<float>>> sShared;
 
-		// Record data for later use
-		mDeviceFrequency = obtainedSpec.freq;
+		std::lock_guard<std::mutex> lock(sSharedMutex);
+		if (std::shared_ptr<const std::vector<float>> shared = sShared[frequency].lock())
+			return shared;
 
 		// Let's create a 100Hz-ish sawtooth
-		size_t numSamples = obtainedSpec.freq / 100;
-		mWaveform.reserve(numSamples);
+		size_t numSamples = frequency / 100;
+		auto waveform = std::make_shared<std::vector<float>>();
+		waveform->reserve(numSamples);
 		for (size_t sample = 0; sample < numSamples; ++sample)
 		{
-			mWaveform.push_back(2.f * static_cast<float>(sample) / (numSamples - 1) - 1.f);
+			waveform->push_back(2.f * static_cast<float>(sample) / (numSamples - 1) - 1.f);
 		}
 
-		// Start the audio device
-		SDL_PauseAudioDevice(mDevice, false);
-	}
-
-	SoundTimer::~SoundTimer()
-	{
-		SDL_CloseAudioDevice(mDevice);
+		sShared[frequency] = waveform;
+		return waveform;
 	}
 
 	void SoundTimer::SetValue(uint8_t value)
@@ -47,19 +42,7 @@ namespace chip8
 		mRemainingSamples.store(value * mDeviceFrequency / 60);
 	}
 
-	void SoundTimer::RenderCallback(void * soundObject, Uint8 * buffer, int bufferLen)
-	{
-		assert(bufferLen >= 0);
-		assert(bufferLen % sizeof(float) == 0);
-		assert(soundObject != nullptr);
-		
-		reinterpret_cast<SoundTimer*>(soundObject)->Render(
-			reinterpret_cast<float*>(buffer),
-			bufferLen / sizeof(float)
-		);
-	}
-
-	void SoundTimer::Render(float * buffer, size_t bufferLen)
+	bool SoundTimer::Mix(float * buffer, size_t bufferLen)
 	{
 		size_t dstOffset = 0;
 		size_t srcOffset = mWaveformOffset;
@@ -71,32 +54,34 @@ namespace chip8
 			finalRemainingSamples = remainingSamples > bufferLen ? remainingSamples - bufferLen : 0;
 		} while (mRemainingSamples.compare_exchange_weak(remainingSamples, finalRemainingSamples) == false);
 
-		while (dstOffset < bufferLen)
-		{
-			if (remainingSamples > 0)
-			{
-				size_t copyCount = std::min({
-					mWaveform.size() - srcOffset,
-					static_cast<size_t>(remainingSamples),
-					bufferLen - dstOffset
-					});
+		// A muted timer still runs down, so it's in step if it's unmuted
+		float gain = mMuted.load(std::memory_order_relaxed) ? 0.f : mGain.load(std::memory_order_relaxed);
 
-				std::copy_n(mWaveform.begin() + srcOffset, copyCount, buffer + dstOffset);
+		while (dstOffset < bufferLen && remainingSamples > 0)
+		{
+			size_t copyCount = std::min({
+				mWaveform->size() - srcOffset,
+				static_cast<size_t>(remainingSamples),
+				bufferLen - dstOffset
+				});
 
-				dstOffset += copyCount;
-				remainingSamples -= copyCount;
-				srcOffset += copyCount;
-				srcOffset %= mWaveform.size();
-			}
-			else
+			if (gain != 0.f)
 			{
-				// Buzzer has stopped, fill with silence
-				std::fill_n(buffer + dstOffset, bufferLen - dstOffset, 0.f);
-				break;
+				const float* waveform = mWaveform->data() + srcOffset;
+				float* output = buffer + dstOffset;
+				for (size_t sample = 0; sample < copyCount; sample++)
+					output[sample] += waveform[sample] * gain;
 			}
+
+			dstOffset += copyCount;
+			remainingSamples -= copyCount;
+			srcOffset += copyCount;
+			srcOffset %= mWaveform->size();
 		}
 
 		// Update the offset for next time
 		mWaveformOffset = remainingSamples > 0 ? srcOffset : 0;
+
+		return dstOffset > 0 && gain != 0.f;
 	}
 }
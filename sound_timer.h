@@ -1,10 +1,10 @@
 #ifndef CHIP8_SOUND_TIMER_H
 #define CHIP8_SOUND_TIMER_H
 
-#include "SDL.h"
-
 #include <atomic>
-#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
 #include <vector>
 
 namespace chip8
@@ -12,25 +12,31 @@ namespace chip8
 	class SoundTimer
 	{
 	public:
-		SoundTimer();
-		~SoundTimer();
+		// Samples are rendered at the given frequency, by the AudioMixer the timer is
+		// attached to or by calling Mix directly.
+		explicit SoundTimer(uint32_t frequency);
 
 		void SetValue(uint8_t value);
 
-	private:
-		static void RenderCallback(void * soundObject,
-			Uint8 * buffer,
-			int bufferLen);
+		// Adds the buzzer to what's already in the buffer. Returns false if it added nothing.
+		bool Mix(float * buffer, size_t bufferLen);
 
-		void Render(float * buffer, size_t bufferLen);
+		// Can be changed while the timer is being mixed
+		void SetGain(float gain) { mGain.store(gain, std::memory_order_relaxed); }
+		void SetMuted(bool muted) { mMuted.store(muted, std::memory_order_relaxed); }
+
+	private:
+		static std::shared_ptr<const std::vector<float>> ShareWaveform(uint32_t frequency);
 
 	private:
-		SDL_AudioDeviceID mDevice = 0;
 		uint32_t mDeviceFrequency = 0;
 		std::atomic_uint32_t mRemainingSamples = 0;
 
-		std::vector<float> mWaveform;
+		std::shared_ptr<const std::vector<float>> mWaveform;
 		size_t mWaveformOffset = 0;
+
+		std::atomic<float> mGain = 1.f;
+		std::atomic_bool mMuted = false;
 	};
 }
 
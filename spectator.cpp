@@ -0,0 +1,253 @@
+#include "spectator.h"
+
+#include "log.h"
+#include "tracer.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cstring>
+
+#ifndef _WIN32
+#include <cerrno>
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
+
+namespace
+{
+	// Enough for viewers connecting at the same time
+	constexpr int kListenBacklog = 16;
+
+	// Runs in a delta are limited by their one byte lengths
+	constexpr size_t kMaxRunLength = 255;
+
+#ifndef _WIN32
+#ifdef MSG_NOSIGNAL
+	// A viewer disconnecting shouldn't kill the emulator with SIGPIPE
+	constexpr int kSendFlags = MSG_NOSIGNAL;
+#else
+	constexpr int kSendFlags = 0;
+#endif
+
+	bool SetNonBlocking(int socket)
+	{
+		int flags = fcntl(socket, F_GETFL, 0);
+		return flags >= 0 && fcntl(socket, F_SETFL, flags | O_NONBLOCK) == 0;
+	}
+#endif
+
+	void WriteHeader(std::vector<uint8_t>& message, chip8::Spectator::MessageType type, size_t payloadSize)
+	{
+		assert(payloadSize <= UINT16_MAX);
+		message[0] = type;
+		message[1] = static_cast<uint8_t>(payloadSize);
+		message[2] = static_cast<uint8_t>(payloadSize >> 8);
+	}
+}
+
+namespace chip8
+{
+	Spectator::Spectator(const std::filesystem::path& socketPath)
+		: mSocketPath(socketPath)
+	{
+#ifdef _WIN32
+		LOG_WARNING("Spectating isn't supported on Windows, not publishing to %s", mSocketPath.string().c_str());
+#else
+		sockaddr_un address = {};
+		address.sun_family = AF_UNIX;
+		std::string path = mSocketPath.string();
+		if (path.size() >= sizeof(address.sun_path))
+		{
+			LOG_WARNING("Spectator socket path is too long: %s", path.c_str());
+			return;
+		}
+		std::strncpy(address.sun_path, path.c_str(), sizeof(address.sun_path) - 1);
+
+		mSocket = socket(AF_UNIX, SOCK_STREAM, 0);
+		if (mSocket < 0)
+		{
+			LOG_WARNING("Unable to create spectator socket: %s", strerror(errno));
+			return;
+		}
+
+		// Replace the socket left behind by a previous run
+		unlink(path.c_str());
+
+		if (bind(mSocket, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0 ||
+			listen(mSocket, kListenBacklog) != 0 ||
+			!SetNonBlocking(mSocket))
+		{
+			LOG_WARNING("Unable to listen for spectators on %s: %s", path.c_str(), strerror(errno));
+			close(mSocket);
+			mSocket = -1;
+			return;
+		}
+#endif
+	}
+
+	Spectator::~Spectator()
+	{
+#ifndef _WIN32
+		for (Viewer& viewer : mViewers)
+			close(viewer.socket);
+
+		if (mSocket >= 0)
+		{
+			close(mSocket);
+			unlink(mSocketPath.string().c_str());
+		}
+#endif
+	}
+
+	void Spectator::Publish(const Display& display)
+	{
+		if (mSocket < 0)
+			return;
+
+		TRACE_SCOPE("Spectator::Publish");
+
+		AcceptViewers();
+		if (mViewers.empty())
+			return;
+
+		Frame frame;
+		display.Pack(frame.data());
+
+		bool changed = frame != mFrame;
+		if (changed)
+			EncodeDelta(mFrame, frame, mDelta);
+
+		mFrame = frame;
+		mKeyframe.clear();
+
+		for (size_t index = 0; index < mViewers.size();)
+		{
+			Viewer& viewer = mViewers[index];
+
+			bool connected = Flush(viewer);
+			if (connected && !viewer.pending.empty())
+			{
+				// Still sending an old frame, so drop this one
+				viewer.needsKeyframe = true;
+			}
+			else if (connected && viewer.needsKeyframe)
+			{
+				if (mKeyframe.empty())
+				{
+					mKeyframe.resize(kHeaderSize);
+					WriteHeader(mKeyframe, kKeyframe, frame.size());
+					mKeyframe.insert(mKeyframe.end(), frame.begin(), frame.end());
+				}
+
+				connected = Send(viewer, mKeyframe);
+				viewer.needsKeyframe = false;
+			}
+			else if (connected && changed)
+			{
+				connected = Send(viewer, mDelta);
+			}
+
+			if (connected)
+			{
+				index++;
+				continue;
+			}
+
+#ifndef _WIN32
+			close(viewer.socket);
+#endif
+			mViewers.erase(mViewers.begin() + index);
+		}
+	}
+
+	void Spectator::AcceptViewers()
+	{
+#ifndef _WIN32
+		while (true)
+		{
+			int socket = accept(mSocket, nullptr, nullptr);
+			if (socket < 0)
+				break;
+
+			if (!SetNonBlocking(socket))
+			{
+				close(socket);
+				continue;
+			}
+
+#ifdef SO_NOSIGPIPE
+			int noSigPipe = 1;
+			setsockopt(socket, SOL_SOCKET, SO_NOSIGPIPE, &noSigPipe, sizeof(noSigPipe));
+#endif
+
+			mViewers.push_back({ socket, true, {} });
+		}
+#endif
+	}
+
+	bool Spectator::Flush(Viewer& viewer)
+	{
+#ifndef _WIN32
+		if (viewer.pending.empty())
+			return true;
+
+		ssize_t sent = send(viewer.socket, viewer.pending.data(), viewer.pending.size(), kSendFlags);
+		if (sent < 0)
+			return errno == EAGAIN || errno == EWOULDBLOCK;
+
+		viewer.pending.erase(viewer.pending.begin(), viewer.pending.begin() + sent);
+#endif
+		return true;
+	}
+
+	bool Spectator::Send(Viewer& viewer, const std::vector<uint8_t>& message)
+	{
+		assert(viewer.pending.empty());
+
+#ifndef _WIN32
+		ssize_t sent = send(viewer.socket, message.data(), message.size(), kSendFlags);
+		if (sent < 0)
+		{
+			if (errno != EAGAIN && errno != EWOULDBLOCK)
+				return false;
+			sent = 0;
+		}
+
+		// The viewer has to get the rest of the message before anything else
+		viewer.pending.assign(message.begin() + sent, message.end());
+#endif
+		return true;
+	}
+
+	void Spectator::EncodeDelta(const Frame& previous, const Frame& current, std::vector<uint8_t>& message)
+	{
+		message.resize(kHeaderSize);
+
+		size_t offset = 0;
+		while (offset < current.size())
+		{
+			size_t skip = 0;
+			while (offset + skip < current.size() && skip < kMaxRunLength && previous[offset + skip] == current[offset + skip])
+				skip++;
+			offset += skip;
+
+			size_t count = 0;
+			while (offset + count < current.size() && count < kMaxRunLength && previous[offset + count] != current[offset + count])
+				count++;
+
+			// Nothing changed after the last run
+			if (count == 0 && offset == current.size())
+				break;
+
+			message.push_back(static_cast<uint8_t>(skip));
+			message.push_back(static_cast<uint8_t>(count));
+			for (size_t index = offset; index < offset + count; index++)
+				message.push_back(previous[index] ^ current[index]);
+			offset += count;
+		}
+
+		WriteHeader(message, kDelta, message.size() - kHeaderSize);
+	}
+}
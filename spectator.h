@@ -0,0 +1,78 @@
+#ifndef CHIP8_SPECTATOR_H
+#define CHIP8_SPECTATOR_H
+
+#include "display.h"
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <vector>
+
+namespace chip8
+{
+	// Publishes a program's display to any number of viewers connected to a Unix domain
+	// socket, see chip8_spectate.cpp for a viewer.
+	//
+	// Each message is a type byte and a little endian uint16_t payload size, then the payload:
+	//   kKeyframe  the whole screen, as packed by Display::Pack
+	//   kDelta     changes since the previous frame, as runs of (skip, count, count bytes) to
+	//              XOR with the packed screen. Anything after the last run is unchanged.
+	//
+	// A viewer gets a keyframe when it connects, then deltas. Sends never block, a viewer
+	// that can't keep up has frames dropped and gets a keyframe once it has caught up.
+	class Spectator
+	{
+	public:
+		enum MessageType : uint8_t
+		{
+			kKeyframe = 1,
+			kDelta = 2,
+		};
+
+		static constexpr size_t kHeaderSize = 3;
+
+		explicit Spectator(const std::filesystem::path& socketPath);
+		~Spectator();
+
+		Spectator(const Spectator&) = delete;
+		Spectator& operator=(const Spectator&) = delete;
+
+		// Call once per frame
+		void Publish(const Display& display);
+
+		size_t ViewerCount() const { return mViewers.size(); }
+
+	private:
+		using Frame = std::array<uint8_t, Display::kPackedSize>;
+
+		struct Viewer
+		{
+			int socket;
+			bool needsKeyframe;
+
+			// The unsent end of a message the socket only took part of
+			std::vector<uint8_t> pending;
+		};
+
+		void AcceptViewers();
+
+		// Both return false once the viewer has disconnected
+		bool Flush(Viewer& viewer);
+		bool Send(Viewer& viewer, const std::vector<uint8_t>& message);
+
+		static void EncodeDelta(const Frame& previous, const Frame& current, std::vector<uint8_t>& message);
+
+	private:
+		std::filesystem::path mSocketPath;
+		int mSocket = -1;
+
+		std::vector<Viewer> mViewers;
+
+		Frame mFrame = {};
+		std::vector<uint8_t> mKeyframe;
+		std::vector<uint8_t> mDelta;
+	};
+}
+
+#endif // CHIP8_SPECTATOR_H
@@ -0,0 +1,46 @@
+#ifndef CHIP8_STACK_H
+#define CHIP8_STACK_H
+
+#include <algorithm>
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+
+namespace chip8
+{
+	// Return addresses for 2NNN/00EE. Held inline with a fixed depth, like the hardware, so a
+	// program's state needs no allocations and copies as plain memory.
+	class Stack
+	{
+	public:
+		// As on later interpreters, the COSMAC VIP only had room for 12
+		static constexpr size_t kDepth = 16;
+
+		bool Empty() const { return mSize == 0; }
+		bool Full() const { return mSize == kDepth; }
+		size_t Size() const { return mSize; }
+
+		void Push(uint16_t address) {
+			assert(!Full());
+			mEntries[mSize++] = address;
+		}
+
+		uint16_t Pop() {
+			assert(!Empty());
+			return mEntries[--mSize];
+		}
+
+		// Oldest first
+		const uint16_t* begin() const { return mEntries; }
+		const uint16_t* end() const { return mEntries + mSize; }
+
+		bool operator==(const Stack& other) const { return std::equal(begin(), end(), other.begin(), other.end()); }
+		bool operator!=(const Stack& other) const { return !(*this == other); }
+
+	private:
+		uint16_t mEntries[kDepth] = {};
+		uint8_t mSize = 0;
+	};
+}
+
+#endif // CHIP8_STACK_H
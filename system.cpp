@@ -1,11 +1,13 @@
 #include "system.h"
 
+#include "latency.h"
 #include "program.h"
+#include "profiler.h"
 #include "program_select.h"
-
-#include "SDL_ttf.h"
+#include "tracer.h"
 
 #include <cassert>
+#include <chrono>
 
 namespace
 {
@@ -21,10 +23,10 @@ namespace chip8
 {
 	System::System()
 	{
-		int result = SDL_Init(SDL_INIT_AUDIO | SDL_INIT_VIDEO | SDL_INIT_EVENTS);
-		assert(result == 0);
-		result = TTF_Init();
+		// Audio and fonts are brought up by Resources the first time something needs them
+		int result = SDL_Init(SDL_INIT_VIDEO | SDL_INIT_EVENTS);
 		assert(result == 0);
+		mResources = std::make_unique<Resources>();
 
 		result = SDL_CreateWindowAndRenderer(kPixelWidth * kNumPixelsWide, kPixelHeight * kNumPixelsHigh,
 			SDL_WINDOW_BORDERLESS | SDL_WINDOW_SHOWN,
@@ -32,17 +34,27 @@ namespace chip8
 			&mRenderer);
 		assert(result == 0);
 
+		mOverlay = std::make_unique<PerformanceOverlay>(*mResources);
+
 		// Start with the program selection prompt
-		mProcess = std::make_unique<ProgramSelect>();
+		mProcess = std::make_unique<ProgramSelect>(*mResources);
 	}
 
 	System::~System()
 	{
+		// Processes may own textures, which have to go before the renderer
+		mProcess.reset();
+		mOverlay.reset();
+		mResources.reset();
+
 		SDL_DestroyRenderer(mRenderer);
 		SDL_DestroyWindow(mWindow);
 
-		TTF_Quit();
 		SDL_Quit();
+
+		TRACE_FLUSH();
+		LATENCY_REPORT();
+		PROFILE_REPORT();
 	}
 
 	void System::Run()
@@ -50,37 +62,83 @@ namespace chip8
 		bool quit = false;
 		while (!quit)
 		{
+			TRACE_SCOPE("Frame");
+			auto frameStart = std::chrono::steady_clock::now();
+
+			LATENCY_FRAME();
+
 			// Process any system events
-			SDL_Event event;
-			while (!quit && SDL_PollEvent(&event))
 			{
-				switch (event.type)
+				TRACE_SCOPE("Events");
+
+				SDL_Event event;
+				while (!quit && SDL_PollEvent(&event))
 				{
-				case SDL_KEYDOWN:
-					mProcess->OnKeyDown(event.key.keysym);
-					break;
-				case SDL_KEYUP:
-					mProcess->OnKeyUp(event.key.keysym);
-					break;
-				case SDL_QUIT:
-					quit = true;
-					break;
+					switch (event.type)
+					{
+					case SDL_KEYDOWN:
+						if (event.key.keysym.scancode == SDL_SCANCODE_F3)
+							mOverlay->Toggle();
+						else
+							mProcess->OnKeyDown(event.key);
+						break;
+					case SDL_KEYUP:
+						mProcess->OnKeyUp(event.key);
+						break;
+					case SDL_QUIT:
+						quit = true;
+						break;
+					}
 				}
 			}
 
 			// Update the process a little
-			mProcess->Render(mRenderer);
+			auto renderStart = std::chrono::steady_clock::now();
+			{
+				TRACE_SCOPE("Process::Render");
+				mProcess->Render(mRenderer);
+			}
+			auto renderEnd = std::chrono::steady_clock::now();
+
+			{
+				TRACE_SCOPE("PerformanceOverlay::Render");
+				mOverlay->Render(mRenderer);
+			}
 
 			// Blit to screen
-			SDL_RenderPresent(mRenderer);
+			auto presentStart = std::chrono::steady_clock::now();
+			{
+				TRACE_SCOPE("SDL_RenderPresent");
+				SDL_RenderPresent(mRenderer);
+			}
+			LATENCY_PRESENTED();
+			auto presentEnd = std::chrono::steady_clock::now();
+
+			// Sleep while the process has nothing to do, waking early for input. The sleep isn't
+			// part of the frame's time, or waiting on a key would look like dropped frames.
+			auto idleStart = std::chrono::steady_clock::now();
+			if (uint32_t idleTime = mProcess->IdleTime(); idleTime > 0)
+			{
+				TRACE_SCOPE("Idle");
+				SDL_WaitEventTimeout(nullptr, idleTime);
+			}
+			auto idleEnd = std::chrono::steady_clock::now();
+
+			mOverlay->AddFrame(idleStart - frameStart, idleEnd - idleStart, renderEnd - renderStart, presentEnd - presentStart, mProcess->GetStats());
 
 			// Check if the process want to switch out
 			if (mProcess->Finished())
+			{
+				TRACE_SCOPE("Process switch");
 				mProcess = mProcess->NextProcess();
+			}
 
 			// If there's no process, return to the program select
 			if (mProcess == nullptr)
-				mProcess = std::make_unique<ProgramSelect>();
+			{
+				TRACE_SCOPE("Process switch");
+				mProcess = std::make_unique<ProgramSelect>(*mResources);
+			}
 		}
 	}
 }
\ No newline at end of file
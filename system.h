@@ -1,7 +1,9 @@
 #ifndef CHIP8_SYSTEM_H
 #define CHIP8_SYSTEM_H
 
+#include "performance_overlay.h"
 #include "process.h"
+#include "resources.h"
 
 #include "SDL.h"
 
@@ -18,8 +20,14 @@ namespace chip8
 		void Run();
 
 	private:
+		// Created before and destroyed after the processes which use it
+		std::unique_ptr<Resources> mResources;
+
 		std::unique_ptr<Process> mProcess;
 
+		// Toggled with F3
+		std::unique_ptr<PerformanceOverlay> mOverlay;
+
 		SDL_Window* mWindow;
 		SDL_Renderer* mRenderer;
 	};
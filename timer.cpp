@@ -1,18 +1,23 @@
 #include "timer.h"
 
+namespace
+{
+	constexpr uint32_t kUpdateFrequency = 60;
+
+	// Converted before dividing, a second divided by 60 in whole seconds is zero
+	constexpr auto kDecrementPeriod = std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::seconds(1)) / kUpdateFrequency;
+}
+
 namespace chip8
 {
-	void Timer::SetValue(uint8_t value)
+	void Timer::SetValue(uint8_t value, ClockType::time_point now)
 	{
-		mLastUpdate = ClockType::now();
+		mLastUpdate = now;
 		mLastValue = value;
 	}
 
-	uint8_t Timer::GetValue()
+	uint8_t Timer::GetValue(ClockType::time_point now)
 	{
-		constexpr uint32_t kUpdateFrequency = 60;
-
-		ClockType::time_point now = ClockType::now();
 		ClockType::duration timeSinceUpdate = now - mLastUpdate;
 
 		// Timers decrement at frequency of 60 hertz
@@ -22,8 +27,17 @@ namespace chip8
 		mLastValue = decrementCount > mLastValue ? 0 : mLastValue - decrementCount;
 
 		// Update the last time the value was changed
-		mLastUpdate += decrementCount * std::chrono::duration_cast<ClockType::duration>(std::chrono::seconds(1) / kUpdateFrequency);
+		mLastUpdate += decrementCount * kDecrementPeriod;
 
 		return mLastValue;
 	}
+
+	Timer::ClockType::duration Timer::TimeUntilDecrement(ClockType::time_point now)
+	{
+		// Bring the value up to date first
+		if (GetValue(now) == 0)
+			return ClockType::duration::max();
+
+		return mLastUpdate + kDecrementPeriod - now;
+	}
 }
\ No newline at end of file
@@ -7,16 +7,21 @@
 
 namespace chip8
 {
+	// Counts down at 60hz from the value last set. The time is passed in rather than read from the
+	// host clock, so that a program can run its timers on emulated time.
 	class Timer
 	{
+	public:
 		using ClockType = std::chrono::steady_clock;
 
-	public:
-		void SetValue(uint8_t value);
-		uint8_t GetValue();
+		void SetValue(uint8_t value, ClockType::time_point now);
+		uint8_t GetValue(ClockType::time_point now);
+
+		// Time until the value next decrements, or max() if it has reached zero
+		ClockType::duration TimeUntilDecrement(ClockType::time_point now);
 
 	private:
-		ClockType::time_point mLastUpdate = ClockType::now();
+		ClockType::time_point mLastUpdate;
 		uint8_t mLastValue = 0;
 	};
 }
@@ -0,0 +1,111 @@
+#include "tracer.h"
+
+#ifdef CHIP8_TRACE
+
+#include "log.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace
+{
+	using ClockType = std::chrono::steady_clock;
+
+	constexpr char kTraceFile[] = "chip8_trace.json";
+
+	// Events kept per thread, older events are overwritten once this is exceeded.
+	// At a few events per frame this covers several minutes.
+	constexpr size_t kBufferCapacity = 256 * 1024;
+
+	struct Event
+	{
+		const char* name;
+		ClockType::time_point start;
+		ClockType::time_point end;
+	};
+
+	// Only the owning thread writes to a buffer. The count is published after each
+	// event is written, so Flush can read everything before it without locking.
+	struct ThreadBuffer
+	{
+		uint32_t threadId = 0;
+		std::atomic_uint64_t count = 0;
+		Event events[kBufferCapacity];
+	};
+
+	const ClockType::time_point sTraceStart = ClockType::now();
+
+	// Buffers are kept after their thread exits, so that their events still get flushed
+	std::mutex sBuffersMutex;
+	std::vector<std::unique_ptr<ThreadBuffer>> sBuffers;
+
+	ThreadBuffer* RegisterThread()
+	{
+		std::lock_guard<std::mutex> lock(sBuffersMutex);
+
+		auto buffer = std::make_unique<ThreadBuffer>();
+		buffer->threadId = static_cast<uint32_t>(sBuffers.size()) + 1;
+		sBuffers.push_back(std::move(buffer));
+		return sBuffers.back().get();
+	}
+
+	double Microseconds(ClockType::duration duration)
+	{
+		return std::chrono::duration<double, std::micro>(duration).count();
+	}
+}
+
+namespace chip8
+{
+	void Tracer::Record(const char* name, ClockType::time_point start, ClockType::time_point end)
+	{
+		thread_local ThreadBuffer* tBuffer = RegisterThread();
+
+		uint64_t index = tBuffer->count.load(std::memory_order_relaxed);
+		tBuffer->events[index % kBufferCapacity] = { name, start, end };
+		tBuffer->count.store(index + 1, std::memory_order_release);
+	}
+
+	void Tracer::Flush()
+	{
+		FILE* file = fopen(kTraceFile, "w");
+		assert(file != nullptr);
+		if (file == nullptr)
+			return;
+
+		std::lock_guard<std::mutex> lock(sBuffersMutex);
+
+		fprintf(file, "{\"traceEvents\":[");
+
+		bool first = true;
+		for (const auto& buffer : sBuffers)
+		{
+			uint64_t count = buffer->count.load(std::memory_order_acquire);
+			uint64_t begin = count > kBufferCapacity ? count - kBufferCapacity : 0;
+			if (begin > 0)
+				LOG_WARNING("Trace buffer for thread %u overflowed, dropped %llu events", buffer->threadId, static_cast<unsigned long long>(begin));
+
+			for (uint64_t index = begin; index < count; index++)
+			{
+				const Event& event = buffer->events[index % kBufferCapacity];
+				fprintf(file, "%s\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%u,\"ts\":%.3f,\"dur\":%.3f}",
+					first ? "" : ",",
+					event.name,
+					buffer->threadId,
+					Microseconds(event.start - sTraceStart),
+					Microseconds(event.end - event.start));
+				first = false;
+			}
+		}
+
+		fprintf(file, "\n],\"displayTimeUnit\":\"ms\"}\n");
+		fclose(file);
+	}
+}
+
+#endif // CHIP8_TRACE
@@ -0,0 +1,53 @@
+#ifndef CHIP8_TRACER_H
+#define CHIP8_TRACER_H
+
+// Timeline tracing is only compiled in when CHIP8_TRACE is defined, the
+// TRACE_ macros below expand to nothing otherwise.
+#ifdef CHIP8_TRACE
+
+#include <chrono>
+
+namespace chip8
+{
+	// Records timed events to a buffer owned by the calling thread, which are
+	// written out as Chrome trace event JSON (chrome://tracing, Perfetto) by Flush.
+	class Tracer
+	{
+		using ClockType = std::chrono::steady_clock;
+
+	public:
+		// name must outlive the tracer, normally it's a string literal
+		static void Record(const char* name, ClockType::time_point start, ClockType::time_point end);
+
+		static void Flush();
+
+		class Scope
+		{
+		public:
+			Scope(const char* name) : mName(name), mStart(ClockType::now()) {}
+			~Scope() { Record(mName, mStart, ClockType::now()); }
+
+			Scope(const Scope&) = delete;
+			Scope& operator=(const Scope&) = delete;
+
+		private:
+			const char* mName;
+			ClockType::time_point mStart;
+		};
+	};
+}
+
+#define TRACE_SCOPE_NAME_(line) traceScope##line
+#define TRACE_SCOPE_NAME(line) TRACE_SCOPE_NAME_(line)
+
+#define TRACE_SCOPE(name) chip8::Tracer::Scope TRACE_SCOPE_NAME(__LINE__)(name)
+#define TRACE_FLUSH() chip8::Tracer::Flush()
+
+#else
+
+#define TRACE_SCOPE(name) do {} while(0)
+#define TRACE_FLUSH() do {} while(0)
+
+#endif // CHIP8_TRACE
+
+#endif // CHIP8_TRACER_H
@@ -0,0 +1,82 @@
+#include "worker_pool.h"
+
+#include <algorithm>
+#include <cassert>
+
+namespace chip8
+{
+	WorkerPool::WorkerPool(size_t threadCount)
+	{
+		if (threadCount == 0)
+			threadCount = std::max(1u, std::thread::hardware_concurrency());
+
+		// The thread calling Run makes up the last one
+		for (size_t i = 1; i < threadCount; i++)
+			mThreads.emplace_back(&WorkerPool::WorkerMain, this);
+	}
+
+	WorkerPool::~WorkerPool()
+	{
+		{
+			std::lock_guard<std::mutex> lock(mMutex);
+			mStopping = true;
+		}
+		mBatchStarted.notify_all();
+
+		for (std::thread& thread : mThreads)
+			thread.join();
+	}
+
+	void WorkerPool::Run(size_t count, const std::function<void(size_t index)>& task)
+	{
+		if (count == 0)
+			return;
+
+		std::unique_lock<std::mutex> lock(mMutex);
+		assert(mTask == nullptr); // Not reentrant
+
+		mTask = &task;
+		mCount = count;
+		mNext = 0;
+		mRemaining = count;
+		mBatch++;
+		mBatchStarted.notify_all();
+
+		Work(lock);
+
+		mBatchFinished.wait(lock, [this]() { return mRemaining == 0; });
+		mTask = nullptr;
+	}
+
+	void WorkerPool::WorkerMain()
+	{
+		std::unique_lock<std::mutex> lock(mMutex);
+		uint64_t lastBatch = 0;
+
+		while (true)
+		{
+			mBatchStarted.wait(lock, [&]() { return mStopping || (mTask != nullptr && mBatch != lastBatch); });
+			if (mStopping)
+				return;
+
+			lastBatch = mBatch;
+			Work(lock);
+		}
+	}
+
+	void WorkerPool::Work(std::unique_lock<std::mutex>& lock)
+	{
+		while (mNext < mCount)
+		{
+			size_t index = mNext++;
+			const std::function<void(size_t)>& task = *mTask;
+
+			lock.unlock();
+			task(index);
+			lock.lock();
+
+			if (--mRemaining == 0)
+				mBatchFinished.notify_all();
+		}
+	}
+}
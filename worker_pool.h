@@ -0,0 +1,55 @@
+#ifndef CHIP8_WORKER_POOL_H
+#define CHIP8_WORKER_POOL_H
+
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace chip8
+{
+	// Fixed set of threads which run batches of independent tasks
+	class WorkerPool
+	{
+	public:
+		// Defaults to one thread per hardware thread
+		explicit WorkerPool(size_t threadCount = 0);
+		~WorkerPool();
+
+		WorkerPool(const WorkerPool&) = delete;
+		WorkerPool& operator=(const WorkerPool&) = delete;
+
+		// Calls task for every index in [0, count) across the pool, and returns once all are done.
+		// The calling thread works on the batch too.
+		void Run(size_t count, const std::function<void(size_t index)>& task);
+
+		size_t ThreadCount() const { return mThreads.size() + 1; }
+
+	private:
+		void WorkerMain();
+
+		// Runs tasks from the current batch until there are none left
+		void Work(std::unique_lock<std::mutex>& lock);
+
+	private:
+		std::vector<std::thread> mThreads;
+
+		std::mutex mMutex;
+		std::condition_variable mBatchStarted;
+		std::condition_variable mBatchFinished;
+
+		// The current batch
+		const std::function<void(size_t)>* mTask = nullptr;
+		size_t mCount = 0;
+		size_t mNext = 0;
+		size_t mRemaining = 0;
+		uint64_t mBatch = 0;
+
+		bool mStopping = false;
+	};
+}
+
+#endif // CHIP8_WORKER_POOL_H
@@ -0,0 +1,608 @@
+#include "zip_archive.h"
+
+#include "log.h"
+
+#include <algorithm>
+#include <array>
+#include <cstdio>
+#include <cstring>
+#include <map>
+#include <mutex>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace
+{
+	constexpr char kArchiveExtension[] = ".zip";
+
+	// See https://pkware.cachefly.net/webdocs/casestudies/APPNOTE.TXT
+	constexpr uint32_t kEndOfCentralDirectorySignature = 0x06054B50;
+	constexpr uint32_t kCentralDirectoryHeaderSignature = 0x02014B50;
+	constexpr uint32_t kLocalHeaderSignature = 0x04034B50;
+
+	constexpr size_t kEndOfCentralDirectorySize = 22;
+	constexpr size_t kCentralDirectoryHeaderSize = 46;
+	constexpr size_t kLocalHeaderSize = 30;
+	constexpr size_t kMaxCommentSize = 0xFFFF;
+
+	constexpr uint16_t kMethodStored = 0;
+	constexpr uint16_t kMethodDeflated = 8;
+	constexpr uint16_t kFlagEncrypted = 1 << 0;
+
+	uint16_t Read16(const uint8_t* data)
+	{
+		return static_cast<uint16_t>(data[0] | (data[1] << 8));
+	}
+
+	uint32_t Read32(const uint8_t* data)
+	{
+		return data[0] | (data[1] << 8) | (data[2] << 16) | (static_cast<uint32_t>(data[3]) << 24);
+	}
+
+	uint32_t Crc32(const uint8_t* data, size_t size)
+	{
+		static const std::array<uint32_t, 256> kTable = []() {
+			std::array<uint32_t, 256> table;
+			for (uint32_t index = 0; index < table.size(); index++)
+			{
+				uint32_t crc = index;
+				for (int bit = 0; bit < 8; bit++)
+					crc = (crc & 1) ? (crc >> 1) ^ 0xEDB88320 : crc >> 1;
+				table[index] = crc;
+			}
+			return table;
+		}();
+
+		uint32_t crc = 0xFFFFFFFF;
+		for (size_t index = 0; index < size; index++)
+			crc = kTable[(crc ^ data[index]) & 0xFF] ^ (crc >> 8);
+		return crc ^ 0xFFFFFFFF;
+	}
+
+	// Raw DEFLATE (RFC 1951). ROMs are only a few kilobytes, so this decodes a bit at a time
+	// rather than with lookup tables.
+	class Inflater
+	{
+	public:
+		Inflater(const uint8_t* input, size_t inputSize, uint8_t* output, size_t outputSize)
+			: mInput(input)
+			, mInputSize(inputSize)
+			, mOutput(output)
+			, mOutputSize(outputSize)
+		{
+		}
+
+		bool Run()
+		{
+			bool last = false;
+			while (!last)
+			{
+				last = ReadBits(1) == 1;
+				bool valid = false;
+				switch (ReadBits(2))
+				{
+				case 0:
+					valid = Stored();
+					break;
+				case 1:
+					valid = FixedBlock();
+					break;
+				case 2:
+					valid = DynamicBlock();
+					break;
+				}
+
+				if (!valid || mOverrun)
+					return false;
+			}
+
+			return mOutputPosition == mOutputSize;
+		}
+
+	private:
+		static constexpr int kMaxBits = 15;
+		static constexpr size_t kNumLengthCodes = 288;
+		static constexpr size_t kNumDistanceCodes = 30;
+
+		// Canonical Huffman code, as the number of codes of each length and the symbols in code order
+		struct Huffman
+		{
+			uint16_t counts[kMaxBits + 1];
+			uint16_t symbols[kNumLengthCodes];
+		};
+
+		uint32_t ReadBits(int count)
+		{
+			while (mBitCount < count)
+			{
+				if (mInputPosition < mInputSize)
+					mBits |= static_cast<uint32_t>(mInput[mInputPosition++]) << mBitCount;
+				else
+					mOverrun = true;
+				mBitCount += 8;
+			}
+
+			uint32_t value = mBits & ((1u << count) - 1);
+			mBits >>= count;
+			mBitCount -= count;
+			return value;
+		}
+
+		static bool Build(Huffman& huffman, const uint8_t* lengths, size_t count)
+		{
+			std::fill(std::begin(huffman.counts), std::end(huffman.counts), 0);
+			for (size_t symbol = 0; symbol < count; symbol++)
+				huffman.counts[lengths[symbol]]++;
+
+			// More codes of a length than there's room for can't be decoded. Fewer is allowed,
+			// e.g. a single distance code.
+			int left = 1;
+			for (int length = 1; length <= kMaxBits; length++)
+			{
+				left = (left << 1) - huffman.counts[length];
+				if (left < 0)
+					return false;
+			}
+
+			uint16_t offsets[kMaxBits + 1];
+			offsets[1] = 0;
+			for (int length = 1; length < kMaxBits; length++)
+				offsets[length + 1] = offsets[length] + huffman.counts[length];
+
+			for (size_t symbol = 0; symbol < count; symbol++)
+			{
+				if (lengths[symbol] != 0)
+					huffman.symbols[offsets[lengths[symbol]]++] = static_cast<uint16_t>(symbol);
+			}
+			return true;
+		}
+
+		int Decode(const Huffman& huffman)
+		{
+			int code = 0;
+			int first = 0;
+			int index = 0;
+			for (int length = 1; length <= kMaxBits; length++)
+			{
+				code |= ReadBits(1);
+				int count = huffman.counts[length];
+				if (code - first < count)
+					return huffman.symbols[index + code - first];
+
+				index += count;
+				first = (first + count) << 1;
+				code <<= 1;
+			}
+			return -1;
+		}
+
+		bool Stored()
+		{
+			// The length starts on the next byte
+			mBits = 0;
+			mBitCount = 0;
+
+			if (mInputSize - mInputPosition < 4)
+				return false;
+			uint16_t length = Read16(mInput + mInputPosition);
+			uint16_t complement = Read16(mInput + mInputPosition + 2);
+			mInputPosition += 4;
+
+			if (length != static_cast<uint16_t>(~complement) || length > mInputSize - mInputPosition || length > mOutputSize - mOutputPosition)
+				return false;
+
+			std::memcpy(mOutput + mOutputPosition, mInput + mInputPosition, length);
+			mInputPosition += length;
+			mOutputPosition += length;
+			return true;
+		}
+
+		bool FixedBlock()
+		{
+			static const std::pair<Huffman, Huffman> kFixed = []() {
+				uint8_t lengths[kNumLengthCodes];
+				std::fill(lengths, lengths + 144, 8);
+				std::fill(lengths + 144, lengths + 256, 9);
+				std::fill(lengths + 256, lengths + 280, 7);
+				std::fill(lengths + 280, lengths + kNumLengthCodes, 8);
+
+				std::pair<Huffman, Huffman> fixed;
+				Build(fixed.first, lengths, kNumLengthCodes);
+				std::fill(lengths, lengths + kNumDistanceCodes, 5);
+				Build(fixed.second, lengths, kNumDistanceCodes);
+				return fixed;
+			}();
+
+			return Codes(kFixed.first, kFixed.second);
+		}
+
+		bool DynamicBlock()
+		{
+			static constexpr uint8_t kCodeLengthOrder[] = { 16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15 };
+
+			size_t lengthCount = ReadBits(5) + 257;
+			size_t distanceCount = ReadBits(5) + 1;
+			size_t codeLengthCount = ReadBits(4) + 4;
+			if (lengthCount > kNumLengthCodes || distanceCount > kNumDistanceCodes)
+				return false;
+
+			uint8_t lengths[kNumLengthCodes + kNumDistanceCodes] = {};
+			for (size_t index = 0; index < codeLengthCount; index++)
+				lengths[kCodeLengthOrder[index]] = static_cast<uint8_t>(ReadBits(3));
+
+			Huffman codeLengths;
+			if (!Build(codeLengths, lengths, std::size(kCodeLengthOrder)))
+				return false;
+
+			// The lengths of both codes are one sequence, and repeats can run from one into the other
+			std::fill(std::begin(lengths), std::end(lengths), 0);
+			size_t index = 0;
+			while (index < lengthCount + distanceCount)
+			{
+				int symbol = Decode(codeLengths);
+				if (symbol < 0 || mOverrun)
+					return false;
+
+				if (symbol < 16)
+				{
+					lengths[index++] = static_cast<uint8_t>(symbol);
+					continue;
+				}
+
+				uint8_t length = 0;
+				size_t repeat;
+				if (symbol == 16)
+				{
+					if (index == 0)
+						return false;
+					length = lengths[index - 1];
+					repeat = 3 + ReadBits(2);
+				}
+				else if (symbol == 17)
+				{
+					repeat = 3 + ReadBits(3);
+				}
+				else
+				{
+					repeat = 11 + ReadBits(7);
+				}
+
+				if (index + repeat > lengthCount + distanceCount)
+					return false;
+				std::fill(lengths + index, lengths + index + repeat, length);
+				index += repeat;
+			}
+
+			// Without an end of block code the block never finishes
+			if (lengths[256] == 0)
+				return false;
+
+			Huffman lengthCodes;
+			Huffman distanceCodes;
+			if (!Build(lengthCodes, lengths, lengthCount) || !Build(distanceCodes, lengths + lengthCount, distanceCount))
+				return false;
+
+			return Codes(lengthCodes, distanceCodes);
+		}
+
+		bool Codes(const Huffman& lengthCodes, const Huffman& distanceCodes)
+		{
+			static constexpr uint16_t kLengthBase[] = { 3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31, 35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258 };
+			static constexpr uint8_t kLengthExtra[] = { 0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0 };
+			static constexpr uint16_t kDistanceBase[] = { 1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193, 257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577 };
+			static constexpr uint8_t kDistanceExtra[] = { 0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6, 7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13 };
+
+			while (true)
+			{
+				int symbol = Decode(lengthCodes);
+				if (symbol < 0 || mOverrun)
+					return false;
+
+				if (symbol < 256)
+				{
+					if (mOutputPosition == mOutputSize)
+						return false;
+					mOutput[mOutputPosition++] = static_cast<uint8_t>(symbol);
+					continue;
+				}
+
+				if (symbol == 256)
+					return true;
+
+				symbol -= 257;
+				if (symbol >= static_cast<int>(std::size(kLengthBase)))
+					return false;
+				size_t length = kLengthBase[symbol] + ReadBits(kLengthExtra[symbol]);
+
+				int distanceSymbol = Decode(distanceCodes);
+				if (distanceSymbol < 0 || distanceSymbol >= static_cast<int>(std::size(kDistanceBase)))
+					return false;
+				size_t distance = kDistanceBase[distanceSymbol] + ReadBits(kDistanceExtra[distanceSymbol]);
+
+				if (distance > mOutputPosition || length > mOutputSize - mOutputPosition)
+					return false;
+
+				// Byte by byte, the copy can overlap what it's writing
+				for (size_t index = 0; index < length; index++, mOutputPosition++)
+					mOutput[mOutputPosition] = mOutput[mOutputPosition - distance];
+			}
+		}
+
+	private:
+		const uint8_t* mInput;
+		size_t mInputSize;
+		size_t mInputPosition = 0;
+
+		uint32_t mBits = 0;
+		int mBitCount = 0;
+		bool mOverrun = false;
+
+		uint8_t* mOutput;
+		size_t mOutputSize;
+		size_t mOutputPosition = 0;
+	};
+}
+
+namespace chip8
+{
+	std::shared_ptr<const ZipArchive> ZipArchive::Open(const std::filesystem::path& path)
+	{
+		// Browsing and loading open the same archives over and over, so share them while in use
+		static std::mutex sOpenMutex;
+		static std::map<std::filesystem::path, std::weak_ptr<const ZipArchive>> sOpen;
+
+		std::lock_guard<std::mutex> lock(sOpenMutex);
+
+		std::filesystem::path key = std::filesystem::weakly_canonical(path);
+		auto found = sOpen.find(key);
+		if (found != sOpen.end())
+		{
+			if (std::shared_ptr<const ZipArchive> open = found->second.lock())
+				return open;
+		}
+
+		// Forget archives nothing holds any more, before they pile up
+		for (auto entry = sOpen.begin(); entry != sOpen.end();)
+		{
+			if (entry->second.expired())
+				entry = sOpen.erase(entry);
+			else
+				++entry;
+		}
+
+		std::shared_ptr<ZipArchive> archive(new ZipArchive());
+		if (!archive->Map(path))
+			return nullptr;
+
+		if (!archive->ReadCentralDirectory())
+		{
+			LOG_WARNING("%s isn't a zip archive this can read", path.string().c_str());
+			return nullptr;
+		}
+
+		sOpen[key] = archive;
+		return archive;
+	}
+
+	bool ZipArchive::Split(const std::filesystem::path& path, std::filesystem::path& archive, std::string& name)
+	{
+		std::error_code error;
+		for (std::filesystem::path parent = path; parent.has_relative_path(); parent = parent.parent_path())
+		{
+			if (parent.extension() == kArchiveExtension && std::filesystem::is_regular_file(parent, error))
+			{
+				archive = parent;
+				name = path.lexically_relative(parent).generic_string();
+				if (name == ".")
+					name.clear();
+				return true;
+			}
+		}
+
+		return false;
+	}
+
+	ZipArchive::~ZipArchive()
+	{
+#ifndef _WIN32
+		if (mData != nullptr)
+			munmap(const_cast<uint8_t*>(mData), mSize);
+#endif
+	}
+
+	bool ZipArchive::Map(const std::filesystem::path& path)
+	{
+#ifdef _WIN32
+		FILE* file = _wfopen(path.c_str(), L"rb");
+		if (file == nullptr)
+			return false;
+
+		fseek(file, 0, SEEK_END);
+		long fileSize = ftell(file);
+		fseek(file, 0, SEEK_SET);
+		if (fileSize > 0)
+		{
+			mBuffer.resize(fileSize);
+			if (fread(mBuffer.data(), fileSize, 1, file) != 1)
+				mBuffer.clear();
+		}
+		fclose(file);
+
+		mData = mBuffer.data();
+		mSize = mBuffer.size();
+		return mSize > 0;
+#else
+		int file = open(path.c_str(), O_RDONLY);
+		if (file < 0)
+			return false;
+
+		struct stat fileStat;
+		if (fstat(file, &fileStat) != 0 || fileStat.st_size == 0)
+		{
+			close(file);
+			return false;
+		}
+
+		// Only the pages touched are read: the central directory now, and entries as they're extracted
+		void* data = mmap(nullptr, fileStat.st_size, PROT_READ, MAP_PRIVATE, file, 0);
+		close(file);
+		if (data == MAP_FAILED)
+			return false;
+
+		mData = static_cast<const uint8_t*>(data);
+		mSize = fileStat.st_size;
+		return true;
+#endif
+	}
+
+	bool ZipArchive::ReadCentralDirectory()
+	{
+		// The end of central directory record is last, followed only by a comment
+		if (mSize < kEndOfCentralDirectorySize)
+			return false;
+
+		size_t searchEnd = mSize > kEndOfCentralDirectorySize + kMaxCommentSize ? mSize - kEndOfCentralDirectorySize - kMaxCommentSize : 0;
+		const uint8_t* end = nullptr;
+		for (size_t offset = mSize - kEndOfCentralDirectorySize + 1; offset-- > searchEnd;)
+		{
+			if (Read32(mData + offset) == kEndOfCentralDirectorySignature)
+			{
+				end = mData + offset;
+				break;
+			}
+		}
+		if (end == nullptr)
+			return false;
+
+		// Multiple disks and zip64 aren't supported, ROM packs don't get that big
+		uint16_t entryCount = Read16(end + 10);
+		uint32_t directorySize = Read32(end + 12);
+		uint32_t directoryOffset = Read32(end + 16);
+		if (Read16(end + 4) != 0 || Read16(end + 6) != 0 || directoryOffset > mSize || directorySize > mSize - directoryOffset)
+			return false;
+
+		mEntries.reserve(entryCount);
+		const uint8_t* header = mData + directoryOffset;
+		const uint8_t* directoryEnd = header + directorySize;
+		for (uint16_t index = 0; index < entryCount; index++)
+		{
+			if (directoryEnd - header < static_cast<ptrdiff_t>(kCentralDirectoryHeaderSize) || Read32(header) != kCentralDirectoryHeaderSignature)
+				return false;
+
+			uint16_t nameSize = Read16(header + 28);
+			size_t headerSize = kCentralDirectoryHeaderSize + nameSize + Read16(header + 30) + Read16(header + 32);
+			if (static_cast<size_t>(directoryEnd - header) < headerSize)
+				return false;
+
+			// Encrypted entries are left out, they can't be loaded anyway
+			if ((Read16(header + 8) & kFlagEncrypted) == 0)
+			{
+				Entry entry;
+				entry.name = std::string_view(reinterpret_cast<const char*>(header + kCentralDirectoryHeaderSize), nameSize);
+				entry.method = Read16(header + 10);
+				entry.crc = Read32(header + 16);
+				entry.compressedSize = Read32(header + 20);
+				entry.size = Read32(header + 24);
+				entry.localHeaderOffset = Read32(header + 42);
+				mEntries.push_back(entry);
+			}
+
+			header += headerSize;
+		}
+
+		std::sort(mEntries.begin(), mEntries.end(), [](const Entry& a, const Entry& b) { return a.name < b.name; });
+		return true;
+	}
+
+	const ZipArchive::Entry* ZipArchive::Find(std::string_view name) const
+	{
+		auto it = std::lower_bound(mEntries.begin(), mEntries.end(), name, [](const Entry& entry, std::string_view name) { return entry.name < name; });
+		if (it == mEntries.end() || it->name != name)
+			return nullptr;
+
+		return &*it;
+	}
+
+	bool ZipArchive::IsDirectory(std::string_view name) const
+	{
+		if (name.empty())
+			return true;
+
+		// Anything named with this as a prefix, whether or not there's an entry for the directory itself
+		std::string prefix(name);
+		if (prefix.back() != '/')
+			prefix += '/';
+
+		auto it = std::lower_bound(mEntries.begin(), mEntries.end(), prefix, [](const Entry& entry, const std::string& prefix) { return entry.name < prefix; });
+		return it != mEntries.end() && it->name.compare(0, prefix.size(), prefix) == 0;
+	}
+
+	std::vector<ZipArchive::Child> ZipArchive::List(std::string_view directory) const
+	{
+		std::string prefix(directory);
+		if (!prefix.empty() && prefix.back() != '/')
+			prefix += '/';
+
+		// Everything within the directory is together, as the entries are sorted
+		std::vector<Child> children;
+		auto it = std::lower_bound(mEntries.begin(), mEntries.end(), prefix, [](const Entry& entry, const std::string& prefix) { return entry.name < prefix; });
+		for (; it != mEntries.end() && it->name.compare(0, prefix.size(), prefix) == 0; ++it)
+		{
+			std::string_view rest = it->name.substr(prefix.size());
+			if (rest.empty())
+				continue; // The directory's own entry
+
+			size_t slash = rest.find('/');
+			Child child{ std::string(rest.substr(0, slash)), slash != std::string_view::npos };
+			if (children.empty() || children.back().name != child.name || children.back().directory != child.directory)
+				children.push_back(std::move(child));
+		}
+
+		// "a.ch8" sorts between the entries of "a" and "a/b.ch8", put them back in name order
+		std::sort(children.begin(), children.end(), [](const Child& a, const Child& b) {
+			return a.name != b.name ? a.name < b.name : a.directory < b.directory;
+		});
+		children.erase(std::unique(children.begin(), children.end(), [](const Child& a, const Child& b) {
+			return a.name == b.name && a.directory == b.directory;
+		}), children.end());
+		return children;
+	}
+
+	bool ZipArchive::Extract(const Entry& entry, uint8_t* output) const
+	{
+		// The local header repeats the name, and can have a different extra field
+		if (entry.localHeaderOffset > mSize || mSize - entry.localHeaderOffset < kLocalHeaderSize)
+			return false;
+
+		const uint8_t* header = mData + entry.localHeaderOffset;
+		if (Read32(header) != kLocalHeaderSignature)
+			return false;
+
+		size_t dataOffset = entry.localHeaderOffset + kLocalHeaderSize + Read16(header + 26) + Read16(header + 28);
+		if (dataOffset > mSize || mSize - dataOffset < entry.compressedSize)
+			return false;
+
+		const uint8_t* data = mData + dataOffset;
+		switch (entry.method)
+		{
+		case kMethodStored:
+			if (entry.compressedSize != entry.size)
+				return false;
+			std::memcpy(output, data, entry.size);
+			break;
+		case kMethodDeflated:
+			if (!Inflater(data, entry.compressedSize, output, entry.size).Run())
+				return false;
+			break;
+		default:
+			return false;
+		}
+
+		return Crc32(output, entry.size) == entry.crc;
+	}
+}
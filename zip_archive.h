@@ -0,0 +1,82 @@
+#ifndef CHIP8_ZIP_ARCHIVE_H
+#define CHIP8_ZIP_ARCHIVE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace chip8
+{
+	// A zip file mapped into memory. Opening it only reads the central directory, which is
+	// indexed by name in place. Entries are inflated on demand, straight into the caller's memory.
+	//
+	// Paths into an archive are written as if it were a directory, e.g. roms.zip/games/pong.ch8.
+	class ZipArchive
+	{
+	public:
+		struct Entry
+		{
+			// Points into the mapping, '/' separated
+			std::string_view name;
+
+			uint16_t method;
+			uint32_t crc;
+			uint32_t compressedSize;
+			uint32_t size;
+			uint32_t localHeaderOffset;
+		};
+
+		struct Child
+		{
+			std::string name;
+			bool directory;
+		};
+
+		// Archives stay open while anything holds them, and are shared. Returns nullptr if the
+		// file can't be read as a zip.
+		static std::shared_ptr<const ZipArchive> Open(const std::filesystem::path& path);
+
+		// Splits a path into the .zip file it passes through and the name within it, which is
+		// empty for the archive itself. Returns false if it doesn't pass through one.
+		static bool Split(const std::filesystem::path& path, std::filesystem::path& archive, std::string& name);
+
+		~ZipArchive();
+
+		ZipArchive(const ZipArchive&) = delete;
+		ZipArchive& operator=(const ZipArchive&) = delete;
+
+		const Entry* Find(std::string_view name) const;
+		bool IsDirectory(std::string_view name) const;
+
+		// What's directly within a directory ("" for the top), in name order. Directories are
+		// included whether the archive has entries for them or not.
+		std::vector<Child> List(std::string_view directory) const;
+
+		// Inflates an entry into output, which must hold entry.size bytes. Returns false if the
+		// entry is corrupt or uses something other than store or deflate.
+		bool Extract(const Entry& entry, uint8_t* output) const;
+
+	private:
+		ZipArchive() = default;
+
+		bool Map(const std::filesystem::path& path);
+		bool ReadCentralDirectory();
+
+	private:
+		const uint8_t* mData = nullptr;
+		size_t mSize = 0;
+
+#ifdef _WIN32
+		std::vector<uint8_t> mBuffer;
+#endif
+
+		// Sorted by name
+		std::vector<Entry> mEntries;
+	};
+}
+
+#endif // CHIP8_ZIP_ARCHIVE_H